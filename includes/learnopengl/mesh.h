@@ -5,9 +5,16 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include <learnopengl/shader.h>
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
 #include <string>
 #include <vector>
 using namespace std;
@@ -31,6 +38,226 @@ struct Vertex {
 	float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// How a Mesh stores its vertices on the GPU. Vertex stays the CPU-side format in every case.
+//   MESH_LAYOUT_FULL     88 bytes, Vertex as it is: attributes 0-6 as listed in setupMesh()
+//   MESH_LAYOUT_STATIC   20 bytes, StaticVertex: no bone data (4.4x smaller)
+//   MESH_LAYOUT_SKINNED  28 bytes, SkinnedVertex: StaticVertex plus 4 bone indices and weights (3.1x smaller)
+// The quantized layouts keep attribute 2 (vec2 uv, from half floats), 5 (ivec4 bone ids, from u8) and
+// 6 (vec4 weights, from unorm8) as shaders declare them for the full layout. Attribute 0 is the position
+// as unorm16 inside the bounds of everything in the buffer, which the shader scales back with the
+// positionOffset and positionScale uniforms that Draw() sets. Normal, tangent and bitangent become one
+// integer attribute 1, "ivec4 aFrame": the octahedral normal in xy and the octahedral tangent in zw as
+// snorm16, the lowest bit of w being the bitangent sign. Attributes 3 and 4 are unused. mesh_quantized.vs
+// next to this file decodes all of it; a skinned vertex may only name bones 0-255, see fitMeshLayout().
+enum MeshLayout
+{
+    MESH_LAYOUT_FULL,
+    MESH_LAYOUT_STATIC,
+    MESH_LAYOUT_SKINNED
+};
+
+struct StaticVertex {
+    uint16_t Position[4];  // unorm16 within the MeshPositionRange, [3] unused
+    int16_t Frame[4];      // octahedral normal, octahedral tangent with the bitangent sign in bit 0 of [3]
+    uint16_t TexCoords[2]; // half floats
+};
+
+struct SkinnedVertex {
+    uint16_t Position[4];
+    int16_t Frame[4];
+    uint16_t TexCoords[2];
+    uint8_t BoneIDs[4];
+    uint8_t Weights[4];    // unorm8, summing to 255
+};
+static_assert(sizeof(StaticVertex) == 20 && sizeof(SkinnedVertex) == 28, "quantized vertices are tightly packed");
+
+// the box the quantized positions of one vertex buffer are stored in
+struct MeshPositionRange
+{
+    glm::vec3 lo = glm::vec3(FLT_MAX);
+    glm::vec3 hi = glm::vec3(-FLT_MAX);
+
+    void include(const vector<Vertex> &vertices)
+    {
+        for (const Vertex &vertex : vertices)
+        {
+            lo = glm::min(lo, vertex.Position);
+            hi = glm::max(hi, vertex.Position);
+        }
+    }
+
+    // what unorm16 0 and the step to unorm16 1.0 stand for
+    glm::vec3 offset() const
+    {
+        return lo.x <= hi.x ? lo : glm::vec3(0.0f);
+    }
+
+    glm::vec3 scale() const
+    {
+        return lo.x <= hi.x ? hi - lo : glm::vec3(0.0f);
+    }
+};
+
+inline size_t meshLayoutStride(MeshLayout layout)
+{
+    return layout == MESH_LAYOUT_STATIC ? sizeof(StaticVertex) : layout == MESH_LAYOUT_SKINNED ? sizeof(SkinnedVertex) : sizeof(Vertex);
+}
+
+// octahedral encoding: the unit vector is projected onto the octahedron |x| + |y| + |z| = 1, whose lower
+// half is folded over the upper one, and the resulting square is stored as two snorm16
+inline void encodeOctahedral(glm::vec3 v, int16_t &x, int16_t &y)
+{
+    float length = std::fabs(v.x) + std::fabs(v.y) + std::fabs(v.z);
+    glm::vec2 p = length > 0.0f ? glm::vec2(v.x, v.y) / length : glm::vec2(0.0f);
+    if (length > 0.0f && v.z < 0.0f)
+        p = (glm::vec2(1.0f) - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+    x = static_cast<int16_t>(std::lround(glm::clamp(p.x, -1.0f, 1.0f) * 32767.0f));
+    y = static_cast<int16_t>(std::lround(glm::clamp(p.y, -1.0f, 1.0f) * 32767.0f));
+}
+
+// the decoder of the GLSL above, for checking an encoded frame on the CPU
+inline glm::vec3 decodeOctahedral(int16_t x, int16_t y)
+{
+    glm::vec2 e(x / 32767.0f, y / 32767.0f);
+    glm::vec3 v(e, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+    if (v.z < 0.0f)
+        v = glm::vec3((glm::vec2(1.0f) - glm::abs(glm::vec2(v.y, v.x))) * glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f), v.z);
+    return glm::normalize(v);
+}
+
+// fills the shared part of the quantized vertices
+inline void quantizeVertex(const Vertex &vertex, const MeshPositionRange &range, uint16_t position[4], int16_t frame[4], uint16_t texCoords[2])
+{
+    const glm::vec3 offset = range.offset(), scale = range.scale();
+    for (int i = 0; i < 3; i++)
+    {
+        float t = scale[i] > 0.0f ? (vertex.Position[i] - offset[i]) / scale[i] : 0.0f;
+        position[i] = static_cast<uint16_t>(std::lround(glm::clamp(t, 0.0f, 1.0f) * 65535.0f));
+    }
+    position[3] = 0;
+    encodeOctahedral(vertex.Normal, frame[0], frame[1]);
+    encodeOctahedral(vertex.Tangent, frame[2], frame[3]);
+    bool flipped = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f;
+    frame[3] = static_cast<int16_t>((frame[3] & ~1) | (flipped ? 1 : 0));
+    texCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+    texCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+}
+
+// the layout vertices can actually be stored in: the skinned layout keeps bone ids in 8 bits, so vertices
+// that name bone 256 or above keep the full layout, with a warning, rather than lose those bones
+inline MeshLayout fitMeshLayout(const vector<Vertex> &vertices, MeshLayout layout)
+{
+    if (layout != MESH_LAYOUT_SKINNED)
+        return layout;
+    for (const Vertex &vertex : vertices)
+        for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+            if (vertex.m_BoneIDs[i] >= 256)
+            {
+                cout << "MESH::LAYOUT:: bone " << vertex.m_BoneIDs[i] << " does not fit the 8-bit ids of MESH_LAYOUT_SKINNED, using MESH_LAYOUT_FULL" << endl;
+                return MESH_LAYOUT_FULL;
+            }
+    return layout;
+}
+
+// bone ids to u8 (unused slots, id < 0, get weight 0; so do ids >= 256, which fitMeshLayout() keeps out)
+// and weights to unorm8 that still add up to exactly 255: the rounding error goes to the largest weight
+inline void quantizeBones(const Vertex &vertex, uint8_t boneIDs[4], uint8_t weights[4])
+{
+    float total = 0.0f;
+    for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+        if (vertex.m_BoneIDs[i] >= 0 && vertex.m_BoneIDs[i] < 256)
+            total += std::max(vertex.m_Weights[i], 0.0f);
+    int sum = 0, largest = 0;
+    for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+    {
+        bool used = vertex.m_BoneIDs[i] >= 0 && vertex.m_BoneIDs[i] < 256 && total > 0.0f;
+        boneIDs[i] = used ? static_cast<uint8_t>(vertex.m_BoneIDs[i]) : 0;
+        weights[i] = used ? static_cast<uint8_t>(std::lround(std::max(vertex.m_Weights[i], 0.0f) / total * 255.0f)) : 0;
+        sum += weights[i];
+        if (weights[i] > weights[largest])
+            largest = i;
+    }
+    if (sum > 0)
+        weights[largest] = static_cast<uint8_t>(weights[largest] + 255 - sum);
+}
+
+// appends vertices to out in the GPU format of layout: the Vertex bytes as they are for MESH_LAYOUT_FULL,
+// StaticVertex or SkinnedVertex otherwise, with the positions quantized within range
+inline void appendMeshVertices(const vector<Vertex> &vertices, MeshLayout layout, const MeshPositionRange &range, vector<unsigned char> &out)
+{
+    const size_t stride = meshLayoutStride(layout);
+    size_t offset = out.size();
+    out.resize(offset + vertices.size() * stride);
+    if (layout == MESH_LAYOUT_FULL)
+    {
+        if (!vertices.empty())
+            memcpy(&out[offset], vertices.data(), vertices.size() * stride);
+        return;
+    }
+    for (size_t i = 0; i < vertices.size(); i++, offset += stride)
+    {
+        if (layout == MESH_LAYOUT_SKINNED)
+        {
+            SkinnedVertex vertex;
+            quantizeVertex(vertices[i], range, vertex.Position, vertex.Frame, vertex.TexCoords);
+            quantizeBones(vertices[i], vertex.BoneIDs, vertex.Weights);
+            memcpy(&out[offset], &vertex, stride);
+        }
+        else
+        {
+            StaticVertex vertex;
+            quantizeVertex(vertices[i], range, vertex.Position, vertex.Frame, vertex.TexCoords);
+            memcpy(&out[offset], &vertex, stride);
+        }
+    }
+}
+
+// sets the attribute pointers of layout on the bound VAO, reading from the bound GL_ARRAY_BUFFER
+inline void setMeshAttributes(MeshLayout layout)
+{
+    const GLsizei stride = static_cast<GLsizei>(meshLayoutStride(layout));
+    if (layout != MESH_LAYOUT_FULL)
+    {
+        // both quantized layouts start like StaticVertex
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(StaticVertex, Position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribIPointer(1, 4, GL_SHORT, stride, (void*)offsetof(StaticVertex, Frame));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(StaticVertex, TexCoords));
+        if (layout == MESH_LAYOUT_SKINNED)
+        {
+            glEnableVertexAttribArray(5);
+            glVertexAttribIPointer(5, 4, GL_UNSIGNED_BYTE, stride, (void*)offsetof(SkinnedVertex, BoneIDs));
+            glEnableVertexAttribArray(6);
+            glVertexAttribPointer(6, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)offsetof(SkinnedVertex, Weights));
+        }
+        return;
+    }
+    // vertex Positions
+    glEnableVertexAttribArray(0);	
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    // vertex normals
+    glEnableVertexAttribArray(1);	
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Normal));
+    // vertex texture coords
+    glEnableVertexAttribArray(2);	
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, TexCoords));
+    // vertex tangent
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Tangent));
+    // vertex bitangent
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Bitangent));
+	// ids
+	glEnableVertexAttribArray(5);
+	glVertexAttribIPointer(5, 4, GL_INT, stride, (void*)offsetof(Vertex, m_BoneIDs));
+
+	// weights
+	glEnableVertexAttribArray(6);
+	glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, m_Weights));
+}
+
 struct Texture {
     unsigned int id;
     string type;
@@ -43,21 +270,60 @@ public:
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
-    unsigned int VAO;
+    unsigned int VAO = 0; // 0 for the meshes of a Model: they are drawn from Model::geometry, whose VAO takes instance attributes instead
+    MeshLayout layout;
 
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // constructor. Without upload the mesh gets no buffers of its own (VAO stays 0) and is drawn by
+    // whoever packs it with others, as Model does through ModelGeometry. With upload, a skinned layout
+    // the bone ids do not fit falls back to the full one, see fitMeshLayout().
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, MeshLayout layout = MESH_LAYOUT_FULL, bool upload = true)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->layout = layout;
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        if (upload)
+            setupMesh();
+    }
+
+    // constructor from arrays already in the Vertex layout (e.g. a mapped model cache): they are copied
+    // as they are, with no per-vertex work
+    Mesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount, vector<Texture> textures,
+         MeshLayout layout = MESH_LAYOUT_FULL, bool upload = true)
+        : vertices(vertexData, vertexData + vertexCount), indices(indexData, indexData + indexCount), textures(textures), layout(layout)
+    {
+        if (upload)
+            setupMesh();
     }
 
     // render the mesh
     void Draw(Shader &shader) 
+    {
+        BindTextures(shader);
+        SetPositionRange(shader, layout, positionRange);
+        
+        // draw mesh
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+
+        // always good practice to set everything back to defaults once configured.
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // points the positionOffset and positionScale uniforms of shader at range when layout quantizes the positions
+    static void SetPositionRange(Shader &shader, MeshLayout layout, const MeshPositionRange &range)
+    {
+        if (layout == MESH_LAYOUT_FULL)
+            return;
+        shader.setVec3("positionOffset", range.offset());
+        shader.setVec3("positionScale", range.scale());
+    }
+
+    // binds the textures to units 0, 1, ... and points the texture_diffuseN etc. samplers of shader at them
+    void BindTextures(Shader &shader)
     {
         // bind appropriate textures
         unsigned int diffuseNr  = 1;
@@ -84,23 +350,18 @@ public:
             // and finally bind the texture
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
-        
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
     }
 
 private:
     // render data 
-    unsigned int VBO, EBO;
+    unsigned int VBO = 0, EBO = 0;
+    MeshPositionRange positionRange; // of vertices, for the quantized layouts
 
     // initializes all the buffer objects/arrays
     void setupMesh()
     {
+        layout = fitMeshLayout(vertices, layout);
+
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
@@ -109,37 +370,27 @@ private:
         glBindVertexArray(VAO);
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
+        if (layout == MESH_LAYOUT_FULL)
+        {
+            // A great thing about structs is that their memory layout is sequential for all its items.
+            // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+            // again translates to 3/2 floats which translates to a byte array.
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
+        }
+        else
+        {
+            // the StaticVertex or SkinnedVertex copy of vertices, with the attributes described at MeshLayout
+            positionRange.include(vertices);
+            vector<unsigned char> packed;
+            appendMeshVertices(vertices, layout, positionRange, packed);
+            glBufferData(GL_ARRAY_BUFFER, packed.size(), packed.data(), GL_STATIC_DRAW);
+        }
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
         // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);	
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);	
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);	
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-		// ids
-		glEnableVertexAttribArray(5);
-		glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
-
-		// weights
-		glEnableVertexAttribArray(6);
-		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
+        setMeshAttributes(layout);
         glBindVertexArray(0);
     }
 };
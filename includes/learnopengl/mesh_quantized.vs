@@ -0,0 +1,74 @@
+#version 330 core
+// Vertex shader for meshes stored in MESH_LAYOUT_STATIC or MESH_LAYOUT_SKINNED (see mesh.h). It decodes
+// the quantized attributes back to what a shader for the full layout receives, skins them when skinned is
+// set, and passes on the same outputs in world space.
+layout (location = 0) in vec3 aPos;       // unorm16 in [0, 1], within positionOffset + positionScale
+layout (location = 1) in ivec4 aFrame;    // octahedral normal and tangent, bitangent sign in bit 0 of w
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 5) in ivec4 aBoneIds;  // skinned only
+layout (location = 6) in vec4 aWeights;   // skinned only, summing to 1
+
+out vec2 TexCoords;
+out vec3 FragPos;
+out vec3 Normal;
+out vec3 Tangent;
+out vec3 Bitangent;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// set by Mesh::Draw() and ModelGeometry::Draw()
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+const int MAX_BONES = 100; // as many as Animator computes
+const int MAX_BONE_INFLUENCE = 4;
+uniform bool skinned;
+uniform mat4 finalBonesMatrices[MAX_BONES];
+
+vec3 octDecode(vec2 e)
+{
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
+
+void main()
+{
+    vec3 position = positionOffset + aPos * positionScale;
+    vec3 normal = octDecode(vec2(aFrame.xy) / 32767.0);
+    vec3 tangent = octDecode(vec2(aFrame.z, aFrame.w & ~1) / 32767.0);
+    vec3 bitangent = cross(normal, tangent) * ((aFrame.w & 1) != 0 ? -1.0 : 1.0);
+
+    vec4 skinnedPosition = vec4(position, 1.0);
+    mat3 skin = mat3(1.0);
+    if (skinned)
+    {
+        // a vertex without bones, all weights 0, stays where it is
+        mat4 blend = mat4(0.0);
+        float total = 0.0;
+        for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+        {
+            if (aWeights[i] == 0.0 || aBoneIds[i] >= MAX_BONES)
+                continue;
+            blend += finalBonesMatrices[aBoneIds[i]] * aWeights[i];
+            total += aWeights[i];
+        }
+        if (total > 0.0)
+        {
+            skinnedPosition = blend * skinnedPosition;
+            skin = mat3(blend);
+        }
+    }
+
+    mat3 tangentMatrix = mat3(model) * skin;
+    vec4 world = model * skinnedPosition;
+    FragPos = world.xyz;
+    Normal = normalize(transpose(inverse(mat3(model))) * skin * normal);
+    Tangent = normalize(tangentMatrix * tangent);
+    Bitangent = normalize(tangentMatrix * bitangent);
+    TexCoords = aTexCoords;
+    gl_Position = projection * view * world;
+}
@@ -11,6 +11,8 @@
 #include <assimp/postprocess.h>
 
 #include <learnopengl/mesh.h>
+#include <learnopengl/model_geometry.h>
+#include <learnopengl/texture_loader.h>
 #include <learnopengl/shader.h>
 
 #include <string>
@@ -18,6 +20,7 @@
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <learnopengl/assimp_glm_helpers.h>
 #include <learnopengl/animdata.h>
@@ -28,24 +31,68 @@ class Model
 {
 public:
     // model data 
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
-    vector<Mesh>    meshes;
+    vector<Texture> textures_loaded;	// stores all the textures loaded so far, each holding one reference in the TextureCache.
+    vector<Mesh>    meshes;   // CPU data and textures; their vertices and indices live in geometry, so meshes[i].VAO is 0
+                              // and instanced drawing uses geometry.VAO and geometry.Draw(), see model_geometry.h
+    ModelGeometry   geometry; // every mesh in one vertex and one index buffer
     string directory;
     bool gammaCorrection;
+    MeshLayout meshLayout; // GPU vertex layout of every mesh; MESH_LAYOUT_SKINNED quantizes the bone data too, past 256 bones it falls back to MESH_LAYOUT_FULL
+    TextureLoadStats textureStats; // decode and upload times of the textures of the last load
 	
 	
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const &path, bool gamma = false, MeshLayout layout = MESH_LAYOUT_FULL) : gammaCorrection(gamma), meshLayout(layout)
     {
         loadModel(path);
     }
 
-    // draws the model, and thus all its meshes
+    // the textures are shared through the TextureCache: a copy takes its own references, a moved-from model
+    // gives its references up, and destruction releases them
+    Model(const Model &other)
+        : textures_loaded(other.textures_loaded), meshes(other.meshes), geometry(other.geometry), directory(other.directory),
+          gammaCorrection(other.gammaCorrection), meshLayout(other.meshLayout), textureStats(other.textureStats),
+          m_BoneInfoMap(other.m_BoneInfoMap), m_BoneCounter(other.m_BoneCounter), textureIndex(other.textureIndex)
+    {
+        for (const Texture &texture : textures_loaded)
+            TextureCache::instance().retain(texture.id);
+    }
+
+    Model(Model &&other)
+        : textures_loaded(std::move(other.textures_loaded)), meshes(std::move(other.meshes)), geometry(std::move(other.geometry)),
+          directory(std::move(other.directory)), gammaCorrection(other.gammaCorrection), meshLayout(other.meshLayout), textureStats(other.textureStats),
+          m_BoneInfoMap(std::move(other.m_BoneInfoMap)), m_BoneCounter(other.m_BoneCounter), textureIndex(std::move(other.textureIndex))
+    {
+        other.textures_loaded.clear();
+        other.textureIndex.clear();
+    }
+
+    Model &operator=(Model other)
+    {
+        std::swap(textures_loaded, other.textures_loaded);
+        std::swap(meshes, other.meshes);
+        std::swap(geometry, other.geometry);
+        std::swap(directory, other.directory);
+        std::swap(gammaCorrection, other.gammaCorrection);
+        std::swap(meshLayout, other.meshLayout);
+        std::swap(textureStats, other.textureStats);
+        std::swap(m_BoneInfoMap, other.m_BoneInfoMap);
+        std::swap(m_BoneCounter, other.m_BoneCounter);
+        std::swap(textureIndex, other.textureIndex);
+        return *this;
+    }
+
+    ~Model()
+    {
+        for (const Texture &texture : textures_loaded)
+            TextureCache::instance().release(texture.id);
+    }
+
+    // draws the model, and thus all its meshes, sorted by material from the shared buffers
     void Draw(Shader &shader)
     {
-        for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        geometry.Draw(shader, meshes);
     }
     
 	auto& GetBoneInfoMap() { return m_BoneInfoMap; }
@@ -57,8 +104,29 @@ private:
 	std::map<string, BoneInfo> m_BoneInfoMap;
 	int m_BoneCounter = 0;
 
+    // textures are decoded on worker threads while the meshes are built, see loadTexture()
+    TextureDecodeQueue *textureQueue = NULL;
+    unordered_map<string, size_t> textureIndex; // texture path as the model names it, to its textures_loaded entry
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    // Unlike model.h this always imports through ASSIMP and writes no model_cache.h cache: Animation reads the
+    // same file through ASSIMP again for its keyframes and node hierarchy, so a cached skin alone would not
+    // take the import off the launch.
     void loadModel(string const &path)
+    {
+        TextureDecodeQueue queue;
+        queue.uploaded = [](unsigned int textureID, uint64_t bytes) { TextureCache::instance().setResidentBytes(textureID, bytes); };
+        textureQueue = &queue;
+        importModel(path);
+        geometry.build(meshes, meshLayout);
+        meshLayout = geometry.layout;
+        // upload whatever is still decoding before the model is used
+        queue.finish();
+        textureStats = queue.stats;
+        textureQueue = NULL;
+    }
+
+    void importModel(string const &path)
     {
         // read file via ASSIMP
         Assimp::Importer importer;
@@ -86,6 +154,9 @@ private:
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
             meshes.push_back(processMesh(mesh, scene));
+            // hand the textures decoded in the meantime to the GL
+            if (textureQueue)
+                textureQueue->uploadFinished();
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
@@ -149,7 +220,7 @@ private:
 
 		ExtractBoneWeightForVertices(vertices,mesh,scene);
 
-		return Mesh(vertices, indices, textures);
+		return Mesh(vertices, indices, textures, meshLayout, false);
 	}
 
 	void SetVertexBoneData(Vertex& vertex, int boneID, float weight)
@@ -202,46 +273,6 @@ private:
 		}
 	}
 
-
-	unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false)
-	{
-		string filename = string(path);
-		filename = directory + '/' + filename;
-
-		unsigned int textureID;
-		glGenTextures(1, &textureID);
-
-		int width, height, nrComponents;
-		unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-		if (data)
-		{
-			GLenum format;
-			if (nrComponents == 1)
-				format = GL_RED;
-			else if (nrComponents == 3)
-				format = GL_RGB;
-			else if (nrComponents == 4)
-				format = GL_RGBA;
-
-			glBindTexture(GL_TEXTURE_2D, textureID);
-			glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-			glGenerateMipmap(GL_TEXTURE_2D);
-
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Texture failed to load at path: " << path << std::endl;
-			stbi_image_free(data);
-		}
-
-		return textureID;
-	}
     
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
     // the required info is returned as a Texture struct.
@@ -252,29 +283,28 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
-            }
+            textures.push_back(loadTexture(str.C_Str(), typeName));
         }
         return textures;
     }
+
+    // the texture at path (relative to the model's directory), from the process-wide TextureCache, which only
+    // loads files no model has loaded yet. During loadModel() the decode is only queued: the texture name is
+    // valid at once, its pixels follow.
+    Texture loadTexture(string const &path, string const &typeName)
+    {
+        // this model already holds a reference to the texture
+        auto found = textureIndex.find(path);
+        if (found != textureIndex.end())
+            return textures_loaded[found->second];
+        Texture texture;
+        texture.id = TextureCache::instance().acquire(this->directory + '/' + path, path, gammaCorrection, textureQueue);
+        texture.type = typeName;
+        texture.path = path;
+        textureIndex[path] = textures_loaded.size();
+        textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
+        return texture;
+    }
 };
 
 
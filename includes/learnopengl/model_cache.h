@@ -0,0 +1,270 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <learnopengl/mapped_file.h>
+#include <learnopengl/mesh.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Cooked model cache, written next to the model as <model>.meshcache after the first Assimp import and
+// mapped on later loads. Native byte order:
+//   ModelCacheHeader   64 bytes
+//   ModelCacheMesh     meshCount entries, one per Mesh in Model::meshes order
+//   ModelCacheTexture  textureCount entries, the texture references of all meshes in order
+//   strings            texture types and paths, not terminated
+//   vertices/indices   per mesh: the Vertex array exactly as Mesh uploads it, then its indices (64-byte aligned)
+// The cache belongs to one source: the key is a hash of the model file (and of its .mtl, for OBJ), the
+// Assimp import flags and sizeof(Vertex), so editing any of them makes the next load import again.
+const char MODEL_CACHE_MAGIC[8] = {'L', 'O', 'G', 'L', 'M', 'E', 'S', 'H'};
+const uint32_t MODEL_CACHE_VERSION = 1;
+const uint64_t MODEL_CACHE_ALIGNMENT = 64;
+
+struct ModelCacheKey
+{
+    uint64_t sourceHash = 0;
+    uint64_t sourceBytes = 0;
+    uint32_t importFlags = 0;
+};
+
+struct ModelCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t vertexSize;
+    uint32_t importFlags;
+    uint32_t meshCount;
+    uint64_t sourceHash;
+    uint64_t sourceBytes;
+    uint32_t textureCount;
+    uint32_t stringBytes;
+    uint64_t fileBytes;
+    uint64_t reserved;
+};
+static_assert(sizeof(ModelCacheHeader) == 64, "the model cache header is one 64-byte block");
+
+struct ModelCacheMesh
+{
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t firstTexture;
+    uint32_t textureCount;
+};
+
+struct ModelCacheTexture
+{
+    uint32_t typeOffset, typeLength; // into the string block
+    uint32_t pathOffset, pathLength;
+};
+
+inline uint64_t alignModelCacheOffset(uint64_t offset)
+{
+    return (offset + MODEL_CACHE_ALIGNMENT - 1) / MODEL_CACHE_ALIGNMENT * MODEL_CACHE_ALIGNMENT;
+}
+
+// FNV-1a over the bytes of path, folded into hash; false when the file cannot be read
+inline bool hashModelSource(const std::string &path, uint64_t &hash, uint64_t &bytes)
+{
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+    const unsigned char *data = file.data();
+    for (size_t i = 0; i < file.size(); ++i)
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    bytes += file.size();
+    return true;
+}
+
+// the key of the model at path imported with importFlags; sourceBytes stays 0 when the model is unreadable
+inline ModelCacheKey modelCacheKey(const std::string &path, unsigned int importFlags)
+{
+    ModelCacheKey key;
+    key.importFlags = importFlags;
+    key.sourceHash = 0xcbf29ce484222325ull;
+    if (!hashModelSource(path, key.sourceHash, key.sourceBytes))
+        return ModelCacheKey();
+    // an OBJ keeps its materials, and so the texture references, in the .mtl beside it
+    size_t dot = path.find_last_of('.');
+    if (dot != std::string::npos && path.substr(dot) == ".obj")
+        hashModelSource(path.substr(0, dot) + ".mtl", key.sourceHash, key.sourceBytes);
+    return key;
+}
+
+inline std::string modelCachePath(const std::string &path)
+{
+    return path + ".meshcache";
+}
+
+// writes the meshes of a freshly imported model; a failed write only costs the next launch another import
+inline bool saveModelCache(const std::string &cachePath, const ModelCacheKey &key, const vector<Mesh> &meshes)
+{
+    ModelCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MODEL_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MODEL_CACHE_VERSION;
+    header.vertexSize = sizeof(Vertex);
+    header.importFlags = key.importFlags;
+    header.meshCount = static_cast<uint32_t>(meshes.size());
+    header.sourceHash = key.sourceHash;
+    header.sourceBytes = key.sourceBytes;
+
+    std::vector<ModelCacheMesh> table(meshes.size());
+    std::vector<ModelCacheTexture> textures;
+    std::string strings;
+    for (size_t m = 0; m < meshes.size(); ++m)
+    {
+        table[m].firstTexture = static_cast<uint32_t>(textures.size());
+        table[m].textureCount = static_cast<uint32_t>(meshes[m].textures.size());
+        for (const Texture &texture : meshes[m].textures)
+        {
+            ModelCacheTexture entry;
+            entry.typeOffset = static_cast<uint32_t>(strings.size());
+            entry.typeLength = static_cast<uint32_t>(texture.type.size());
+            strings += texture.type;
+            entry.pathOffset = static_cast<uint32_t>(strings.size());
+            entry.pathLength = static_cast<uint32_t>(texture.path.size());
+            strings += texture.path;
+            textures.push_back(entry);
+        }
+    }
+    header.textureCount = static_cast<uint32_t>(textures.size());
+    header.stringBytes = static_cast<uint32_t>(strings.size());
+
+    uint64_t offset = sizeof(header) + table.size() * sizeof(ModelCacheMesh) + textures.size() * sizeof(ModelCacheTexture) + strings.size();
+    for (size_t m = 0; m < meshes.size(); ++m)
+    {
+        table[m].vertexCount = static_cast<uint32_t>(meshes[m].vertices.size());
+        table[m].indexCount = static_cast<uint32_t>(meshes[m].indices.size());
+        table[m].vertexOffset = alignModelCacheOffset(offset);
+        table[m].indexOffset = alignModelCacheOffset(table[m].vertexOffset + table[m].vertexCount * sizeof(Vertex));
+        offset = table[m].indexOffset + table[m].indexCount * sizeof(unsigned int);
+    }
+    header.fileBytes = offset;
+
+    // written under a temporary name and renamed, so a crash never leaves a half cache behind
+    std::string partial = cachePath + ".partial";
+    {
+        std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        const char padding[MODEL_CACHE_ALIGNMENT] = {};
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(ModelCacheMesh));
+        file.write(reinterpret_cast<const char *>(textures.data()), textures.size() * sizeof(ModelCacheTexture));
+        file.write(strings.data(), strings.size());
+        uint64_t written = sizeof(header) + table.size() * sizeof(ModelCacheMesh) + textures.size() * sizeof(ModelCacheTexture) + strings.size();
+        for (size_t m = 0; m < meshes.size(); ++m)
+        {
+            file.write(padding, table[m].vertexOffset - written);
+            file.write(reinterpret_cast<const char *>(meshes[m].vertices.data()), table[m].vertexCount * sizeof(Vertex));
+            file.write(padding, table[m].indexOffset - table[m].vertexOffset - table[m].vertexCount * sizeof(Vertex));
+            file.write(reinterpret_cast<const char *>(meshes[m].indices.data()), table[m].indexCount * sizeof(unsigned int));
+            written = table[m].indexOffset + table[m].indexCount * sizeof(unsigned int);
+        }
+        if (!file)
+            return false;
+    }
+    std::remove(cachePath.c_str());
+    return std::rename(partial.c_str(), cachePath.c_str()) == 0;
+}
+
+// a mapped cache; load() checks the key, that every table entry fits the file and that every index names a
+// vertex of its mesh, the vertex and index arrays are handed out in place. The bounds are compared as
+// count <= (size - offset) / stride, so no offset or count in a corrupt file can wrap the sum around.
+class ModelCache
+{
+public:
+    ModelCacheHeader header;
+
+    bool load(const std::string &cachePath, const ModelCacheKey &key)
+    {
+        if (key.sourceBytes == 0 || !file.open(cachePath))
+            return false;
+        const uint64_t size = file.size();
+        bool valid = size >= sizeof(header);
+        if (valid)
+        {
+            std::memcpy(&header, file.data(), sizeof(header));
+            valid = std::memcmp(header.magic, MODEL_CACHE_MAGIC, sizeof(header.magic)) == 0 && header.version == MODEL_CACHE_VERSION &&
+                    header.vertexSize == sizeof(Vertex) && header.importFlags == key.importFlags && header.sourceHash == key.sourceHash &&
+                    header.sourceBytes == key.sourceBytes && header.fileBytes == size &&
+                    stringsOffset() <= size && header.stringBytes <= size - stringsOffset();
+        }
+        for (uint32_t m = 0; valid && m < header.meshCount; ++m)
+        {
+            const ModelCacheMesh &entry = mesh(m);
+            valid = entry.vertexOffset % MODEL_CACHE_ALIGNMENT == 0 && entry.indexOffset % MODEL_CACHE_ALIGNMENT == 0 &&
+                    entry.vertexOffset <= size && entry.vertexCount <= (size - entry.vertexOffset) / sizeof(Vertex) &&
+                    entry.indexOffset <= size && entry.indexCount <= (size - entry.indexOffset) / sizeof(unsigned int) &&
+                    entry.firstTexture <= header.textureCount && entry.textureCount <= header.textureCount - entry.firstTexture;
+            // an index past the mesh would read beyond its vertices once the meshes share one buffer
+            const unsigned int *meshIndices = valid ? indices(m) : NULL;
+            for (uint32_t i = 0; valid && i < entry.indexCount; ++i)
+                valid = meshIndices[i] < entry.vertexCount;
+        }
+        for (uint32_t t = 0; valid && t < header.textureCount; ++t)
+        {
+            const ModelCacheTexture &entry = texture(t);
+            valid = entry.typeOffset <= header.stringBytes && entry.typeLength <= header.stringBytes - entry.typeOffset &&
+                    entry.pathOffset <= header.stringBytes && entry.pathLength <= header.stringBytes - entry.pathOffset;
+        }
+        if (!valid)
+            file.close();
+        return valid;
+    }
+
+    uint32_t meshCount() const
+    {
+        return header.meshCount;
+    }
+
+    const ModelCacheMesh &mesh(uint32_t m) const
+    {
+        return reinterpret_cast<const ModelCacheMesh *>(file.data() + sizeof(header))[m];
+    }
+
+    const Vertex *vertices(uint32_t m) const
+    {
+        return reinterpret_cast<const Vertex *>(file.data() + mesh(m).vertexOffset);
+    }
+
+    const unsigned int *indices(uint32_t m) const
+    {
+        return reinterpret_cast<const unsigned int *>(file.data() + mesh(m).indexOffset);
+    }
+
+    const ModelCacheTexture &texture(uint32_t t) const
+    {
+        return reinterpret_cast<const ModelCacheTexture *>(file.data() + sizeof(header) + header.meshCount * sizeof(ModelCacheMesh))[t];
+    }
+
+    std::string textureType(uint32_t t) const
+    {
+        return std::string(strings() + texture(t).typeOffset, texture(t).typeLength);
+    }
+
+    std::string texturePath(uint32_t t) const
+    {
+        return std::string(strings() + texture(t).pathOffset, texture(t).pathLength);
+    }
+
+private:
+    MappedFile file;
+
+    uint64_t stringsOffset() const
+    {
+        return sizeof(header) + static_cast<uint64_t>(header.meshCount) * sizeof(ModelCacheMesh) + static_cast<uint64_t>(header.textureCount) * sizeof(ModelCacheTexture);
+    }
+
+    const char *strings() const
+    {
+        return reinterpret_cast<const char *>(file.data() + stringsOffset());
+    }
+};
+#endif
@@ -0,0 +1,214 @@
+#ifndef MODEL_GEOMETRY_H
+#define MODEL_GEOMETRY_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/mesh.h>
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <vector>
+using namespace std;
+
+// where one mesh lies in the shared buffers
+struct ModelSubmesh
+{
+    unsigned int mesh;       // index into the meshes the geometry was built from
+    unsigned int firstIndex; // in indices, not bytes
+    unsigned int indexCount;
+    int baseVertex;          // added to every index of the mesh, which stay local to it
+};
+
+// consecutive submeshes with the same textures, drawn after binding them once
+struct ModelDrawBatch
+{
+    unsigned int firstSubmesh;
+    unsigned int submeshCount;
+};
+
+// All meshes of a model in one vertex buffer, one index buffer and one VAO. The meshes are laid out sorted
+// by their textures, so each material is bound once per Draw() and its meshes follow with
+// glMultiDrawElementsIndirect() (GL 4.3) or one glDrawElementsBaseVertex() each, without a VAO switch.
+// Copies share the GL objects, which the last one deletes; build() always makes new ones.
+//
+// Meshes packed here have no VAO of their own (Mesh::VAO is 0). Instancing therefore goes through this VAO:
+// add the per-instance attributes to geometry.VAO, from attribute 7 up (3 and 4 are free too in the
+// quantized layouts), and call Draw() with the instance count:
+//
+//     glBindVertexArray(model.geometry.VAO);
+//     glEnableVertexAttribArray(7);
+//     glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
+//     glVertexAttribDivisor(7, 1);
+//     ...
+//     model.geometry.Draw(shader, model.meshes, amount);
+class ModelGeometry
+{
+public:
+    unsigned int VAO = 0;           // shared by every submesh, 0 until build() packed something
+    vector<ModelSubmesh> submeshes; // in draw order
+    vector<ModelDrawBatch> batches;
+    bool indirect = false;          // batches are drawn from the indirect buffer
+    MeshLayout layout = MESH_LAYOUT_FULL; // what build() stored, which is the full layout when the bone ids do not fit the skinned one
+    MeshPositionRange positionRange;      // of every vertex, for the quantized layouts
+
+    // packs the vertices and indices of meshes in layout; the meshes themselves need no GL buffers
+    void build(const vector<Mesh> &meshes, MeshLayout requested)
+    {
+        submeshes.clear();
+        batches.clear();
+        layout = requested;
+        positionRange = MeshPositionRange();
+        for (const Mesh &mesh : meshes)
+        {
+            if (fitMeshLayout(mesh.vertices, layout) != layout)
+                layout = MESH_LAYOUT_FULL;
+            positionRange.include(mesh.vertices);
+        }
+        vector<unsigned int> order(meshes.size());
+        iota(order.begin(), order.end(), 0u);
+        stable_sort(order.begin(), order.end(), [&meshes](unsigned int a, unsigned int b) { return texturesLess(meshes[a], meshes[b]); });
+
+        vector<unsigned char> vertexData;
+        vector<unsigned int> indexData;
+        size_t vertexCount = 0;
+        for (unsigned int m : order)
+        {
+            const Mesh &mesh = meshes[m];
+            if (mesh.indices.empty())
+                continue;
+            ModelSubmesh submesh;
+            submesh.mesh = m;
+            submesh.firstIndex = static_cast<unsigned int>(indexData.size());
+            submesh.indexCount = static_cast<unsigned int>(mesh.indices.size());
+            submesh.baseVertex = static_cast<int>(vertexCount);
+            if (batches.empty() || !sameTextures(meshes[submeshes[batches.back().firstSubmesh].mesh], mesh))
+                batches.push_back({static_cast<unsigned int>(submeshes.size()), 0});
+            ++batches.back().submeshCount;
+            submeshes.push_back(submesh);
+            appendMeshVertices(mesh.vertices, layout, positionRange, vertexData);
+            indexData.insert(indexData.end(), mesh.indices.begin(), mesh.indices.end());
+            vertexCount += mesh.vertices.size();
+        }
+        // copies keep drawing what they were copied with
+        buffers.reset();
+        VAO = 0;
+        indirect = false;
+        if (submeshes.empty())
+            return;
+
+        buffers = make_shared<Buffers>();
+        VAO = buffers->VAO;
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers->VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexData.size(), vertexData.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers->EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size() * sizeof(unsigned int), indexData.data(), GL_STATIC_DRAW);
+        setMeshAttributes(layout);
+        glBindVertexArray(0);
+
+        indirect = GLAD_GL_VERSION_4_3 != 0;
+        if (indirect)
+        {
+            vector<DrawElementsIndirectCommand> commands;
+            commands.reserve(submeshes.size());
+            for (const ModelSubmesh &submesh : submeshes)
+                commands.push_back({submesh.indexCount, 1, submesh.firstIndex, submesh.baseVertex, 0});
+            glGenBuffers(1, &buffers->indirect);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers->indirect);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+    }
+
+    // draws every submesh instanceCount times; meshes must be the ones build() was given, for their
+    // textures. The indirect commands hold one instance, so more take one draw per submesh.
+    void Draw(Shader &shader, vector<Mesh> &meshes, GLsizei instanceCount = 1)
+    {
+        if (VAO == 0)
+            return;
+        const bool useIndirect = indirect && instanceCount == 1;
+        Mesh::SetPositionRange(shader, layout, positionRange);
+        glBindVertexArray(VAO);
+        if (useIndirect)
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers->indirect);
+        for (const ModelDrawBatch &batch : batches)
+        {
+            meshes[submeshes[batch.firstSubmesh].mesh].BindTextures(shader);
+            if (useIndirect)
+            {
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(batch.firstSubmesh * sizeof(DrawElementsIndirectCommand)),
+                                            static_cast<GLsizei>(batch.submeshCount), 0);
+                continue;
+            }
+            for (unsigned int s = batch.firstSubmesh; s < batch.firstSubmesh + batch.submeshCount; s++)
+            {
+                void *firstIndex = (void*)(submeshes[s].firstIndex * sizeof(unsigned int));
+                if (instanceCount == 1)
+                    glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(submeshes[s].indexCount), GL_UNSIGNED_INT, firstIndex, submeshes[s].baseVertex);
+                else
+                    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(submeshes[s].indexCount), GL_UNSIGNED_INT, firstIndex,
+                                                      instanceCount, submeshes[s].baseVertex);
+            }
+        }
+        if (useIndirect)
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    // the GL objects of one build(), deleted with the last ModelGeometry that shares them
+    struct Buffers
+    {
+        unsigned int VAO = 0, VBO = 0, EBO = 0, indirect = 0;
+
+        Buffers()
+        {
+            glGenVertexArrays(1, &VAO);
+            glGenBuffers(1, &VBO);
+            glGenBuffers(1, &EBO);
+        }
+
+        ~Buffers()
+        {
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &VBO);
+            glDeleteBuffers(1, &EBO);
+            if (indirect != 0)
+                glDeleteBuffers(1, &indirect);
+        }
+
+        Buffers(const Buffers &) = delete;
+        Buffers &operator=(const Buffers &) = delete;
+    };
+    shared_ptr<Buffers> buffers;
+
+    struct DrawElementsIndirectCommand
+    {
+        unsigned int count;
+        unsigned int instanceCount;
+        unsigned int firstIndex;
+        int baseVertex;
+        unsigned int baseInstance;
+    };
+
+    static bool sameTextures(const Mesh &a, const Mesh &b)
+    {
+        if (a.textures.size() != b.textures.size())
+            return false;
+        for (size_t i = 0; i < a.textures.size(); i++)
+            if (a.textures[i].id != b.textures[i].id || a.textures[i].type != b.textures[i].type)
+                return false;
+        return true;
+    }
+
+    static bool texturesLess(const Mesh &a, const Mesh &b)
+    {
+        return lexicographical_compare(a.textures.begin(), a.textures.end(), b.textures.begin(), b.textures.end(),
+                                       [](const Texture &x, const Texture &y) { return x.id != y.id ? x.id < y.id : x.type < y.type; });
+    }
+};
+#endif
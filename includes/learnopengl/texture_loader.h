@@ -0,0 +1,352 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// pixels of one texture as stbi_load() returns them; data is NULL when the file could not be decoded
+struct TextureImage
+{
+    unsigned char *data = NULL;
+    int width = 0;
+    int height = 0;
+    int components = 0;
+};
+
+// decodes filename; touches no GL state, so it may run on any thread (stbi_load() only shares its
+// failure reason string, which nothing here reads)
+inline TextureImage decodeTextureFile(const std::string &filename)
+{
+    TextureImage image;
+    image.data = stbi_load(filename.c_str(), &image.width, &image.height, &image.components, 0);
+    return image;
+}
+
+// uploads a decoded image into textureID with mipmaps and the usual repeat/trilinear parameters, then frees
+// the pixels; needs the GL context. With gamma, color images are stored as sRGB so sampling linearizes
+// them. path is only for the error message. Returns the bytes the texture takes with its mipmaps.
+inline uint64_t uploadTextureImage(unsigned int textureID, TextureImage &image, const std::string &path, bool gamma = false)
+{
+    uint64_t bytes = 0;
+    if (image.data)
+    {
+        GLenum format = GL_RGBA;
+        if (image.components == 1)
+            format = GL_RED;
+        else if (image.components == 3)
+            format = GL_RGB;
+        else if (image.components == 4)
+            format = GL_RGBA;
+        GLenum internalFormat = format;
+        if (gamma && format == GL_RGB)
+            internalFormat = GL_SRGB;
+        else if (gamma && format == GL_RGBA)
+            internalFormat = GL_SRGB_ALPHA;
+
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // the mip chain adds a third to the base level
+        bytes = static_cast<uint64_t>(image.width) * image.height * image.components * 4 / 3;
+    }
+    else
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+    }
+    stbi_image_free(image.data);
+    image.data = NULL;
+    return bytes;
+}
+
+// where the time of a model's textures went; decodeMilliseconds adds up the worker threads, so it can
+// exceed the wall time of the load
+struct TextureLoadStats
+{
+    unsigned int textures = 0;
+    unsigned int threads = 0;
+    double decodeMilliseconds = 0.0; // stbi_load() on the workers
+    double uploadMilliseconds = 0.0; // glTexImage2D() and mipmaps on the GL thread
+    double waitMilliseconds = 0.0;   // the GL thread blocked in finish() for decodes still running
+};
+
+// Decodes textures on worker threads while the GL thread goes on with the model; the GL thread uploads
+// whatever has finished each time it calls uploadFinished(), and finish() waits for the rest. The texture
+// names are generated at submit(), so meshes can hold them before the pixels arrive.
+class TextureDecodeQueue
+{
+public:
+    TextureLoadStats stats;
+    std::function<void(unsigned int textureID, uint64_t bytes)> uploaded; // called on the GL thread after each upload
+
+    TextureDecodeQueue()
+    {
+    }
+
+    ~TextureDecodeQueue()
+    {
+        finish();
+    }
+
+    TextureDecodeQueue(const TextureDecodeQueue &) = delete;
+    TextureDecodeQueue &operator=(const TextureDecodeQueue &) = delete;
+
+    // queues filename for decoding and returns the texture name it will be uploaded to; GL thread only
+    unsigned int submit(const std::string &filename, const std::string &path, bool gamma = false)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        std::unique_lock<std::mutex> lock(mutex);
+        if (workers.empty())
+        {
+            // the GL thread keeps one core busy with the model itself
+            unsigned int count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+            stats.threads = count;
+            for (unsigned int i = 0; i < count; i++)
+                workers.emplace_back([this]() { work(); });
+        }
+        Job job;
+        job.textureID = textureID;
+        job.filename = filename;
+        job.path = path;
+        job.gamma = gamma;
+        pending.push_back(job);
+        ++outstanding;
+        ++stats.textures;
+        wake.notify_one();
+        return textureID;
+    }
+
+    // uploads every texture decoded so far without waiting; GL thread only
+    void uploadFinished()
+    {
+        std::vector<Job> ready;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.swap(decoded);
+        }
+        upload(ready);
+    }
+
+    // waits for the remaining decodes, uploads them and stops the workers; GL thread only
+    void finish()
+    {
+        if (workers.empty())
+            return;
+        for (;;)
+        {
+            std::vector<Job> ready;
+            {
+                auto start = std::chrono::steady_clock::now();
+                std::unique_lock<std::mutex> lock(mutex);
+                done.wait(lock, [this]() { return !decoded.empty() || outstanding == 0; });
+                stats.waitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                ready.swap(decoded);
+                if (ready.empty())
+                    break;
+            }
+            upload(ready);
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+        workers.clear();
+        stopping = false;
+    }
+
+private:
+    struct Job
+    {
+        unsigned int textureID = 0;
+        std::string filename, path;
+        bool gamma = false;
+        TextureImage image;
+    };
+
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::deque<Job> pending;
+    std::vector<Job> decoded;
+    std::vector<std::thread> workers;
+    size_t outstanding = 0; // submitted and not yet uploaded
+    bool stopping = false;
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            wake.wait(lock, [this]() { return stopping || !pending.empty(); });
+            if (pending.empty())
+                return;
+            Job job = pending.front();
+            pending.pop_front();
+            lock.unlock();
+            auto start = std::chrono::steady_clock::now();
+            job.image = decodeTextureFile(job.filename);
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            lock.lock();
+            stats.decodeMilliseconds += milliseconds;
+            decoded.push_back(job);
+            done.notify_one();
+        }
+    }
+
+    void upload(std::vector<Job> &ready)
+    {
+        if (ready.empty())
+            return;
+        auto start = std::chrono::steady_clock::now();
+        for (Job &job : ready)
+        {
+            uint64_t bytes = uploadTextureImage(job.textureID, job.image, job.path, job.gamma);
+            if (uploaded)
+                uploaded(job.textureID, bytes);
+        }
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::unique_lock<std::mutex> lock(mutex);
+        stats.uploadMilliseconds += milliseconds;
+        outstanding -= ready.size();
+    }
+};
+
+// the absolute path of filename with "." and ".." resolved and links followed, so every spelling of one
+// file maps to the same cache entry; filename itself when it does not exist
+inline std::string canonicalTexturePath(const std::string &filename)
+{
+#ifdef _WIN32
+    char resolved[_MAX_PATH];
+    return _fullpath(resolved, filename.c_str(), _MAX_PATH) ? std::string(resolved) : filename;
+#else
+    char resolved[PATH_MAX];
+    return realpath(filename.c_str(), resolved) ? std::string(resolved) : filename;
+#endif
+}
+
+struct TextureCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t bytesResident = 0; // of the textures alive now, mipmaps included
+    unsigned int textures = 0;  // alive now
+};
+
+// Process-wide texture cache: one GL texture per canonical path and gamma flag, shared by every model that
+// references the file and reference counted. acquire() and retain() take a reference, release() drops one
+// and deletes the texture with the last. GL thread only.
+class TextureCache
+{
+public:
+    static TextureCache &instance()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // the texture of filename, decoded on queue when given and loaded at once otherwise; path is only for
+    // error messages
+    unsigned int acquire(const std::string &filename, const std::string &path, bool gamma, TextureDecodeQueue *queue = NULL)
+    {
+        std::string key = canonicalTexturePath(filename) + (gamma ? "|srgb" : "|linear");
+        auto found = entries.find(key);
+        if (found != entries.end())
+        {
+            ++found->second.references;
+            ++counters.hits;
+            return found->second.textureID;
+        }
+        ++counters.misses;
+        Entry entry;
+        if (queue)
+        {
+            entry.textureID = queue->submit(filename, path, gamma);
+        }
+        else
+        {
+            glGenTextures(1, &entry.textureID);
+            TextureImage image = decodeTextureFile(filename);
+            entry.bytes = uploadTextureImage(entry.textureID, image, path, gamma);
+        }
+        keys[entry.textureID] = key;
+        entries[key] = entry;
+        return entry.textureID;
+    }
+
+    // records the size of a texture whose upload was deferred to a TextureDecodeQueue
+    void setResidentBytes(unsigned int textureID, uint64_t bytes)
+    {
+        auto key = keys.find(textureID);
+        if (key != keys.end())
+            entries[key->second].bytes = bytes;
+    }
+
+    void retain(unsigned int textureID)
+    {
+        auto key = keys.find(textureID);
+        if (key != keys.end())
+            ++entries[key->second].references;
+    }
+
+    void release(unsigned int textureID)
+    {
+        auto key = keys.find(textureID);
+        if (key == keys.end())
+            return;
+        auto entry = entries.find(key->second);
+        if (--entry->second.references > 0)
+            return;
+        glDeleteTextures(1, &textureID);
+        entries.erase(entry);
+        keys.erase(key);
+    }
+
+    TextureCacheStats stats() const
+    {
+        TextureCacheStats result = counters;
+        result.textures = static_cast<unsigned int>(entries.size());
+        for (const auto &entry : entries)
+            result.bytesResident += entry.second.bytes;
+        return result;
+    }
+
+private:
+    struct Entry
+    {
+        unsigned int textureID = 0;
+        unsigned int references = 1;
+        uint64_t bytes = 0;
+    };
+
+    std::unordered_map<std::string, Entry> entries; // by canonical path and gamma
+    std::unordered_map<unsigned int, std::string> keys; // texture name to entry key
+    TextureCacheStats counters;
+
+    TextureCache()
+    {
+    }
+};
+#endif
@@ -10,146 +10,484 @@
 #include <learnopengl/shader_m.h>
 #include <learnopengl/camera.h>
 
+#include "galaxy.h"
+#include "headless.h"
+#include "instance_uploads.h"
+#include "kinetic_sculpture.h"
+#include "sculpture.h"
+#include "simulation_thread.h"
+#include "sphere_mesh.h"
+#include "star_culling.h"
+#include "star_instances.h"
+#include "star_lod.h"
+#include "star_morton.h"
+#include "star_motion.h"
+#include "star_nbody.h"
+#include "star_octree.h"
+#include "star_picking.h"
+#include "star_snapshot.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
 void processInput(GLFWwindow *window);
-void generateGalaxy(int numStars, int arms = 3, float radius = 10.0f);
-void generateSphere(float radius, int sectorCount, int stackCount);
+unsigned int createStarVAO(unsigned int sphereVBO, unsigned int sphereEBO, unsigned int instanceBuffer, StarInstanceFormat format);
+unsigned int createStarPointVAO(unsigned int instanceBuffer, StarInstanceFormat format);
+SphereMesh starSphereMesh(const StarLodLevel &level, bool &embedded);
+void parseCommandLine(int argc, char *argv[]);
+void resolveRenderModes();
+void setupRenderState();
+SphereMeshBuffer buildStarSpheres(const StarLodLevel &defaultSphere, StarLod &starLod);
+void pickStar(const glm::mat4 &model, bool motionOnCpuArrays, bool sculptureAnimated, StarBvh &starBvh, const StarMortonOrder &starOrder);
+void writeHeadlessSummary(FrameTimings &frameTimings, const StarLodLevel &defaultSphere, bool sculptureAnimated, const InstanceUploader &instanceUploader);
+int runCheckKernels();
+int runCheckProcedural();
+bool captureProceduralStars(const char *vertexPath, const GalaxyParams &params, uint32_t numStars, std::vector<float> &stars, std::string &error);
+int runCheckSpheres();
+int runCheckParallel();
+int runBenchmarkNBody();
+int runBenchmarkKinetic();
+int runBenchmarkPicking();
+int runBenchmarkMorton();
 
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
+unsigned int viewportWidth = SCR_WIDTH; // --size, for the window or the headless framebuffer
+unsigned int viewportHeight = SCR_HEIGHT;
+constexpr float STAR_RADIUS = 0.08f;
+
+// the UV spheres of the default mesh and the LOD chain, built by the compiler (sphere_mesh.h)
+constexpr StaticUvSphere<4, 3> STAR_SPHERE_4X3(STAR_RADIUS);
+constexpr StaticUvSphere<6, 4> STAR_SPHERE_6X4(STAR_RADIUS);
+constexpr StaticUvSphere<12, 8> STAR_SPHERE_12X8(STAR_RADIUS);
+constexpr StaticUvSphere<24, 16> STAR_SPHERE_24X16(STAR_RADIUS);
 
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
+bool pickRequested = false; // left click, handled once per frame
 
 // timing
 float deltaTime = 0.0f; // time between current frame and last frame
 float lastFrame = 0.0f;
 
+// galaxy
+GalaxyParams galaxyParams;
+unsigned int galaxyThreads = 0; // 0 = all hardware threads
+GalaxyKernel galaxyKernel = GALAXY_KERNEL_AUTO;
+StarInstanceFormat instanceFormat = STAR_FORMAT_FLOAT;
+StarSource starSource = STAR_SOURCE_BUFFER;
+StarCullMode cullMode = STAR_CULL_NONE;
+StarRenderMode renderMode = STAR_RENDER_SPHERES;
+SphereShape sphereShape = SPHERE_UV;
+bool mortonOrder = false;
+std::string snapshotLoadPath;
+std::string snapshotSavePath;
+std::string sculpturePath;
+InstanceUploadMethod uploadMethod = INSTANCE_UPLOAD_SUBDATA;
+bool lodEnabled = false;
+bool octreeEnabled = false;
+float octreeError = STAR_OCTREE_MAX_PIXEL_ERROR;
+StarMotionMode motionMode = STAR_MOTION_RIGID;
+StarMotionPath motionPath = STAR_MOTION_CPU;
+NBodyParams nbodyParams;
+KineticParams kineticParams;
+bool simulationThreadEnabled = false;
+float simulationRate = 60.0f; // ticks per second
+
 // global
 std::vector<float> galaxyVertices;
-std::vector<float> sphereVertices;
-std::vector<unsigned int> sphereIndices;
 
-int main()
+// command line: modes that run instead of the render loop, and the headless run
+bool checkKernels = false;
+bool checkProcedural = false;
+bool checkSpheres = false;
+bool checkParallel = false;
+bool benchmarkNBody = false;
+bool benchmarkMorton = false;
+bool benchmarkKinetic = false;
+bool benchmarkPicking = false;
+unsigned int headlessFrames = 0;
+std::string benchmarkJsonPath;
+
+int main(int argc, char *argv[])
 {
-  // glfw: initialize and configure
-  // ------------------------------
-  glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  // command line
+  // ------------
+  parseCommandLine(argc, argv);
+
+  // the check and benchmark modes run on their own and exit
+  if (checkKernels)
+    return runCheckKernels();
+  if (checkProcedural)
+    return runCheckProcedural();
+  if (checkSpheres)
+    return runCheckSpheres();
+  if (checkParallel)
+    return runCheckParallel();
+  if (benchmarkNBody)
+    return runBenchmarkNBody();
+  if (benchmarkKinetic)
+    return runBenchmarkKinetic();
+  if (benchmarkPicking)
+    return runBenchmarkPicking();
+  if (benchmarkMorton)
+    return runBenchmarkMorton();
+
+  // with --headless there is no window: an EGL context renders into an offscreen framebuffer instead
+  // ------------------------------------------------------------------------------------------------
+  GLFWwindow *window = NULL;
+  HeadlessContext headless;
+  if (headlessFrames > 0)
+  {
+    if (!headless.create(viewportWidth, viewportHeight))
+    {
+      std::cout << "headless: " << headless.error << std::endl;
+      return -1;
+    }
+    std::cout << "headless: " << viewportWidth << "x" << viewportHeight << ", " << headlessFrames << " frames on "
+              << glGetString(GL_RENDERER) << " (OpenGL " << glGetString(GL_VERSION) << ")" << std::endl;
+  }
+  else
+  {
+    // glfw: initialize and configure
+    // ------------------------------
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
-  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
-  // glfw window creation
-  // --------------------
-  GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
-  if (window == NULL)
-  {
-    std::cout << "Failed to create GLFW window" << std::endl;
-    glfwTerminate();
-    return -1;
+    // glfw window creation
+    // --------------------
+    window = glfwCreateWindow(viewportWidth, viewportHeight, "LearnOpenGL", NULL, NULL);
+    if (window == NULL)
+    {
+      std::cout << "Failed to create GLFW window" << std::endl;
+      glfwTerminate();
+      return -1;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetCursorPosCallback(window, mouse_callback);
+    glfwSetScrollCallback(window, scroll_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+
+    // tell GLFW to capture our mouse
+    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+    // glad: load all OpenGL function pointers
+    // ---------------------------------------
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+      std::cout << "Failed to initialize GLAD" << std::endl;
+      return -1;
+    }
   }
-  glfwMakeContextCurrent(window);
-  glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-  glfwSetCursorPosCallback(window, mouse_callback);
-  glfwSetScrollCallback(window, scroll_callback);
 
-  // tell GLFW to capture our mouse
-  glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-
-  // glad: load all OpenGL function pointers
-  // ---------------------------------------
-  if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
-  {
-    std::cout << "Failed to initialize GLAD" << std::endl;
-    return -1;
-  }
-
-  // configure global opengl state
-  // -----------------------------
-  glEnable(GL_DEPTH_TEST);
+  // settle the options that rule each other out, then configure global opengl state for the render mode
+  // ------------------------------------------------------------------------------------------------
+  resolveRenderModes();
+  setupRenderState();
 
   // build and compile our shader zprogram
   // ------------------------------------
   Shader ourShader("assignment_2.vs", "assignment_2.fs");
 
-  generateGalaxy(2000);
-  generateSphere(0.08f, 12, 8);
-
-  unsigned int VBO, VAO;
-  glGenVertexArrays(1, &VAO);
-  glGenBuffers(1, &VBO);
-
-  glBindVertexArray(VAO);
-  glDrawArrays(GL_POINTS, 0, galaxyVertices.size() / 3);
-
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  glBufferData(GL_ARRAY_BUFFER, galaxyVertices.size() * sizeof(float), galaxyVertices.data(), GL_STATIC_DRAW);
+  // a snapshot replaces generation: the file is mapped and its payload later goes to the instance buffer
+  // as it is. Only the passes that read stars on the CPU (culling and LOD there, motion) copy it out.
+  StarSnapshot snapshot;
+  bool fromSnapshot = false;
+  if (!snapshotLoadPath.empty() && starSource == STAR_SOURCE_BUFFER)
+  {
+    fromSnapshot = snapshot.load(snapshotLoadPath);
+    if (fromSnapshot)
+    {
+      galaxyParams = snapshot.params();
+      instanceFormat = snapshot.format();
+      std::cout << "snapshot: " << galaxyParams.numStars << " stars (seed " << galaxyParams.seed << ", "
+                << (instanceFormat == STAR_FORMAT_PACKED ? "packed" : "float") << ") mapped in " << snapshot.milliseconds << " ms" << std::endl;
+    }
+    else
+    {
+      std::cout << "snapshot: " << snapshot.error << ", generating the galaxy instead" << std::endl;
+    }
+  }
 
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
+  // a sculpture file replaces the single galaxy with its elements, all generated into the one star array
+  Sculpture composite;
+  bool fromSculpture = false;
+  if (!sculpturePath.empty() && !fromSnapshot && starSource == STAR_SOURCE_BUFFER && motionMode != STAR_MOTION_KINETIC)
+  {
+    fromSculpture = composite.load(sculpturePath);
+    if (fromSculpture)
+      galaxyParams.numStars = composite.size();
+    else
+      std::cout << "sculpture: " << composite.error << ", generating the galaxy instead" << std::endl;
+  }
+  if (fromSculpture && composite.isAnimated() && motionMode != STAR_MOTION_RIGID)
+    std::cout << "sculpture: --motion moves every star, spinning elements stay where they were generated" << std::endl;
+  const bool sculptureAnimated = fromSculpture && composite.isAnimated() && motionMode == STAR_MOTION_RIGID;
+  const bool needsStarArrays = lodEnabled || motionMode != STAR_MOTION_RIGID || cullMode == STAR_CULL_CPU;
+
+  // procedural stars are rebuilt by the vertex shader, so there is nothing to generate up front
+  StarMortonOrder starOrder;
+  std::vector<PackedStar> packedStars;
+  KineticSculpture sculpture;
+  if (fromSnapshot)
+  {
+    if (snapshot.ids() != NULL)
+      starOrder.assign(snapshot.ids(), galaxyParams.numStars);
+    if (needsStarArrays && instanceFormat == STAR_FORMAT_PACKED)
+    {
+      const PackedStar *stored = reinterpret_cast<const PackedStar *>(snapshot.instances());
+      packedStars.assign(stored, stored + galaxyParams.numStars);
+      unpackStars(packedStars.data(), galaxyParams.numStars, galaxyParams.radius, galaxyVertices, galaxyThreads);
+    }
+    else if (needsStarArrays)
+    {
+      const float *stored = reinterpret_cast<const float *>(snapshot.instances());
+      galaxyVertices.assign(stored, stored + snapshot.instanceBytes() / sizeof(float));
+    }
+  }
+  else if (motionMode == STAR_MOTION_KINETIC)
+  {
+    sculpture.build(galaxyParams.numStars, galaxyParams.radius, kineticParams, galaxyThreads);
+    sculpture.writeRecords(galaxyVertices);
+    std::cout << "kinetic: " << galaxyParams.numStars << " spheres on " << sculpture.stats.motors << " motors, "
+              << sculpture.stats.constraints << " constraints in " << sculpture.stats.colors << " colors" << std::endl;
+  }
+  else if (starSource == STAR_SOURCE_BUFFER)
+  {
+    if (fromSculpture)
+    {
+      // the largest coordinate stands in for the galaxy radius: packing, culling and the camera scale with it
+      galaxyParams.radius = std::max(composite.generate(galaxyVertices, galaxyThreads, galaxyKernel), 1.0f);
+      std::cout << "sculpture: " << galaxyParams.numStars << " stars in " << composite.elements.size() << " elements, "
+                << composite.stats.jobs << " jobs in " << composite.stats.milliseconds << " ms on " << composite.stats.threads
+                << " threads, " << composite.stats.starsPerSecond / 1.0e6 << " M stars/sec" << std::endl;
+    }
+    else
+    {
+      GalaxyStats galaxyStats = generateGalaxy(galaxyParams, galaxyVertices, galaxyThreads, galaxyKernel);
+      std::cout << "galaxy: " << galaxyParams.numStars << " stars (seed " << galaxyParams.seed << ") in "
+                << galaxyStats.seconds * 1000.0 << " ms on " << galaxyStats.threads << " threads ("
+                << galaxyKernelName(galaxyStats.kernel) << "), "
+                << galaxyStats.starsPerSecond / 1.0e6 << " M stars/sec" << std::endl;
+    }
+    if (mortonOrder && sculptureAnimated)
+    {
+      std::cout << "morton: spinning sculpture elements are updated as contiguous ranges, keeping generation order" << std::endl;
+    }
+    else if (mortonOrder)
+    {
+      starOrder.sort(galaxyVertices, galaxyParams.radius, galaxyThreads);
+      std::cout << "morton: stars reordered in " << starOrder.stats.milliseconds << " ms on " << starOrder.stats.threads << " threads" << std::endl;
+    }
+  }
+  // sphere meshes, in one vertex and index buffer
+  const StarLodLevel defaultSphere = defaultStarSphere(sphereShape);
+  StarLod starLod(sphereShape);
+  if (renderMode == STAR_RENDER_POINTS)
+  {
+    // the octree's stars stay point sprites whatever their size
+    starLod.levels.assign(1, StarLodLevel());
+    starLod.levels[0].maxPixelRadius = INFINITY;
+  }
+  SphereMeshBuffer sphereBuffer = buildStarSpheres(defaultSphere, starLod);
+  const unsigned int sphereIndexCount = sphereBuffer.ranges[0].indexCount;
+  const GLenum sphereIndexType = sphereBuffer.indexType();
 
-  unsigned int sphereVAO, sphereVBO, sphereEBO;
-  glGenVertexArrays(1, &sphereVAO);
+  unsigned int sphereVBO, sphereEBO;
   glGenBuffers(1, &sphereVBO);
   glGenBuffers(1, &sphereEBO);
+  sphereBuffer.upload(sphereVBO, sphereEBO);
 
-  glBindVertexArray(sphereVAO);
-  glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-  glBufferData(GL_ARRAY_BUFFER, sphereVertices.size() * sizeof(float), sphereVertices.data(), GL_STATIC_DRAW);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0);
+  // star instances, in the float or packed layout described in assignment_2.vs
+  unsigned int instanceVBO = 0;
+  if (starSource == STAR_SOURCE_BUFFER)
+  {
+    auto uploadStart = std::chrono::steady_clock::now();
+    glGenBuffers(1, &instanceVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    if (fromSnapshot)
+    {
+      // straight from the mapping; immutable storage where available, the stars never change size
+      if (GLAD_GL_VERSION_4_4)
+        glBufferStorage(GL_ARRAY_BUFFER, snapshot.instanceBytes(), snapshot.instances(), 0);
+      else
+        glBufferData(GL_ARRAY_BUFFER, snapshot.instanceBytes(), snapshot.instances(), GL_STATIC_DRAW);
+    }
+    else if (instanceFormat == STAR_FORMAT_PACKED)
+    {
+      packStars(galaxyVertices, galaxyParams.radius, packedStars, galaxyThreads);
+      glBufferData(GL_ARRAY_BUFFER, packedStars.size() * sizeof(PackedStar), packedStars.data(), sculptureAnimated ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    }
+    else
+    {
+      glBufferData(GL_ARRAY_BUFFER, galaxyVertices.size() * sizeof(float), galaxyVertices.data(), sculptureAnimated ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    }
+    glFinish();
+    std::cout << "instances: " << starInstanceStride(instanceFormat) << " bytes/star, "
+              << galaxyParams.numStars * starInstanceStride(instanceFormat) / (1024.0 * 1024.0) << " MB, uploaded in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - uploadStart).count() << " ms" << std::endl;
+  }
+  unsigned int sphereVAO = renderMode == STAR_RENDER_POINTS ? createStarPointVAO(instanceVBO, instanceFormat)
+                                                            : createStarVAO(sphereVBO, sphereEBO, instanceVBO, instanceFormat);
+  const unsigned char *instanceBytes = fromSnapshot && galaxyVertices.empty()       ? snapshot.instances()
+                                      : instanceFormat == STAR_FORMAT_PACKED ? reinterpret_cast<const unsigned char *>(packedStars.data())
+                                                                             : reinterpret_cast<const unsigned char *>(galaxyVertices.data());
+  if (!snapshotSavePath.empty() && starSource == STAR_SOURCE_BUFFER)
+  {
+    bool saved = saveStarSnapshot(snapshotSavePath, galaxyParams, instanceFormat, instanceBytes, galaxyParams.numStars, starOrder.empty() ? NULL : &starOrder.ids);
+    std::cout << "snapshot: " << (saved ? "saved to " : "could not write ") << snapshotSavePath << std::endl;
+  }
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereIndices.size() * sizeof(unsigned int), sphereIndices.data(), GL_STATIC_DRAW);
+  // hierarchical LOD: clusters of stars too small to tell apart are drawn as one aggregate
+  if (octreeEnabled && sculptureAnimated)
+  {
+    std::cout << "octree: the tree is built once and cannot follow spinning sculpture elements, octree disabled" << std::endl;
+    octreeEnabled = false;
+  }
+  StarOctree starOctree;
+  if (octreeEnabled)
+  {
+    starOctree.build(galaxyVertices, instanceFormat, galaxyParams.radius, renderMode);
+    std::cout << "octree: " << starOctree.stats.nodes << " nodes in " << starOctree.stats.buildMilliseconds << " ms" << std::endl;
+  }
 
-  unsigned int instanceVBO;
-  glGenBuffers(1, &instanceVBO);
-  glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-  glBufferData(GL_ARRAY_BUFFER, galaxyVertices.size() * sizeof(float), galaxyVertices.data(), GL_STATIC_DRAW);
+  // culling and LOD: the selected instances are compacted into their own buffer with its own VAO
+  // --------------------------------------------------------------------------------------------
+  StarCuller starCuller;
+  std::unique_ptr<GpuStarCuller> gpuCuller;
+  unsigned int culledVBO = 0;
+  if (cullMode == STAR_CULL_GPU)
+  {
+    gpuCuller.reset(new GpuStarCuller("assignment_2_cull.cs"));
+    gpuCuller->setInstances(instanceVBO, galaxyParams.numStars, instanceFormat, starPositionScale(instanceFormat, galaxyParams.radius));
+  }
+  else if (cullMode == STAR_CULL_CPU || lodEnabled)
+  {
+    glGenBuffers(1, &culledVBO);
+  }
+  unsigned int culledVAO = 0;
+  if (cullMode != STAR_CULL_NONE || lodEnabled)
+    culledVAO = createStarVAO(sphereVBO, sphereEBO, gpuCuller ? gpuCuller->outputBuffer() : culledVBO, instanceFormat);
+
+  // moving stars: CPU culling and LOD read the star positions on the CPU, so the CPU path then moves
+  // galaxyVertices (and the packed copy) in place; otherwise it writes straight into a pair of mapped
+  // instance buffers, or the GPU path rewrites instanceVBO. N-body and the kinetic sculpture only run on the CPU.
+  // --------------------------------------------------------------------------------------------------
+  const bool motionOnCpuArrays = cullMode == STAR_CULL_CPU || lodEnabled;
+  StarMotion starMotion;
+  NBodySimulation nbody;
+  StarMotionBuffers motionBuffers;
+  std::unique_ptr<GpuStarMotion> gpuMotion;
+  unsigned int motionVAO[2] = {0, 0};
+  if (motionMode != STAR_MOTION_RIGID)
+  {
+    if (motionMode == STAR_MOTION_NBODY)
+      nbody.init(galaxyVertices, nbodyParams, galaxyThreads);
+    else if (motionMode == STAR_MOTION_DIFFERENTIAL)
+      starMotion.init(galaxyVertices, RotationCurve(), galaxyKernel);
+    if (motionPath == STAR_MOTION_GPU)
+    {
+      gpuMotion.reset(new GpuStarMotion("assignment_2_motion.cs"));
+      gpuMotion->init(starMotion, instanceVBO, instanceFormat, starPositionScale(instanceFormat, galaxyParams.radius));
+    }
+    else if (!motionOnCpuArrays)
+    {
+      motionBuffers.init(instanceBytes, galaxyParams.numStars * starInstanceStride(instanceFormat));
+      for (int k = 0; k < 2; ++k)
+        motionVAO[k] = renderMode == STAR_RENDER_POINTS ? createStarPointVAO(motionBuffers.buffers[k], instanceFormat)
+                                                        : createStarVAO(sphereVBO, sphereEBO, motionBuffers.buffers[k], instanceFormat);
+    }
+    const char *motionDescriptions[] = {"rigid rotation", "differential rotation", "N-body gravity", "kinetic sculpture"};
+    std::cout << "motion: " << motionDescriptions[motionMode] << " of "
+              << galaxyParams.numStars << " stars on the "
+              << (gpuMotion ? "GPU" : motionOnCpuArrays ? "CPU (star arrays)" : motionBuffers.isPersistent() ? "CPU (persistent mapped buffers)" : "CPU (mapped buffers)")
+              << std::endl;
+  }
 
-  // position
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(1);
-  glVertexAttribDivisor(1, 1);
+  // fixed-rate simulation thread: the rigid angle and CPU star motion are stepped there, and the loop only
+  // blends the two states of the newest published tick. The GPU motion path stays in the loop.
+  // --------------------------------------------------------------------------------------------------
+  SimulationThread simulation;
+  std::atomic<double> headlessClock{0.0};
+  if (simulationThreadEnabled && !gpuMotion)
+  {
+    std::function<double()> clock = [&]() { return headlessFrames > 0 ? headlessClock.load() : glfwGetTime(); };
+    simulation.start(1.0 / simulationRate, clock, [&](SimulationFrame &frame) {
+      frame.angle = 0.6f * static_cast<float>(frame.time);
+      if (motionMode == STAR_MOTION_NBODY)
+      {
+        nbody.advance(static_cast<float>(frame.time - frame.previousTime));
+        nbody.writePositions(reinterpret_cast<unsigned char *>(frame.stars->data()), STAR_FORMAT_FLOAT, 1.0f);
+      }
+      else if (motionMode == STAR_MOTION_KINETIC)
+      {
+        sculpture.advance(static_cast<float>(frame.time - frame.previousTime));
+        sculpture.writePositions(reinterpret_cast<unsigned char *>(frame.stars->data()), STAR_FORMAT_FLOAT, 1.0f);
+      }
+      else if (motionMode == STAR_MOTION_DIFFERENTIAL)
+      {
+        starMotion.update(static_cast<float>(frame.time), reinterpret_cast<unsigned char *>(frame.stars->data()), STAR_FORMAT_FLOAT, 1.0f, galaxyThreads);
+      }
+    }, motionMode != STAR_MOTION_RIGID ? galaxyVertices : std::vector<float>());
+    std::cout << "simulation: own thread at " << simulationRate << " Hz" << std::endl;
+  }
 
-  // color
-  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(2);
-  glVertexAttribDivisor(2, 1);
+  // spinning sculpture elements are re-sent as dirty ranges, see instance_uploads.h
+  DirtyRanges dirtyStars;
+  InstanceUploader instanceUploader;
+  instanceUploader.method = uploadMethod;
 
-  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+  // star picking, built on the first click (see the render loop)
+  StarBvh starBvh;
 
   // load image, create texture and generate mipmaps
   int width, height, nrChannels;
-  glEnable(GL_PROGRAM_POINT_SIZE);
 
   // render loop
   // -----------
-  while (!glfwWindowShouldClose(window))
+  // headless runs step a fixed 60 Hz clock and fly the scripted camera, so every run renders the same frames
+  const float headlessFrameTime = 1.0f / 60.0f;
+  FrameTimings frameTimings;
+  if (headlessFrames > 0)
+    frameTimings.reserve(headlessFrames);
+  while (headlessFrames > 0 ? frameTimings.frames() < headlessFrames : !glfwWindowShouldClose(window))
   {
+    if (headlessFrames > 0)
+      frameTimings.beginFrame();
+
     // per-frame time logic
     // --------------------
-    float currentFrame = static_cast<float>(glfwGetTime());
+    float currentFrame = headlessFrames > 0 ? frameTimings.frames() * headlessFrameTime : static_cast<float>(glfwGetTime());
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
 
     // input
     // -----
-    processInput(window);
+    if (window != NULL)
+      processInput(window);
+    else
+      camera = benchmarkCamera(currentFrame, headlessFrames * headlessFrameTime, galaxyParams.radius);
 
     // render
     // ------
@@ -159,7 +497,7 @@ int main()
     ourShader.use();
 
     // pass projection matrix to shader (note that in this case it could change every frame)
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)viewportWidth / (float)viewportHeight, 0.1f, 100.0f);
     ourShader.setMat4("projection", projection);
 
     // camera/view transformation
@@ -169,25 +507,251 @@ int main()
     static float angle = 0.0f;
     angle += 0.6f * deltaTime;
 
+    // with the simulation thread, show its state one tick behind the clock, which the newest tick brackets
+    const SimulationFrame *simulationFrame = NULL;
+    float simulationBlend = 1.0f;
+    if (simulation.isRunning())
+    {
+      if (headlessFrames > 0)
+        headlessClock = currentFrame;
+      simulationFrame = &simulation.latest();
+      simulationBlend = SimulationThread::blend(*simulationFrame, currentFrame - simulation.tick());
+      angle = glm::mix(simulationFrame->previousAngle, simulationFrame->angle, simulationBlend);
+
+      static float lastSimulationReport = 0.0f;
+      if (currentFrame - lastSimulationReport >= 1.0f)
+      {
+        lastSimulationReport = currentFrame;
+        std::cout << "simulation: tick " << simulationFrame->tick << ", step " << simulationFrame->stepMilliseconds << " ms, "
+                  << simulationFrame->skippedTicks << " ticks skipped, blend " << simulationBlend << std::endl;
+      }
+    }
+
     glm::mat4 model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
+    unsigned int starVAO = sphereVAO;
+
+    // spinning sculpture elements move in the star arrays, and only their records are sent to the buffer
+    if (sculptureAnimated)
+    {
+      composite.animate(currentFrame, galaxyVertices, dirtyStars, galaxyThreads);
+      if (instanceFormat == STAR_FORMAT_PACKED)
+      {
+        const float invScale = 1.0f / galaxyParams.radius;
+        for (const DirtyRange &range : dirtyStars.ranges())
+          parallelFor(range.end - range.begin, galaxyThreads, [&](uint32_t begin, uint32_t end, unsigned int) {
+            for (uint32_t i = range.begin + begin; i < range.begin + end; ++i)
+              packedStars[i] = packStar(&galaxyVertices[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR], invScale);
+          });
+      }
+      instanceUploader.upload(instanceVBO, instanceBytes, starInstanceStride(instanceFormat), dirtyStars);
+
+      static float lastUploadReport = 0.0f;
+      if (currentFrame - lastUploadReport >= 1.0f)
+      {
+        lastUploadReport = currentFrame;
+        std::cout << "uploads (" << (uploadMethod == INSTANCE_UPLOAD_MAP ? "mapped ranges" : "glBufferSubData") << "): "
+                  << instanceUploader.stats.ranges << " ranges, " << instanceUploader.stats.bytes / 1024.0 << " KB this frame, "
+                  << 100.0 * instanceUploader.stats.bytes / (static_cast<double>(galaxyParams.numStars) * starInstanceStride(instanceFormat))
+                  << "% of the instance buffer" << std::endl;
+      }
+    }
+    if (motionMode != STAR_MOTION_RIGID)
+    {
+      // the stars carry the motion themselves
+      model = glm::mat4(1.0f);
+      float positionScale = starPositionScale(instanceFormat, galaxyParams.radius);
+      unsigned int nbodySteps = motionMode == STAR_MOTION_NBODY && !simulationFrame ? nbody.advance(deltaTime) : 0;
+      unsigned int kineticSteps = motionMode == STAR_MOTION_KINETIC && !simulationFrame ? sculpture.advance(deltaTime) : 0;
+      auto moveStars = [&](unsigned char *out, StarInstanceFormat format, float scale) {
+        if (simulationFrame)
+          writeBlendedStarPositions(*simulationFrame->previousStars, *simulationFrame->stars, simulationBlend, out, format, scale, galaxyThreads);
+        else if (motionMode == STAR_MOTION_NBODY)
+          nbody.writePositions(out, format, scale);
+        else if (motionMode == STAR_MOTION_KINETIC)
+          sculpture.writePositions(out, format, scale);
+        else
+          starMotion.update(currentFrame, out, format, scale, galaxyThreads);
+      };
+      if (gpuMotion)
+      {
+        gpuMotion->update(currentFrame);
+      }
+      else if (motionOnCpuArrays)
+      {
+        moveStars(reinterpret_cast<unsigned char *>(galaxyVertices.data()), STAR_FORMAT_FLOAT, 1.0f);
+        if (instanceFormat == STAR_FORMAT_PACKED && simulationFrame)
+        {
+          moveStars(reinterpret_cast<unsigned char *>(packedStars.data()), STAR_FORMAT_PACKED, positionScale);
+        }
+        else if (instanceFormat == STAR_FORMAT_PACKED)
+        {
+          double milliseconds = starMotion.stats.milliseconds;
+          moveStars(reinterpret_cast<unsigned char *>(packedStars.data()), STAR_FORMAT_PACKED, positionScale);
+          starMotion.stats.milliseconds += milliseconds;
+        }
+      }
+      else
+      {
+        moveStars(motionBuffers.beginWrite(), instanceFormat, positionScale);
+        unsigned int buffer = motionBuffers.endWrite();
+        starVAO = motionVAO[motionBuffers.currentIndex()];
+        if (gpuCuller)
+          gpuCuller->setInstanceBuffer(buffer);
+      }
+      ourShader.use();
+
+      static float lastMotionReport = 0.0f;
+      if (motionMode == STAR_MOTION_NBODY && !simulationFrame && currentFrame - lastMotionReport >= 1.0f)
+      {
+        lastMotionReport = currentFrame;
+        std::cout << "nbody: " << nbodySteps << " steps this frame, " << nbody.stats.stepsPerSecond << " steps/sec (tree "
+                  << nbody.stats.buildMilliseconds << " ms, forces " << nbody.stats.forceMilliseconds << " ms)" << std::endl;
+      }
+      else if (motionMode == STAR_MOTION_KINETIC && !simulationFrame && currentFrame - lastMotionReport >= 1.0f)
+      {
+        lastMotionReport = currentFrame;
+        std::cout << "kinetic: " << kineticSteps << " steps this frame, " << sculpture.stats.stepsPerSecond << " steps/sec (solve "
+                  << sculpture.stats.solveMilliseconds << " ms, " << sculpture.stats.threads << " threads), max stretch "
+                  << sculpture.maxViolation() * 100.0f << "%" << std::endl;
+      }
+      else if (motionMode == STAR_MOTION_DIFFERENTIAL && !gpuMotion && !simulationFrame && currentFrame - lastMotionReport >= 1.0f)
+      {
+        lastMotionReport = currentFrame;
+        std::cout << "motion (cpu " << galaxyKernelName(starMotion.stats.kernel) << ", " << starMotion.stats.threads << " threads): "
+                  << galaxyParams.numStars << " stars in " << starMotion.stats.milliseconds << " ms" << std::endl;
+      }
+    }
     ourShader.setMat4("model", model);
 
-    // render boxes
-    // glBindVertexArray(VAO);
-    // glDrawArrays(GL_POINTS, 0, galaxyVertices.size() / 3);
-    glBindVertexArray(sphereVAO);
-    glDrawElementsInstanced(GL_TRIANGLES, sphereIndices.size(), GL_UNSIGNED_INT, 0, galaxyVertices.size() / 6);
+    // star picking: a left click casts a ray through the middle of the view, where the captured cursor
+    // sits. The BVH is built on the first click, and again on every click while the stars move.
+    if (pickRequested)
+    {
+      pickRequested = false;
+      pickStar(model, motionOnCpuArrays, sculptureAnimated, starBvh, starOrder);
+    }
+    ourShader.setFloat("positionScale", starPositionScale(instanceFormat, galaxyParams.radius));
+    ourShader.setInt("starSource", starSource);
+    ourShader.setUint("galaxySeed", galaxyParams.seed);
+    ourShader.setInt("galaxyArms", galaxyParams.arms);
+    ourShader.setFloat("galaxyRadius", galaxyParams.radius);
+    ourShader.setFloat("starRadius", STAR_RADIUS);
+    ourShader.setFloat("pointScale", StarLod::projectionScale(glm::radians(camera.Zoom), (float)viewportHeight));
+    ourShader.setBool("pointSprite", renderMode == STAR_RENDER_POINTS);
+    ourShader.setBool("starsAreVertices", renderMode == STAR_RENDER_POINTS);
+    ourShader.setBool("additive", renderMode == STAR_RENDER_POINTS);
+
+    // render stars
+    if (lodEnabled)
+    {
+      float aspect = (float)viewportWidth / (float)viewportHeight;
+      Frustum frustum = frustumToModelSpace(createFrustumFromCamera(camera, aspect, glm::radians(camera.Zoom), 0.1f, 100.0f), model);
+      glm::vec3 eye = glm::vec3(glm::inverse(model) * glm::vec4(camera.Position, 1.0f));
+      float projScale = StarLod::projectionScale(glm::radians(camera.Zoom), (float)viewportHeight);
+      const Frustum *lodFrustum = cullMode == STAR_CULL_CPU ? &frustum : NULL;
+      if (octreeEnabled)
+      {
+        starOctree.select(starLod, galaxyVertices, eye, projScale, STAR_RADIUS, lodFrustum, octreeError, galaxyThreads);
+        starLod.upload(culledVBO, instanceBytes, starInstanceStride(instanceFormat), starOctree.nodeRecords(), galaxyParams.numStars);
+      }
+      else
+      {
+        starLod.select(galaxyVertices, eye, projScale, STAR_RADIUS, lodFrustum, galaxyThreads);
+        starLod.upload(culledVBO, instanceBytes, starInstanceStride(instanceFormat));
+      }
+      glBindVertexArray(culledVAO);
+      starLod.draw(ourShader, instanceFormat);
+
+      // stars and triangles per level, against drawing every selected star as the default sphere
+      static float lastReport = 0.0f;
+      if (currentFrame - lastReport >= 1.0f)
+      {
+        lastReport = currentFrame;
+        std::cout << "lod: " << starLod.stats.visible << " / " << starLod.stats.total << " stars [";
+        for (unsigned int l = 0; l < starLod.levels.size(); ++l)
+        {
+          const StarLodLevel &level = starLod.levels[l];
+          std::cout << (l == 0 ? "" : ", ") << level.name() << " " << starLod.count(l);
+        }
+        std::cout << "], " << starLod.triangles() << " triangles vs "
+                  << static_cast<uint64_t>(starLod.stats.visible) * (sphereIndexCount / 3) << " at " << defaultSphere.name() << ", "
+                  << starLod.stats.milliseconds << " ms" << std::endl;
+        if (octreeEnabled)
+          std::cout << "octree: " << starOctree.stats.visited << " / " << starOctree.stats.nodes << " nodes visited, "
+                    << starOctree.stats.clusters << " clusters and " << starOctree.stats.stars << " stars drawn" << std::endl;
+      }
+    }
+    else if (cullMode == STAR_CULL_NONE)
+    {
+      glBindVertexArray(starVAO);
+      if (renderMode == STAR_RENDER_POINTS)
+        glDrawArrays(GL_POINTS, 0, galaxyParams.numStars);
+      else
+        glDrawElementsInstanced(GL_TRIANGLES, sphereIndexCount, sphereIndexType, 0, galaxyParams.numStars);
+    }
+    else
+    {
+      float aspect = (float)viewportWidth / (float)viewportHeight;
+      Frustum frustum = frustumToModelSpace(createFrustumFromCamera(camera, aspect, glm::radians(camera.Zoom), 0.1f, 100.0f), model);
+      glBindVertexArray(culledVAO);
+      if (gpuCuller)
+      {
+        gpuCuller->cull(frustum, STAR_RADIUS, sphereIndexCount);
+        ourShader.use();
+        gpuCuller->draw(sphereIndexType);
+      }
+      else
+      {
+        starCuller.cull(galaxyVertices, frustum, STAR_RADIUS, galaxyThreads);
+        uint32_t visible = starCuller.upload(culledVBO, instanceBytes, starInstanceStride(instanceFormat));
+        glDrawElementsInstanced(GL_TRIANGLES, sphereIndexCount, sphereIndexType, 0, visible);
+      }
+
+      // visible/total counters, once per second
+      static float lastReport = 0.0f;
+      if (currentFrame - lastReport >= 1.0f)
+      {
+        lastReport = currentFrame;
+        CullStats stats = gpuCuller ? gpuCuller->stats : starCuller.stats;
+        if (gpuCuller)
+          stats.visible = gpuCuller->readVisibleCount();
+        std::cout << "cull (" << (gpuCuller ? "gpu" : "cpu") << "): " << stats.visible << " / " << stats.total << " stars visible";
+        if (!gpuCuller)
+          std::cout << ", " << stats.milliseconds << " ms";
+        std::cout << std::endl;
+      }
+    }
 
     // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
     // -------------------------------------------------------------------------------
+    if (motionVAO[0] != 0)
+      motionBuffers.frameDone();
+
+    if (window == NULL)
+    {
+      frameTimings.endFrame();
+      glFlush();
+      continue;
+    }
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
 
+  simulation.stop();
+
+  // per-frame times, then the summary as JSON (to --json FILE, or after the frames on stdout)
+  if (headlessFrames > 0)
+    writeHeadlessSummary(frameTimings, defaultSphere, sculptureAnimated, instanceUploader);
+
   // optional: de-allocate all resources once they've outlived their purpose:
   // ------------------------------------------------------------------------
-  glDeleteVertexArrays(1, &VAO);
-  glDeleteBuffers(1, &VBO);
+  glDeleteVertexArrays(1, &sphereVAO);
+  glDeleteVertexArrays(1, &culledVAO);
+  glDeleteVertexArrays(2, motionVAO);
+  glDeleteBuffers(1, &culledVBO);
+  glDeleteBuffers(1, &sphereVBO);
+  glDeleteBuffers(1, &sphereEBO);
+  glDeleteBuffers(1, &instanceVBO);
 
   // glfw: terminate, clearing all previously allocated GLFW resources.
   // ------------------------------------------------------------------
@@ -195,6 +759,668 @@ int main()
   return 0;
 }
 
+// reads the command line into the settings above
+void parseCommandLine(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--stars" && hasValue)
+      galaxyParams.numStars = static_cast<unsigned int>(std::strtoul(argv[++i], NULL, 10));
+    else if (arg == "--seed" && hasValue)
+      galaxyParams.seed = static_cast<uint32_t>(std::strtoul(argv[++i], NULL, 10));
+    else if (arg == "--threads" && hasValue)
+      galaxyThreads = static_cast<unsigned int>(std::strtoul(argv[++i], NULL, 10));
+    else if (arg == "--kernel" && hasValue)
+      galaxyKernel = parseGalaxyKernel(argv[++i]);
+    else if (arg == "--instance-format" && hasValue)
+      instanceFormat = parseStarInstanceFormat(argv[++i]);
+    else if (arg == "--star-source" && hasValue)
+      starSource = parseStarSource(argv[++i]);
+    else if (arg == "--cull" && hasValue)
+      cullMode = parseStarCullMode(argv[++i]);
+    else if (arg == "--render" && hasValue)
+      renderMode = parseStarRenderMode(argv[++i]);
+    else if (arg == "--sphere" && hasValue)
+      sphereShape = parseSphereShape(argv[++i]);
+    else if (arg == "--morton")
+      mortonOrder = true;
+    else if (arg == "--load-snapshot" && hasValue)
+      snapshotLoadPath = argv[++i];
+    else if (arg == "--save-snapshot" && hasValue)
+      snapshotSavePath = argv[++i];
+    else if (arg == "--sculpture" && hasValue)
+      sculpturePath = argv[++i];
+    else if (arg == "--upload" && hasValue)
+      uploadMethod = parseInstanceUploadMethod(argv[++i]);
+    else if (arg == "--lod")
+      lodEnabled = true;
+    else if (arg == "--octree")
+      octreeEnabled = lodEnabled = true;
+    else if (arg == "--octree-error" && hasValue)
+      octreeError = static_cast<float>(std::atof(argv[++i]));
+    else if (arg == "--motion" && hasValue)
+      motionMode = parseStarMotionMode(argv[++i]);
+    else if (arg == "--motion-path" && hasValue)
+      motionPath = parseStarMotionPath(argv[++i]);
+    else if (arg == "--theta" && hasValue)
+      nbodyParams.theta = static_cast<float>(std::atof(argv[++i]));
+    else if (arg == "--softening" && hasValue)
+      nbodyParams.softening = static_cast<float>(std::atof(argv[++i]));
+    else if (arg == "--timestep" && hasValue)
+      nbodyParams.timestep = static_cast<float>(std::atof(argv[++i]));
+    else if (arg == "--substeps" && hasValue)
+      kineticParams.substeps = std::max(1ul, std::strtoul(argv[++i], NULL, 10));
+    else if (arg == "--strand-spheres" && hasValue)
+      kineticParams.spheresPerStrand = std::max(1ul, std::strtoul(argv[++i], NULL, 10));
+    else if (arg == "--sim-thread")
+      simulationThreadEnabled = true;
+    else if (arg == "--sim-rate" && hasValue)
+      simulationRate = std::max(1.0f, static_cast<float>(std::atof(argv[++i])));
+    else if (arg == "--benchmark-nbody")
+      benchmarkNBody = true;
+    else if (arg == "--benchmark-morton")
+      benchmarkMorton = true;
+    else if (arg == "--benchmark-kinetic")
+      benchmarkKinetic = true;
+    else if (arg == "--benchmark-picking")
+      benchmarkPicking = true;
+    else if (arg == "--headless" && hasValue)
+      headlessFrames = static_cast<unsigned int>(std::strtoul(argv[++i], NULL, 10));
+    else if (arg == "--size" && hasValue)
+    {
+      std::string size = argv[++i];
+      size_t x = size.find('x');
+      if (x != std::string::npos)
+      {
+        viewportWidth = std::max(1ul, std::strtoul(size.c_str(), NULL, 10));
+        viewportHeight = std::max(1ul, std::strtoul(size.c_str() + x + 1, NULL, 10));
+      }
+    }
+    else if (arg == "--json" && hasValue)
+      benchmarkJsonPath = argv[++i];
+    else if (arg == "--check-kernels")
+      checkKernels = true;
+    else if (arg == "--check-procedural")
+      checkProcedural = true;
+    else if (arg == "--check-spheres")
+      checkSpheres = true;
+    else if (arg == "--check-parallel")
+      checkParallel = true;
+  }
+}
+
+// Options that rule each other out, settled once the context exists (the GPU paths depend on its version).
+// Each fallback says what it changed; the ones that depend on loaded data (snapshots, sculptures) stay
+// where that data is read.
+void resolveRenderModes()
+{
+  // point sprites: each star is a single vertex, which costs the GPU no more than culling or the LOD chain
+  // would. The octree still pays off, merging clusters under a pixel into one sprite with their summed light.
+  if (renderMode == STAR_RENDER_POINTS && (cullMode != STAR_CULL_NONE || (lodEnabled && !octreeEnabled)))
+  {
+    std::cout << "points: every star is one vertex, culling and LOD are skipped (--octree still merges clusters)" << std::endl;
+    cullMode = STAR_CULL_NONE;
+    lodEnabled = octreeEnabled;
+  }
+
+  // the kinetic sculpture replaces the galaxy with its own spheres, kept in strand order in an instance buffer
+  if (motionMode == STAR_MOTION_KINETIC && (starSource == STAR_SOURCE_PROCEDURAL || !snapshotLoadPath.empty() || mortonOrder))
+  {
+    std::cout << "kinetic: the sculpture builds its own spheres in strand order, ignoring procedural stars, snapshots and --morton" << std::endl;
+    starSource = STAR_SOURCE_BUFFER;
+    snapshotLoadPath.clear();
+    mortonOrder = false;
+  }
+
+  if (lodEnabled && starSource == STAR_SOURCE_PROCEDURAL)
+  {
+    std::cout << "lod: procedural stars have no instance buffer to sort, LOD disabled" << std::endl;
+    lodEnabled = octreeEnabled = false;
+  }
+  if (motionMode != STAR_MOTION_RIGID && starSource == STAR_SOURCE_PROCEDURAL)
+  {
+    std::cout << "motion: procedural stars have no instance buffer to move, rotating rigidly" << std::endl;
+    motionMode = STAR_MOTION_RIGID;
+  }
+  if (octreeEnabled && motionMode != STAR_MOTION_RIGID)
+  {
+    std::cout << "octree: the tree is built once and cannot follow moving stars, octree disabled" << std::endl;
+    octreeEnabled = false;
+  }
+  if (cullMode != STAR_CULL_NONE && starSource == STAR_SOURCE_PROCEDURAL)
+  {
+    std::cout << "cull: procedural stars have no instance buffer to compact, culling disabled" << std::endl;
+    cullMode = STAR_CULL_NONE;
+  }
+  if (cullMode == STAR_CULL_GPU && !GpuStarCuller::isSupported())
+  {
+    std::cout << "cull: compute shaders need OpenGL 4.3, falling back to CPU culling" << std::endl;
+    cullMode = STAR_CULL_CPU;
+  }
+  if (cullMode == STAR_CULL_GPU && lodEnabled)
+  {
+    std::cout << "cull: LOD buckets are sorted on the CPU, culling there as well" << std::endl;
+    cullMode = STAR_CULL_CPU;
+  }
+
+  // moving stars: CPU culling and LOD read the star positions on the CPU. N-body and the kinetic sculpture
+  // only run there.
+  const bool motionOnCpuArrays = cullMode == STAR_CULL_CPU || lodEnabled;
+  if (motionMode != STAR_MOTION_RIGID && motionPath == STAR_MOTION_GPU &&
+      (motionMode == STAR_MOTION_NBODY || motionMode == STAR_MOTION_KINETIC || motionOnCpuArrays || !GpuStarMotion::isSupported()))
+  {
+    std::cout << "motion: "
+              << (motionMode == STAR_MOTION_NBODY      ? "N-body has no GPU path"
+                  : motionMode == STAR_MOTION_KINETIC ? "the kinetic sculpture has no GPU path"
+                  : motionOnCpuArrays ? "CPU culling and LOD need the positions on the CPU" : "compute shaders need OpenGL 4.3")
+              << ", moving the stars on the CPU" << std::endl;
+    motionPath = STAR_MOTION_CPU;
+  }
+}
+
+// global opengl state for the render mode
+void setupRenderState()
+{
+  glEnable(GL_DEPTH_TEST);
+  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+  glEnable(GL_PROGRAM_POINT_SIZE);
+  if (renderMode == STAR_RENDER_POINTS)
+  {
+    // additive: overlapping stars add up to a glow, so draw order does not matter and depth need not be written
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glDepthMask(GL_FALSE);
+  }
+}
+
+// sphere meshes: the default sphere goes first, so the paths without LOD draw it from index 0, then the
+// other LOD levels. Each is reordered for the vertex cache, which pays off once per star drawn.
+// The ranges of starLod's levels are set to where their meshes landed.
+SphereMeshBuffer buildStarSpheres(const StarLodLevel &defaultSphere, StarLod &starLod)
+{
+  std::vector<StarLodLevel> sphereLevels(1, defaultSphere);
+  std::vector<size_t> levelMesh(starLod.levels.size(), 0);
+  if (lodEnabled)
+  {
+    for (size_t l = 0; l < starLod.levels.size(); ++l)
+    {
+      const StarLodLevel &level = starLod.levels[l];
+      if (level.isSprite() || level.sameMesh(defaultSphere))
+        continue;
+      levelMesh[l] = sphereLevels.size();
+      sphereLevels.push_back(level);
+    }
+  }
+  std::vector<SphereMesh> sphereMeshes;
+  for (const StarLodLevel &level : sphereLevels)
+  {
+    bool embedded = false;
+    sphereMeshes.push_back(starSphereMesh(level, embedded));
+    SphereMesh &mesh = sphereMeshes.back();
+    float generated = vertexCacheAcmr(mesh.indices, mesh.vertexCount());
+    optimizeVertexCache(mesh);
+    std::cout << "sphere " << level.name() << (embedded ? " (embedded)" : "") << ": " << mesh.vertexCount() << " vertices, " << mesh.triangleCount()
+              << " triangles, ACMR " << generated << " -> " << vertexCacheAcmr(mesh.indices, mesh.vertexCount()) << std::endl;
+  }
+  SphereMeshBuffer sphereBuffer(sphereMeshes);
+  starLod.indexType = sphereBuffer.indexType();
+  for (size_t l = 0; l < starLod.levels.size(); ++l)
+  {
+    const SphereMeshRange &range = sphereBuffer.ranges[levelMesh[l]];
+    starLod.levels[l].baseVertex = range.baseVertex;
+    starLod.levels[l].firstIndex = range.firstIndex;
+    starLod.levels[l].indexCount = starLod.levels[l].isSprite() ? 0 : range.indexCount;
+  }
+  return sphereBuffer;
+}
+
+// casts the pick ray from the camera through model into the stars and reports the first star it hits
+void pickStar(const glm::mat4 &model, bool motionOnCpuArrays, bool sculptureAnimated, StarBvh &starBvh, const StarMortonOrder &starOrder)
+{
+  const bool starsMove = motionMode != STAR_MOTION_RIGID || sculptureAnimated;
+  if (galaxyVertices.empty())
+  {
+    std::cout << "pick: the stars only exist on the GPU (procedural stars or a mapped snapshot)" << std::endl;
+  }
+  else if (motionMode != STAR_MOTION_RIGID && !motionOnCpuArrays)
+  {
+    std::cout << "pick: the stars move in the instance buffers only, --cull cpu or --lod keeps them on the CPU" << std::endl;
+  }
+  else
+  {
+    if (starBvh.empty() || starsMove)
+    {
+      starBvh.build(galaxyVertices, STAR_RADIUS, galaxyThreads);
+      std::cout << "pick: BVH of " << starBvh.stats.nodes << " nodes built in " << starBvh.stats.buildMilliseconds << " ms on "
+                << starBvh.stats.threads << " threads" << std::endl;
+    }
+    glm::mat4 toModel = glm::inverse(model);
+    glm::vec3 origin = glm::vec3(toModel * glm::vec4(camera.Position, 1.0f));
+    glm::vec3 direction = glm::normalize(glm::vec3(toModel * glm::vec4(camera.Front, 0.0f)));
+    StarPick pick = starBvh.pick(origin, direction);
+    if (pick.hit)
+    {
+      const float *star = &galaxyVertices[static_cast<size_t>(pick.slot) * GALAXY_FLOATS_PER_STAR];
+      std::cout << "pick: star " << starOrder.idOf(pick.slot) << " at (" << star[0] << ", " << star[1] << ", " << star[2] << "), color ("
+                << star[3] << ", " << star[4] << ", " << star[5] << "), " << pick.distance << " away";
+    }
+    else
+    {
+      std::cout << "pick: no star";
+    }
+    std::cout << " (" << pick.nodesVisited << " nodes visited in " << pick.microseconds << " us)" << std::endl;
+  }
+}
+
+// the frame times of a headless run and the settings they were measured with
+void writeHeadlessSummary(FrameTimings &frameTimings, const StarLodLevel &defaultSphere, bool sculptureAnimated, const InstanceUploader &instanceUploader)
+{
+  frameTimings.resolve();
+  for (unsigned int f = 0; f < frameTimings.frames(); ++f)
+    std::cout << "frame " << f << ": cpu " << frameTimings.cpuMilliseconds[f] << " ms, gpu " << frameTimings.gpuMilliseconds[f] << " ms" << std::endl;
+  const char *cullNames[] = {"none", "cpu", "gpu"};
+  const char *motionNames[] = {"rigid", "differential", "nbody", "kinetic"};
+  std::ostringstream config;
+  config << "  \"renderer\": \"" << glGetString(GL_RENDERER) << "\",\n"
+         << "  \"width\": " << viewportWidth << ",\n  \"height\": " << viewportHeight << ",\n"
+         << "  \"stars\": " << galaxyParams.numStars << ",\n"
+         << "  \"instance_format\": \"" << (instanceFormat == STAR_FORMAT_PACKED ? "packed" : "float") << "\",\n"
+         << "  \"star_source\": \"" << (starSource == STAR_SOURCE_PROCEDURAL ? "procedural" : "buffer") << "\",\n"
+         << "  \"render\": \"" << (renderMode == STAR_RENDER_POINTS ? "points" : "spheres") << "\",\n"
+         << "  \"sphere\": \"" << defaultSphere.name() << "\",\n"
+         << "  \"cull\": \"" << cullNames[cullMode] << "\",\n"
+         << "  \"lod\": " << (lodEnabled ? "true" : "false") << ",\n  \"octree\": " << (octreeEnabled ? "true" : "false") << ",\n"
+         << "  \"motion\": \"" << motionNames[motionMode] << "\",\n";
+  if (sculptureAnimated)
+    config << "  \"upload_bytes_per_frame\": " << instanceUploader.stats.totalBytes / std::max<uint64_t>(1, instanceUploader.stats.uploads) << ",\n";
+  if (benchmarkJsonPath.empty())
+  {
+    frameTimings.writeJson(std::cout, config.str());
+  }
+  else
+  {
+    std::ofstream json(benchmarkJsonPath);
+    frameTimings.writeJson(json, config.str());
+    std::cout << "headless: summary written to " << benchmarkJsonPath << std::endl;
+  }
+}
+
+// compare every SIMD kernel this CPU supports against the scalar formulas and exit
+int runCheckKernels()
+{
+  bool passed = true;
+  for (GalaxyKernel kernel : {GALAXY_KERNEL_SSE41, GALAXY_KERNEL_AVX2})
+  {
+    if (resolveGalaxyKernel(kernel) != kernel)
+      continue;
+    GalaxyKernelError error = checkGalaxyKernel(kernel, galaxyParams, 1u << 20);
+    std::cout << galaxyKernelName(kernel) << ": max position error " << error.position << ", max color error "
+              << error.color << (error.passed ? " (ok)" : " (FAILED)") << std::endl;
+    passed = passed && error.passed;
+  }
+
+  // the orbit kernels of the differential motion mode, a quarter turn of the rim in
+  GalaxyParams motionParams = galaxyParams;
+  motionParams.numStars = 1u << 20;
+  std::vector<float> motionStars;
+  generateGalaxy(motionParams, motionStars, galaxyThreads, GALAXY_KERNEL_SCALAR);
+  StarMotion motion;
+  motion.init(motionStars, RotationCurve());
+  for (GalaxyKernel kernel : {GALAXY_KERNEL_SSE41, GALAXY_KERNEL_AVX2})
+  {
+    if (resolveGalaxyKernel(kernel) != kernel)
+      continue;
+    float error = motion.checkKernel(kernel, 150.0f);
+    std::cout << galaxyKernelName(kernel) << " orbits: max position error " << error << " x radius"
+              << (error <= GALAXY_SINCOS_MAX_ERROR ? " (ok)" : " (FAILED)") << std::endl;
+    passed = passed && error <= GALAXY_SINCOS_MAX_ERROR;
+  }
+  return passed ? 0 : 1;
+}
+
+// run the procedural vertex shader, compare the stars it builds with the generator and exit; needs a
+// context, so it makes its own: headless where EGL is available, a hidden window otherwise
+int runCheckProcedural()
+{
+  HeadlessContext headless;
+  GLFWwindow *window = NULL;
+  if (!headless.create(1, 1))
+  {
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    window = glfwCreateWindow(1, 1, "LearnOpenGL", NULL, NULL);
+    if (window == NULL)
+    {
+      std::cout << "procedural: no OpenGL context (" << headless.error << ", no window either)" << std::endl;
+      glfwTerminate();
+      return 1;
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+      std::cout << "Failed to initialize GLAD" << std::endl;
+      return 1;
+    }
+  }
+
+  const uint32_t numStars = 1u << 20;
+  std::vector<float> stars;
+  std::string error;
+  bool captured = captureProceduralStars("assignment_2.vs", galaxyParams, numStars, stars, error);
+  if (window != NULL)
+    glfwTerminate();
+  if (!captured)
+  {
+    std::cout << "procedural: " << error << std::endl;
+    return 1;
+  }
+  GalaxyKernelError difference = checkGeneratedStars(galaxyParams, stars.data(), numStars);
+  std::cout << "procedural: " << numStars << " stars from the shader, max position error " << difference.position << ", max color error "
+            << difference.color << " against generateStar()" << (difference.passed ? " (ok)" : " (FAILED)") << std::endl;
+  return difference.passed ? 0 : 1;
+}
+
+// compare the compile-time spheres with generateUvSphere() and exit
+int runCheckSpheres()
+{
+  bool passed = true;
+  for (const StarLodLevel &level : defaultStarLodLevels(SPHERE_UV))
+  {
+    bool embedded = false;
+    SphereMesh built = level.isSprite() ? SphereMesh() : starSphereMesh(level, embedded);
+    if (!embedded)
+      continue;
+    SphereMesh generated = generateUvSphere(STAR_RADIUS, level.sectors, level.stacks);
+    float error = built.vertices.size() == generated.vertices.size() ? 0.0f : INFINITY;
+    for (size_t k = 0; error == 0.0f && k < built.vertices.size(); ++k)
+      error = std::max(error, std::fabs(built.vertices[k] - generated.vertices[k]));
+    bool same = error == 0.0f && built.indices == generated.indices;
+    std::cout << "sphere " << level.name() << ": max vertex difference " << error << ", indices "
+              << (built.indices == generated.indices ? "identical" : "different") << (same ? " (ok)" : " (FAILED)") << std::endl;
+    passed = passed && same;
+  }
+  return passed ? 0 : 1;
+}
+
+// hammer the worker pool from two threads, count how often each task ran and exit
+int runCheckParallel()
+{
+  const unsigned int rounds = 20000;
+  uint64_t wrong = checkParallelRuns(rounds);
+  std::cout << "parallel: " << 2 * rounds << " dispatches, " << wrong << " tasks not run exactly once" << (wrong == 0 ? " (ok)" : " (FAILED)")
+            << std::endl;
+  return wrong == 0 ? 0 : 1;
+}
+
+// Barnes-Hut steps/sec at a few galaxy sizes, the first step after init warming up the caches
+int runBenchmarkNBody()
+{
+  const unsigned int steps = 3;
+  for (unsigned int bodies : {100000u, 1000000u, 4000000u})
+  {
+    GalaxyParams params = galaxyParams;
+    params.numStars = bodies;
+    std::vector<float> stars;
+    generateGalaxy(params, stars, galaxyThreads, galaxyKernel);
+    NBodySimulation simulation;
+    simulation.init(stars, nbodyParams, galaxyThreads);
+    simulation.step();
+    double buildMilliseconds = 0.0, forceMilliseconds = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int s = 0; s < steps; ++s)
+    {
+      simulation.step();
+      buildMilliseconds += simulation.stats.buildMilliseconds;
+      forceMilliseconds += simulation.stats.forceMilliseconds;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "nbody: " << bodies << " bodies, " << steps / seconds << " steps/sec (tree " << buildMilliseconds / steps
+              << " ms, forces " << forceMilliseconds / steps << " ms, " << simulation.stats.nodes << " nodes, "
+              << simulation.stats.threads << " threads, theta " << nbodyParams.theta << ")" << std::endl;
+  }
+  return 0;
+}
+
+// kinetic sculpture steps against the 60 Hz budget, after two seconds of swing-up so the cables are
+// taut and the solver does real work
+int runBenchmarkKinetic()
+{
+  const unsigned int steps = 60;
+  for (unsigned int spheres : {25000u, 100000u, 400000u})
+  {
+    KineticSculpture sculpture;
+    sculpture.build(spheres, galaxyParams.radius, kineticParams, galaxyThreads);
+    for (unsigned int s = 0; s < 120; ++s)
+      sculpture.step();
+    double solveMilliseconds = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int s = 0; s < steps; ++s)
+    {
+      sculpture.step();
+      solveMilliseconds += sculpture.stats.solveMilliseconds;
+    }
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / steps;
+    std::cout << "kinetic: " << spheres << " spheres, " << milliseconds << " ms/step (solve " << solveMilliseconds / steps << " ms), "
+              << 1000.0 / milliseconds << " steps/sec" << (milliseconds <= 1000.0 / 60.0 ? " (60 Hz ok)" : " (below 60 Hz)") << ", "
+              << sculpture.stats.motors << " motors, " << sculpture.stats.constraints << " constraints in " << sculpture.stats.colors
+              << " colors, " << kineticParams.substeps << " substeps, " << sculpture.stats.threads << " threads, max stretch "
+              << sculpture.maxViolation() * 100.0f << "%" << std::endl;
+  }
+  return 0;
+}
+
+// BVH build time and pick queries from points along the headless camera orbit towards random points of the
+// disc; the first rays are checked against testing every star
+int runBenchmarkPicking()
+{
+  const unsigned int queries = 1000, checked = 20;
+  for (unsigned int numStars : {1000000u, 10000000u})
+  {
+    GalaxyParams params = galaxyParams;
+    params.numStars = numStars;
+    std::vector<float> stars;
+    generateGalaxy(params, stars, galaxyThreads, galaxyKernel);
+    StarBvh bvh;
+    bvh.build(stars, STAR_RADIUS, galaxyThreads);
+    std::cout << "picking: " << numStars << " stars, BVH of " << bvh.stats.nodes << " nodes built in " << bvh.stats.buildMilliseconds
+              << " ms on " << bvh.stats.threads << " threads" << std::endl;
+
+    std::vector<double> microseconds;
+    double totalVisited = 0.0;
+    unsigned int hits = 0, mismatches = 0;
+    for (unsigned int q = 0; q < queries; ++q)
+    {
+      uint32_t key = galaxyStarKey(galaxySeedKey(params.seed + 1), q);
+      glm::vec3 origin = benchmarkCamera(static_cast<float>(q) / queries, 1.0f, params.radius).Position;
+      float r = params.radius * std::sqrt(galaxyRandom(key, STREAM_RADIUS));
+      float a = 2.0f * static_cast<float>(M_PI) * galaxyRandom(key, STREAM_ARM);
+      glm::vec3 direction = glm::normalize(glm::vec3(r * std::cos(a), 0.0f, r * std::sin(a)) - origin);
+      StarPick pick = bvh.pick(origin, direction);
+      microseconds.push_back(pick.microseconds);
+      totalVisited += pick.nodesVisited;
+      hits += pick.hit;
+      if (q < checked)
+      {
+        StarPick expected = StarBvh::pickBruteForce(stars, STAR_RADIUS, origin, direction);
+        mismatches += pick.hit != expected.hit || (pick.hit && std::abs(pick.distance - expected.distance) > 1e-4f);
+      }
+    }
+    std::cout << "  " << queries << " queries: " << FrameTimings::percentile(microseconds, 50.0) << " us median, "
+              << FrameTimings::percentile(microseconds, 99.0) << " us p99, " << FrameTimings::percentile(microseconds, 100.0) << " us max, "
+              << totalVisited / queries << " nodes visited, " << hits << " hits, " << mismatches << "/" << checked
+              << " differ from testing every star" << std::endl;
+  }
+  return 0;
+}
+
+// culling, LOD bucketing and the instance gather that follows them, in generation order and then in
+// Morton order, over a few fixed views. The frame time is the CPU side of a culled frame: cull + gather.
+int runBenchmarkMorton()
+{
+  const unsigned int repeats = 5;
+  const float aspect = (float)SCR_WIDTH / (float)SCR_HEIGHT;
+  const float fovY = glm::radians(ZOOM);
+  const Camera views[] = {Camera(glm::vec3(0.0f, 0.0f, 3.0f)), Camera(glm::vec3(0.0f, 6.0f, 14.0f), glm::vec3(0.0f, 1.0f, 0.0f), -90.0f, -25.0f),
+                          Camera(glm::vec3(12.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 180.0f, -10.0f),
+                          Camera(glm::vec3(3.0f, 0.5f, 3.0f), glm::vec3(0.0f, 1.0f, 0.0f), -135.0f, -30.0f)};
+  for (unsigned int numStars : {1000000u, 4000000u})
+  {
+    GalaxyParams params = galaxyParams;
+    params.numStars = numStars;
+    std::vector<float> stars;
+    generateGalaxy(params, stars, galaxyThreads, galaxyKernel);
+    std::vector<float> generated = stars;
+    std::cout << "morton: " << numStars << " stars" << std::endl;
+    for (int sorted = 0; sorted < 2; ++sorted)
+    {
+      StarMortonOrder order;
+      if (sorted)
+      {
+        order.sort(stars, params.radius, galaxyThreads);
+        bool remapped = true;
+        for (uint32_t slot = 0; slot < numStars && remapped; ++slot)
+          remapped = order.slotOf(order.idOf(slot)) == slot &&
+                     std::equal(&stars[static_cast<size_t>(slot) * GALAXY_FLOATS_PER_STAR], &stars[static_cast<size_t>(slot + 1) * GALAXY_FLOATS_PER_STAR],
+                                &generated[static_cast<size_t>(order.idOf(slot)) * GALAXY_FLOATS_PER_STAR]);
+        std::cout << "  sorted in " << order.stats.milliseconds << " ms on " << order.stats.threads << " threads, id remap "
+                  << (remapped ? "ok" : "FAILED") << std::endl;
+        if (!remapped)
+          return 1;
+      }
+      std::vector<PackedStar> packed;
+      if (instanceFormat == STAR_FORMAT_PACKED)
+        packStars(stars, params.radius, packed, galaxyThreads);
+      const unsigned char *instances = instanceFormat == STAR_FORMAT_PACKED ? reinterpret_cast<const unsigned char *>(packed.data())
+                                                                             : reinterpret_cast<const unsigned char *>(stars.data());
+      const size_t stride = starInstanceStride(instanceFormat);
+      std::vector<unsigned char> gathered(static_cast<size_t>(numStars) * stride);
+
+      StarCuller culler;
+      StarLod lod;
+      double cullMilliseconds = 0.0, gatherMilliseconds = 0.0, lodMilliseconds = 0.0;
+      uint64_t visible = 0;
+      for (unsigned int r = 0; r < repeats; ++r)
+      {
+        for (const Camera &view : views)
+        {
+          Frustum frustum = createFrustumFromCamera(view, aspect, fovY, 0.1f, 100.0f);
+          culler.cull(stars, frustum, STAR_RADIUS, galaxyThreads);
+          cullMilliseconds += culler.stats.milliseconds;
+          visible += culler.stats.visible;
+          auto start = std::chrono::steady_clock::now();
+          culler.gather(gathered.data(), instances, stride);
+          gatherMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+          lod.select(stars, view.Position, StarLod::projectionScale(fovY, (float)SCR_HEIGHT), STAR_RADIUS, &frustum, galaxyThreads);
+          start = std::chrono::steady_clock::now();
+          lod.buckets.gather(gathered.data(), instances, stride);
+          lodMilliseconds += lod.stats.milliseconds + std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+      }
+      const double frames = repeats * (sizeof(views) / sizeof(views[0]));
+      std::cout << "  " << (sorted ? "morton order:    " : "generation order: ") << "cull " << cullMilliseconds / frames << " ms ("
+                << numStars * frames / cullMilliseconds / 1000.0 << " M stars/sec), gather " << gatherMilliseconds / frames << " ms of "
+                << visible / frames << " stars, frame " << (cullMilliseconds + gatherMilliseconds) / frames << " ms, lod select + gather "
+                << lodMilliseconds / frames << " ms" << std::endl;
+    }
+  }
+  return 0;
+}
+
+// Runs the vertex shader at vertexPath with starSource = 1 over numStars points and captures, with transform
+// feedback, the position and color it builds for each, in the generateGalaxy() layout. The transforms are
+// identity and aPos stays at the origin, so gl_Position.xyz is the star itself. Needs a current context.
+bool captureProceduralStars(const char *vertexPath, const GalaxyParams &params, uint32_t numStars, std::vector<float> &stars, std::string &error)
+{
+  std::ifstream file(vertexPath);
+  std::stringstream source;
+  source << file.rdbuf();
+  if (!file)
+  {
+    error = std::string("cannot read ") + vertexPath;
+    return false;
+  }
+  std::string code = source.str();
+  const char *text = code.c_str();
+  unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
+  glShaderSource(vertex, 1, &text, NULL);
+  glCompileShader(vertex);
+  unsigned int program = glCreateProgram();
+  glAttachShader(program, vertex);
+  const char *varyings[] = {"gl_Position", "VertexColor"};
+  glTransformFeedbackVaryings(program, 2, varyings, GL_INTERLEAVED_ATTRIBS);
+  glLinkProgram(program);
+  glDeleteShader(vertex);
+  int linked = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked)
+  {
+    char log[1024];
+    glGetProgramInfoLog(program, sizeof(log), NULL, log);
+    error = std::string("the shader does not link: ") + log;
+    glDeleteProgram(program);
+    return false;
+  }
+
+  glUseProgram(program);
+  const glm::mat4 identity(1.0f);
+  for (const char *name : {"model", "view", "projection"})
+    glUniformMatrix4fv(glGetUniformLocation(program, name), 1, GL_FALSE, &identity[0][0]);
+  glUniform1f(glGetUniformLocation(program, "positionScale"), 1.0f);
+  glUniform1i(glGetUniformLocation(program, "starSource"), STAR_SOURCE_PROCEDURAL);
+  glUniform1ui(glGetUniformLocation(program, "galaxySeed"), params.seed);
+  glUniform1i(glGetUniformLocation(program, "galaxyArms"), params.arms);
+  glUniform1f(glGetUniformLocation(program, "galaxyRadius"), params.radius);
+  glUniform1i(glGetUniformLocation(program, "pointSprite"), 0);
+  glUniform1i(glGetUniformLocation(program, "starsAreVertices"), 1);
+
+  // gl_Position (vec4) and VertexColor (vec3) per star
+  const size_t floatsPerStar = 7;
+  unsigned int vao, feedback;
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &feedback);
+  glBindVertexArray(vao);
+  glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, feedback);
+  glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, numStars * floatsPerStar * sizeof(float), NULL, GL_STATIC_READ);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, feedback);
+  glEnable(GL_RASTERIZER_DISCARD);
+  glBeginTransformFeedback(GL_POINTS);
+  glDrawArrays(GL_POINTS, 0, numStars);
+  glEndTransformFeedback();
+  glDisable(GL_RASTERIZER_DISCARD);
+
+  std::vector<float> captured(numStars * floatsPerStar);
+  glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, captured.size() * sizeof(float), captured.data());
+  stars.resize(static_cast<size_t>(numStars) * GALAXY_FLOATS_PER_STAR);
+  for (size_t i = 0; i < numStars; ++i)
+  {
+    const float *in = &captured[i * floatsPerStar];
+    float *out = &stars[i * GALAXY_FLOATS_PER_STAR];
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2];
+    out[3] = in[4];
+    out[4] = in[5];
+    out[5] = in[6];
+  }
+  glDeleteBuffers(1, &feedback);
+  glDeleteVertexArrays(1, &vao);
+  glDeleteProgram(program);
+  if (glGetError() != GL_NO_ERROR)
+  {
+    error = "transform feedback failed";
+    return false;
+  }
+  return true;
+}
+
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
 void processInput(GLFWwindow *window)
@@ -244,6 +1470,14 @@ void mouse_callback(GLFWwindow *window, double xposIn, double yposIn)
   camera.ProcessMouseMovement(xoffset, yoffset);
 }
 
+// glfw: a left click asks the render loop to pick the star in the middle of the view
+// --------------------------------------------------------------------------------
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
+{
+  if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    pickRequested = true;
+}
+
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
@@ -251,80 +1485,56 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
   camera.ProcessMouseScroll(static_cast<float>(yoffset));
 }
 
-void generateGalaxy(int numStars, int arms, float radius)
+// vertex array for instanced spheres: attribute 0 is the sphere mesh, attributes 1 and 2 come from
+// instanceBuffer (0 for procedural stars, which have no instance attributes)
+unsigned int createStarVAO(unsigned int sphereVBO, unsigned int sphereEBO, unsigned int instanceBuffer, StarInstanceFormat format)
 {
-  galaxyVertices.clear();
-  srand(static_cast<unsigned>(time(0)));
+  unsigned int vao;
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
 
-  float armOffset = 2.0f * M_PI / arms;
+  glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
+  glEnableVertexAttribArray(0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
 
-  for (int i = 0; i < numStars; i++)
+  if (instanceBuffer != 0)
   {
-    float r = radius * sqrt(static_cast<float>(rand()) / RAND_MAX);
-
-    int arm = rand() % arms;
-    float angle = (r * 1.5f) + arm * armOffset;
-
-    float deviation = ((rand() / (float)RAND_MAX) - 0.5f) * 0.3f;
-    float distanceRatio = r / radius;
-
-    float x = r * cos(angle + deviation);
-    float y = ((rand() / (float)RAND_MAX) - 0.5f) * 0.2f;
-    float z = r * sin(angle + deviation);
-
-    float R = glm::mix(1.0f, 0.5f, distanceRatio);
-    float G = glm::mix(0.4f, 0.8f, distanceRatio);
-    float B = glm::mix(0.3f, 1.0f, pow(distanceRatio, 0.5f));
-
-    R += ((rand() / (float)RAND_MAX) - 0.5f) * 0.05f;
-    G += ((rand() / (float)RAND_MAX) - 0.5f) * 0.05f;
-    B += ((rand() / (float)RAND_MAX) - 0.5f) * 0.05f;
-
-    R = glm::clamp(R, 0.0f, 1.0f);
-    G = glm::clamp(G, 0.0f, 1.0f);
-    B = glm::clamp(B, 0.0f, 1.0f);
-
-    galaxyVertices.push_back(x);
-    galaxyVertices.push_back(y);
-    galaxyVertices.push_back(z);
-    galaxyVertices.push_back(r / radius);
-    galaxyVertices.push_back(0.8f + y);
-    galaxyVertices.push_back(1.0f);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    setupStarInstanceAttributes(format);
   }
+  glBindVertexArray(0);
+  return vao;
 }
 
-void generateSphere(float radius, int sectorCount, int stackCount)
+// the mesh of a sphere level: one of the compile-time spheres when its size is embedded, generated otherwise
+SphereMesh starSphereMesh(const StarLodLevel &level, bool &embedded)
 {
-  for (int i = 0; i <= stackCount; ++i)
-  {
-    float stackAngle = M_PI / 2 - i * M_PI / stackCount; // latitude
-    float xy = radius * cosf(stackAngle);
-    float z = radius * sinf(stackAngle);
-
-    for (int j = 0; j <= sectorCount; ++j)
-    {
-      float sectorAngle = j * 2 * M_PI / sectorCount; // longitude
-
-      float x = xy * cosf(sectorAngle);
-      float y = xy * sinf(sectorAngle);
-      sphereVertices.insert(sphereVertices.end(), {x, y, z});
-    }
-  }
+  embedded = level.subdivisions < 0;
+  if (level.subdivisions < 0 && level.sectors == 4 && level.stacks == 3)
+    return STAR_SPHERE_4X3.mesh();
+  if (level.subdivisions < 0 && level.sectors == 6 && level.stacks == 4)
+    return STAR_SPHERE_6X4.mesh();
+  if (level.subdivisions < 0 && level.sectors == 12 && level.stacks == 8)
+    return STAR_SPHERE_12X8.mesh();
+  if (level.subdivisions < 0 && level.sectors == 24 && level.stacks == 16)
+    return STAR_SPHERE_24X16.mesh();
+  embedded = false;
+  return level.mesh(STAR_RADIUS);
+}
 
-  // indices
-  for (int i = 0; i < stackCount; ++i)
+// one star per vertex for point sprites: attribute 0 (the sphere vertex) stays disabled and reads as the
+// origin, and the instance attributes advance per vertex. instanceBuffer is 0 for procedural stars.
+unsigned int createStarPointVAO(unsigned int instanceBuffer, StarInstanceFormat format)
+{
+  unsigned int vao;
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+  if (instanceBuffer != 0)
   {
-    int k1 = i * (sectorCount + 1);
-    int k2 = k1 + sectorCount + 1;
-
-    for (int j = 0; j < sectorCount; ++j, ++k1, ++k2)
-    {
-      sphereIndices.push_back(static_cast<unsigned int>(k1));
-      sphereIndices.push_back(static_cast<unsigned int>(k2));
-      sphereIndices.push_back(static_cast<unsigned int>(k1 + 1));
-      sphereIndices.push_back(static_cast<unsigned int>(k1 + 1));
-      sphereIndices.push_back(static_cast<unsigned int>(k2));
-      sphereIndices.push_back(static_cast<unsigned int>(k2 + 1));
-    }
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    setupStarInstanceAttributes(format, 0, 0);
   }
+  glBindVertexArray(0);
+  return vao;
 }
\ No newline at end of file
@@ -1,8 +1,26 @@
 #version 330 core
 in vec3 VertexColor;
+in float PointCoverage;
 out vec4 FragColor;
 
+uniform bool pointSprite;
+
+// point sprite mode (--render points): blended additively without depth writes, so a soft falloff
+// to the edge of the point reads as a glow
+uniform bool additive;
+
 void main()
 {
+    if (additive)
+    {
+        vec2 offset = 2.0 * gl_PointCoord - vec2(1.0);
+        float falloff = max(0.0, 1.0 - dot(offset, offset));
+        FragColor = vec4(VertexColor * falloff * PointCoverage, 1.0);
+        return;
+    }
+
+    // point sprites are square, keep the disc a sphere would cover
+    if (pointSprite && length(gl_PointCoord - vec2(0.5)) > 0.5)
+        discard;
     FragColor = vec4(VertexColor, 1.0);
 }
@@ -1,17 +1,108 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;     // sphere vertex
-layout (location = 1) in vec3 instancePos; // star position
-layout (location = 2) in vec3 instanceColor; // star color
+layout (location = 1) in vec3 instancePos; // star position, in units of positionScale
+layout (location = 2) in vec4 instanceColor; // star color, brightness exponent in a (1 for the float layout)
+
+// instance layouts (see star_instances.h):
+//   float  - 24 bytes: 3 x GL_FLOAT position, 3 x GL_FLOAT color, positionScale = 1
+//   packed - 12 bytes: 4 x GL_SHORT normalized position in [-1, 1], 4 x GL_UNSIGNED_BYTE normalized color,
+//            positionScale = galaxy radius; the fourth color byte is 1 for stars and below it for octree
+//            clusters that carry the light of many (packStarBrightness())
+uniform float positionScale;
+
+// 0 = read the star from the instance attributes, 1 = rebuild it from gl_InstanceID (no instance buffer)
+uniform int starSource;
+uniform uint galaxySeed;
+uniform int galaxyArms;
+uniform float galaxyRadius;
+
+// point sprite LOD (star_lod.h): aPos is disabled and reads as the origin, the point covers the
+// star's projected diameter, pointScale being pixels per unit at distance 1
+uniform bool pointSprite;
+uniform float starRadius;
+uniform float pointScale;
+
+// point sprite mode (--render points): every star is one vertex of a plain GL_POINTS draw, the instance
+// attributes advance per vertex, and procedural stars are numbered by gl_VertexID
+uniform bool starsAreVertices;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
 out vec3 VertexColor;
+out float PointCoverage; // share of the smallest (1 pixel) point the star actually covers
+
+// the functions below are generateStar() from galaxy.h, statement for statement; --check-procedural runs
+// this shader with transform feedback and compares the stars it builds with the generator
+uint galaxyHash(uint x)
+{
+    x ^= x >> 16u;
+    x *= 0x7feb352du;
+    x ^= x >> 15u;
+    x *= 0x846ca68bu;
+    x ^= x >> 16u;
+    return x;
+}
+
+uint galaxyRandomBits(uint key, uint stream)
+{
+    return galaxyHash(key + stream * 0x9e3779b9u);
+}
+
+float galaxyRandom(uint key, uint stream)
+{
+    return float(galaxyRandomBits(key, stream) >> 8u) * (1.0 / 16777216.0);
+}
+
+void proceduralStar(uint index, out vec3 position, out vec3 color)
+{
+    uint seedKey = galaxyHash(galaxySeed ^ 0x9e3779b9u);
+    uint key = galaxyHash(galaxyHash(index) ^ seedKey);
+    float armOffset = 2.0 * 3.14159265358979323846 / float(galaxyArms);
+
+    float r = galaxyRadius * sqrt(galaxyRandom(key, 0u));
+
+    int arm = int(((galaxyRandomBits(key, 1u) >> 16u) * uint(galaxyArms)) >> 16u);
+    float angle = (r * 1.5) + float(arm) * armOffset;
+
+    float deviation = (galaxyRandom(key, 2u) - 0.5) * 0.3;
+    float distanceRatio = r / galaxyRadius;
+
+    position.x = r * cos(angle + deviation);
+    position.y = (galaxyRandom(key, 3u) - 0.5) * 0.2;
+    position.z = r * sin(angle + deviation);
+
+    color.r = mix(1.0, 0.5, distanceRatio);
+    color.g = mix(0.4, 0.8, distanceRatio);
+    color.b = mix(0.3, 1.0, pow(distanceRatio, 0.5));
+
+    color.r += (galaxyRandom(key, 4u) - 0.5) * 0.05;
+    color.g += (galaxyRandom(key, 5u) - 0.5) * 0.05;
+    color.b += (galaxyRandom(key, 6u) - 0.5) * 0.05;
+
+    color = clamp(color, 0.0, 1.0);
+}
 
 void main()
 {
-    vec4 worldPos = model * vec4(aPos + instancePos, 1.0);
-    gl_Position = projection * view * worldPos;
-    VertexColor = instanceColor;
+    vec3 starPos = instancePos * positionScale;
+    // 32.0 is STAR_PACKED_BRIGHTNESS_RANGE
+    vec3 starColor = instanceColor.rgb * exp2((1.0 - instanceColor.a) * 32.0);
+    if (starSource == 1)
+        proceduralStar(uint(starsAreVertices ? gl_VertexID : gl_InstanceID), starPos, starColor);
+
+    vec4 worldPos = model * vec4(aPos + starPos, 1.0);
+    vec4 viewPos = view * worldPos;
+    gl_Position = projection * viewPos;
+    PointCoverage = 1.0;
+    if (pointSprite)
+    {
+        // distance attenuation: the projected diameter, but never under a pixel; a star smaller than that
+        // gives only the light its disc would, so distant crowds do not add up to solid white
+        float diameter = 2.0 * starRadius * pointScale / length(viewPos.xyz);
+        gl_PointSize = max(1.0, diameter);
+        PointCoverage = min(1.0, diameter * diameter);
+    }
+    VertexColor = starColor;
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#version 430 core
+layout (local_size_x = 256) in;
+
+// star instance records (float layout: 6 words, packed layout: 3 words, see star_instances.h)
+layout (std430, binding = 0) readonly buffer Instances
+{
+    uint instances[];
+};
+// visible records, compacted in the same layout
+layout (std430, binding = 1) writeonly buffer Visible
+{
+    uint visible[];
+};
+// DrawElementsIndirectCommand; instanceCount is the visible counter
+layout (std430, binding = 2) buffer Command
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+uniform uint numStars;
+uniform int recordWords;
+uniform float positionScale;
+uniform float starRadius;
+uniform vec4 planes[6]; // galaxy-space frustum planes: xyz = normal, w = distance from the origin
+
+vec3 starPosition(uint base)
+{
+    if (recordWords == 6)
+        return vec3(uintBitsToFloat(instances[base]), uintBitsToFloat(instances[base + 1u]), uintBitsToFloat(instances[base + 2u]));
+    vec2 xy = unpackSnorm2x16(instances[base]);
+    float z = unpackSnorm2x16(instances[base + 1u]).x;
+    return vec3(xy, z) * positionScale;
+}
+
+void main()
+{
+    uint stride = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    for (uint i = gl_GlobalInvocationID.x; i < numStars; i += stride)
+    {
+        uint base = i * uint(recordWords);
+        vec3 center = starPosition(base);
+
+        bool inside = true;
+        for (int k = 0; k < 6; ++k)
+            inside = inside && dot(planes[k].xyz, center) - planes[k].w > -starRadius;
+        if (!inside)
+            continue;
+
+        uint dst = atomicAdd(instanceCount, 1u) * uint(recordWords);
+        for (int w = 0; w < recordWords; ++w)
+            visible[dst + uint(w)] = instances[base + uint(w)];
+    }
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#version 430 core
+layout (local_size_x = 256) in;
+
+// one orbit per star: radius, phase at time 0, angular speed, unused (see StarMotion::orbitData())
+layout (std430, binding = 0) readonly buffer Orbits
+{
+    vec4 orbits[];
+};
+// star instance records (float layout: 6 words, packed layout: 3 words, see star_instances.h);
+// only the words holding x and z are rewritten
+layout (std430, binding = 1) buffer Instances
+{
+    uint instances[];
+};
+
+uniform uint numStars;
+uniform int recordWords;
+uniform float positionScale;
+uniform float time;
+
+void main()
+{
+    const float twoPi = 6.28318530717958647692;
+    uint stride = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    for (uint i = gl_GlobalInvocationID.x; i < numStars; i += stride)
+    {
+        vec4 orbit = orbits[i];
+        float angle = orbit.y + orbit.z * time;
+        angle -= twoPi * round(angle / twoPi);
+        float x = orbit.x * cos(angle);
+        float z = orbit.x * sin(angle);
+
+        uint base = i * uint(recordWords);
+        if (recordWords == 6)
+        {
+            instances[base] = floatBitsToUint(x);
+            instances[base + 2u] = floatBitsToUint(z);
+        }
+        else
+        {
+            // snorm16 x|y and z|unused: keep the other half of each word
+            vec2 xy = unpackSnorm2x16(instances[base]);
+            vec2 zw = unpackSnorm2x16(instances[base + 1u]);
+            instances[base] = packSnorm2x16(vec2(x / positionScale, xy.y));
+            instances[base + 1u] = packSnorm2x16(vec2(z / positionScale, zw.y));
+        }
+    }
+}
@@ -0,0 +1,553 @@
+#ifndef GALAXY_H
+#define GALAXY_H
+
+#include <glm/glm.hpp>
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define GALAXY_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX2/SSE4.1 instructions inside functions that ask for them, MSVC always can
+#if defined(__GNUC__) || defined(__clang__)
+#define GALAXY_TARGET(isa) __attribute__((target(isa)))
+#else
+#define GALAXY_TARGET(isa)
+#endif
+
+// every star is written as position (x, y, z) followed by color (r, g, b)
+const unsigned int GALAXY_FLOATS_PER_STAR = 6;
+
+struct GalaxyParams
+{
+  unsigned int numStars = 2000;
+  int arms = 3;
+  float radius = 10.0f;
+  uint32_t seed = 1;
+};
+
+// star generation kernels, picked at runtime from what the CPU supports
+enum GalaxyKernel
+{
+  GALAXY_KERNEL_AUTO,
+  GALAXY_KERNEL_SCALAR,
+  GALAXY_KERNEL_SSE41,
+  GALAXY_KERNEL_AVX2
+};
+
+struct GalaxyStats
+{
+  GalaxyKernel kernel = GALAXY_KERNEL_SCALAR;
+  unsigned int threads = 0;
+  double seconds = 0.0;
+  double starsPerSecond = 0.0;
+};
+
+// counter-based random numbers
+// ----------------------------
+// every random value is a pure function of (seed, starIndex, stream), so a star never depends on
+// the stars generated before it. That is what lets any thread produce any star and still get the
+// same bits, and it only needs 32-bit integer math so a shader can reproduce it as well.
+inline uint32_t galaxyHash(uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352dU;
+  x ^= x >> 15;
+  x *= 0x846ca68bU;
+  x ^= x >> 16;
+  return x;
+}
+
+inline uint32_t galaxySeedKey(uint32_t seed)
+{
+  return galaxyHash(seed ^ 0x9e3779b9U);
+}
+
+inline uint32_t galaxyStarKey(uint32_t seedKey, uint32_t starIndex)
+{
+  return galaxyHash(galaxyHash(starIndex) ^ seedKey);
+}
+
+inline uint32_t galaxyRandomBits(uint32_t starKey, uint32_t stream)
+{
+  return galaxyHash(starKey + stream * 0x9e3779b9U);
+}
+
+// uniform float in [0, 1) built from the top 24 bits, which a float holds exactly
+inline float galaxyRandom(uint32_t starKey, uint32_t stream)
+{
+  return static_cast<float>(galaxyRandomBits(starKey, stream) >> 8) * (1.0f / 16777216.0f);
+}
+
+// picks one of params.arms arms from the top 16 bits; a multiply and shift is exact in 32-bit lanes,
+// unlike the % it replaces, so the SIMD kernels and shaders choose the same arm
+inline int galaxyArm(uint32_t bits, int arms)
+{
+  return static_cast<int>(((bits >> 16) * static_cast<uint32_t>(arms)) >> 16);
+}
+
+// random streams used per star, in the order the original rand() calls were made
+enum GalaxyStream
+{
+  STREAM_RADIUS,
+  STREAM_ARM,
+  STREAM_DEVIATION,
+  STREAM_HEIGHT,
+  STREAM_RED,
+  STREAM_GREEN,
+  STREAM_BLUE
+};
+
+// writes the position and color of a single star into out[0..5]
+inline void generateStar(const GalaxyParams &params, uint32_t seedKey, uint32_t starIndex, float *out)
+{
+  const uint32_t key = galaxyStarKey(seedKey, starIndex);
+  const float armOffset = 2.0f * static_cast<float>(M_PI) / params.arms;
+
+  float r = params.radius * std::sqrt(galaxyRandom(key, STREAM_RADIUS));
+
+  int arm = galaxyArm(galaxyRandomBits(key, STREAM_ARM), params.arms);
+  float angle = (r * 1.5f) + arm * armOffset;
+
+  float deviation = (galaxyRandom(key, STREAM_DEVIATION) - 0.5f) * 0.3f;
+  float distanceRatio = r / params.radius;
+
+  float x = r * std::cos(angle + deviation);
+  float y = (galaxyRandom(key, STREAM_HEIGHT) - 0.5f) * 0.2f;
+  float z = r * std::sin(angle + deviation);
+
+  float R = glm::mix(1.0f, 0.5f, distanceRatio);
+  float G = glm::mix(0.4f, 0.8f, distanceRatio);
+  float B = glm::mix(0.3f, 1.0f, std::pow(distanceRatio, 0.5f));
+
+  R += (galaxyRandom(key, STREAM_RED) - 0.5f) * 0.05f;
+  G += (galaxyRandom(key, STREAM_GREEN) - 0.5f) * 0.05f;
+  B += (galaxyRandom(key, STREAM_BLUE) - 0.5f) * 0.05f;
+
+  out[0] = x;
+  out[1] = y;
+  out[2] = z;
+  out[3] = glm::clamp(R, 0.0f, 1.0f);
+  out[4] = glm::clamp(G, 0.0f, 1.0f);
+  out[5] = glm::clamp(B, 0.0f, 1.0f);
+}
+
+// batch kernels
+// -------------
+// The kernels below produce GALAXY_BATCH consecutive stars per iteration in SoA form. They share the
+// scalar formulas above, with two substitutions:
+//  - sin/cos use a Cody-Waite reduction by pi/2 and the Cephes minimax polynomials. For
+//    |x| <= 8192 the absolute error against the correctly rounded result is below 2^-22
+//    (GALAXY_SINCOS_MAX_ERROR), so positions stay within radius * 2^-22 of generateStar().
+//  - pow(d, 0.5) is computed as sqrt(d), which is correctly rounded where powf allows 1 ulp,
+//    so the blue channel stays within 1 ulp (GALAXY_COLOR_MAX_ERROR allows 2^-22).
+// Everything else (hash, sqrt, mix, clamp) is the same IEEE operation in the same order, so those
+// values are bit-identical to the scalar path. checkGalaxyKernel() measures both bounds.
+const unsigned int GALAXY_BATCH = 8;
+const float GALAXY_SINCOS_MAX_ERROR = 1.0f / 4194304.0f; // 2^-22
+const float GALAXY_COLOR_MAX_ERROR = 1.0f / 4194304.0f;
+
+struct alignas(32) GalaxyBatch
+{
+  float x[GALAXY_BATCH];
+  float y[GALAXY_BATCH];
+  float z[GALAXY_BATCH];
+  float r[GALAXY_BATCH];
+  float g[GALAXY_BATCH];
+  float b[GALAXY_BATCH];
+};
+
+// Cephes single precision constants: pi/2 split in three parts and the sin/cos polynomials on [-pi/4, pi/4]
+const float GALAXY_TWO_OVER_PI = 0.636619772367581343f;
+const float GALAXY_PIO2_1 = 1.5703125f;
+const float GALAXY_PIO2_2 = 4.837512969970703125e-4f;
+const float GALAXY_PIO2_3 = 7.54978995489188216e-8f;
+const float GALAXY_SIN_C1 = -1.6666654611e-1f;
+const float GALAXY_SIN_C2 = 8.3321608736e-3f;
+const float GALAXY_SIN_C3 = -1.9515295891e-4f;
+const float GALAXY_COS_C1 = 4.166664568298827e-2f;
+const float GALAXY_COS_C2 = -1.388731625493765e-3f;
+const float GALAXY_COS_C3 = 2.443315711809948e-5f;
+
+inline void generateStarBatchScalar(const GalaxyParams &params, uint32_t seedKey, uint32_t first, GalaxyBatch &out)
+{
+  float star[GALAXY_FLOATS_PER_STAR];
+  for (unsigned int lane = 0; lane < GALAXY_BATCH; ++lane)
+  {
+    generateStar(params, seedKey, first + lane, star);
+    out.x[lane] = star[0];
+    out.y[lane] = star[1];
+    out.z[lane] = star[2];
+    out.r[lane] = star[3];
+    out.g[lane] = star[4];
+    out.b[lane] = star[5];
+  }
+}
+
+#ifdef GALAXY_SIMD_X86
+// AVX2: one batch is one register
+// -------------------------------
+GALAXY_TARGET("avx2") inline __m256i galaxyHash8(__m256i x)
+{
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+  x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7feb352d));
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+  x = _mm256_mullo_epi32(x, _mm256_set1_epi32(static_cast<int>(0x846ca68bU)));
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+  return x;
+}
+
+GALAXY_TARGET("avx2") inline __m256i galaxyRandomBits8(__m256i starKey, uint32_t stream)
+{
+  return galaxyHash8(_mm256_add_epi32(starKey, _mm256_set1_epi32(static_cast<int>(stream * 0x9e3779b9U))));
+}
+
+GALAXY_TARGET("avx2") inline __m256 galaxyRandom8(__m256i starKey, uint32_t stream)
+{
+  __m256i bits = _mm256_srli_epi32(galaxyRandomBits8(starKey, stream), 8);
+  return _mm256_mul_ps(_mm256_cvtepi32_ps(bits), _mm256_set1_ps(1.0f / 16777216.0f));
+}
+
+GALAXY_TARGET("avx2") inline void galaxySinCos8(__m256 x, __m256 &s, __m256 &c)
+{
+  __m256 j = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(GALAXY_TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 y = _mm256_sub_ps(x, _mm256_mul_ps(j, _mm256_set1_ps(GALAXY_PIO2_1)));
+  y = _mm256_sub_ps(y, _mm256_mul_ps(j, _mm256_set1_ps(GALAXY_PIO2_2)));
+  y = _mm256_sub_ps(y, _mm256_mul_ps(j, _mm256_set1_ps(GALAXY_PIO2_3)));
+  __m256 z = _mm256_mul_ps(y, y);
+
+  __m256 sp = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(GALAXY_SIN_C3), z), _mm256_set1_ps(GALAXY_SIN_C2));
+  sp = _mm256_add_ps(_mm256_mul_ps(sp, z), _mm256_set1_ps(GALAXY_SIN_C1));
+  sp = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(sp, z), y), y);
+
+  __m256 cp = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(GALAXY_COS_C3), z), _mm256_set1_ps(GALAXY_COS_C2));
+  cp = _mm256_add_ps(_mm256_mul_ps(cp, z), _mm256_set1_ps(GALAXY_COS_C1));
+  cp = _mm256_mul_ps(_mm256_mul_ps(cp, z), z);
+  cp = _mm256_add_ps(_mm256_sub_ps(cp, _mm256_mul_ps(z, _mm256_set1_ps(0.5f))), _mm256_set1_ps(1.0f));
+
+  // quadrant q: sin = {s, c, -s, -c}[q], cos = {c, -s, -c, s}[q]
+  __m256i q = _mm256_cvtps_epi32(j);
+  __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+  __m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(q, _mm256_set1_epi32(2)), 30));
+  __m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+  s = _mm256_xor_ps(_mm256_blendv_ps(sp, cp, swap), sinSign);
+  c = _mm256_xor_ps(_mm256_blendv_ps(cp, sp, swap), cosSign);
+}
+
+GALAXY_TARGET("avx2") inline __m256 galaxyNoise8(__m256 base, __m256i starKey, uint32_t stream)
+{
+  __m256 noise = _mm256_mul_ps(_mm256_sub_ps(galaxyRandom8(starKey, stream), _mm256_set1_ps(0.5f)), _mm256_set1_ps(0.05f));
+  return _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(base, noise), _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+}
+
+GALAXY_TARGET("avx2") inline void generateStarBatchAVX2(const GalaxyParams &params, uint32_t seedKey, uint32_t first, GalaxyBatch &out)
+{
+  const float armOffset = 2.0f * static_cast<float>(M_PI) / params.arms;
+  __m256i index = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(first)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  __m256i key = galaxyHash8(_mm256_xor_si256(galaxyHash8(index), _mm256_set1_epi32(static_cast<int>(seedKey))));
+
+  __m256 radius = _mm256_set1_ps(params.radius);
+  __m256 r = _mm256_mul_ps(radius, _mm256_sqrt_ps(galaxyRandom8(key, STREAM_RADIUS)));
+
+  __m256i arm = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(galaxyRandomBits8(key, STREAM_ARM), 16), _mm256_set1_epi32(params.arms)), 16);
+  __m256 angle = _mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(1.5f)), _mm256_mul_ps(_mm256_cvtepi32_ps(arm), _mm256_set1_ps(armOffset)));
+
+  __m256 deviation = _mm256_mul_ps(_mm256_sub_ps(galaxyRandom8(key, STREAM_DEVIATION), _mm256_set1_ps(0.5f)), _mm256_set1_ps(0.3f));
+  __m256 distanceRatio = _mm256_div_ps(r, radius);
+
+  __m256 s, c;
+  galaxySinCos8(_mm256_add_ps(angle, deviation), s, c);
+  _mm256_store_ps(out.x, _mm256_mul_ps(r, c));
+  _mm256_store_ps(out.y, _mm256_mul_ps(_mm256_sub_ps(galaxyRandom8(key, STREAM_HEIGHT), _mm256_set1_ps(0.5f)), _mm256_set1_ps(0.2f)));
+  _mm256_store_ps(out.z, _mm256_mul_ps(r, s));
+
+  // glm::mix(a, b, t) = a + t * (b - a)
+  __m256 R = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(distanceRatio, _mm256_set1_ps(0.5f - 1.0f)));
+  __m256 G = _mm256_add_ps(_mm256_set1_ps(0.4f), _mm256_mul_ps(distanceRatio, _mm256_set1_ps(0.8f - 0.4f)));
+  __m256 B = _mm256_add_ps(_mm256_set1_ps(0.3f), _mm256_mul_ps(_mm256_sqrt_ps(distanceRatio), _mm256_set1_ps(1.0f - 0.3f)));
+  _mm256_store_ps(out.r, galaxyNoise8(R, key, STREAM_RED));
+  _mm256_store_ps(out.g, galaxyNoise8(G, key, STREAM_GREEN));
+  _mm256_store_ps(out.b, galaxyNoise8(B, key, STREAM_BLUE));
+}
+
+// SSE4.1: one batch is two registers
+// ----------------------------------
+GALAXY_TARGET("sse4.1") inline __m128i galaxyHash4(__m128i x)
+{
+  x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+  x = _mm_mullo_epi32(x, _mm_set1_epi32(0x7feb352d));
+  x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+  x = _mm_mullo_epi32(x, _mm_set1_epi32(static_cast<int>(0x846ca68bU)));
+  x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+  return x;
+}
+
+GALAXY_TARGET("sse4.1") inline __m128i galaxyRandomBits4(__m128i starKey, uint32_t stream)
+{
+  return galaxyHash4(_mm_add_epi32(starKey, _mm_set1_epi32(static_cast<int>(stream * 0x9e3779b9U))));
+}
+
+GALAXY_TARGET("sse4.1") inline __m128 galaxyRandom4(__m128i starKey, uint32_t stream)
+{
+  __m128i bits = _mm_srli_epi32(galaxyRandomBits4(starKey, stream), 8);
+  return _mm_mul_ps(_mm_cvtepi32_ps(bits), _mm_set1_ps(1.0f / 16777216.0f));
+}
+
+GALAXY_TARGET("sse4.1") inline void galaxySinCos4(__m128 x, __m128 &s, __m128 &c)
+{
+  __m128 j = _mm_round_ps(_mm_mul_ps(x, _mm_set1_ps(GALAXY_TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m128 y = _mm_sub_ps(x, _mm_mul_ps(j, _mm_set1_ps(GALAXY_PIO2_1)));
+  y = _mm_sub_ps(y, _mm_mul_ps(j, _mm_set1_ps(GALAXY_PIO2_2)));
+  y = _mm_sub_ps(y, _mm_mul_ps(j, _mm_set1_ps(GALAXY_PIO2_3)));
+  __m128 z = _mm_mul_ps(y, y);
+
+  __m128 sp = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(GALAXY_SIN_C3), z), _mm_set1_ps(GALAXY_SIN_C2));
+  sp = _mm_add_ps(_mm_mul_ps(sp, z), _mm_set1_ps(GALAXY_SIN_C1));
+  sp = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sp, z), y), y);
+
+  __m128 cp = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(GALAXY_COS_C3), z), _mm_set1_ps(GALAXY_COS_C2));
+  cp = _mm_add_ps(_mm_mul_ps(cp, z), _mm_set1_ps(GALAXY_COS_C1));
+  cp = _mm_mul_ps(_mm_mul_ps(cp, z), z);
+  cp = _mm_add_ps(_mm_sub_ps(cp, _mm_mul_ps(z, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+  __m128i q = _mm_cvtps_epi32(j);
+  __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+  __m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(2)), 30));
+  __m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(q, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+  s = _mm_xor_ps(_mm_blendv_ps(sp, cp, swap), sinSign);
+  c = _mm_xor_ps(_mm_blendv_ps(cp, sp, swap), cosSign);
+}
+
+GALAXY_TARGET("sse4.1") inline __m128 galaxyNoise4(__m128 base, __m128i starKey, uint32_t stream)
+{
+  __m128 noise = _mm_mul_ps(_mm_sub_ps(galaxyRandom4(starKey, stream), _mm_set1_ps(0.5f)), _mm_set1_ps(0.05f));
+  return _mm_min_ps(_mm_max_ps(_mm_add_ps(base, noise), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+
+GALAXY_TARGET("sse4.1") inline void generateStarBatchSSE41(const GalaxyParams &params, uint32_t seedKey, uint32_t first, GalaxyBatch &out)
+{
+  const float armOffset = 2.0f * static_cast<float>(M_PI) / params.arms;
+  for (unsigned int half = 0; half < GALAXY_BATCH; half += 4)
+  {
+    __m128i index = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(first + half)), _mm_setr_epi32(0, 1, 2, 3));
+    __m128i key = galaxyHash4(_mm_xor_si128(galaxyHash4(index), _mm_set1_epi32(static_cast<int>(seedKey))));
+
+    __m128 radius = _mm_set1_ps(params.radius);
+    __m128 r = _mm_mul_ps(radius, _mm_sqrt_ps(galaxyRandom4(key, STREAM_RADIUS)));
+
+    __m128i arm = _mm_srli_epi32(_mm_mullo_epi32(_mm_srli_epi32(galaxyRandomBits4(key, STREAM_ARM), 16), _mm_set1_epi32(params.arms)), 16);
+    __m128 angle = _mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(1.5f)), _mm_mul_ps(_mm_cvtepi32_ps(arm), _mm_set1_ps(armOffset)));
+
+    __m128 deviation = _mm_mul_ps(_mm_sub_ps(galaxyRandom4(key, STREAM_DEVIATION), _mm_set1_ps(0.5f)), _mm_set1_ps(0.3f));
+    __m128 distanceRatio = _mm_div_ps(r, radius);
+
+    __m128 s, c;
+    galaxySinCos4(_mm_add_ps(angle, deviation), s, c);
+    _mm_store_ps(out.x + half, _mm_mul_ps(r, c));
+    _mm_store_ps(out.y + half, _mm_mul_ps(_mm_sub_ps(galaxyRandom4(key, STREAM_HEIGHT), _mm_set1_ps(0.5f)), _mm_set1_ps(0.2f)));
+    _mm_store_ps(out.z + half, _mm_mul_ps(r, s));
+
+    __m128 R = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(distanceRatio, _mm_set1_ps(0.5f - 1.0f)));
+    __m128 G = _mm_add_ps(_mm_set1_ps(0.4f), _mm_mul_ps(distanceRatio, _mm_set1_ps(0.8f - 0.4f)));
+    __m128 B = _mm_add_ps(_mm_set1_ps(0.3f), _mm_mul_ps(_mm_sqrt_ps(distanceRatio), _mm_set1_ps(1.0f - 0.3f)));
+    _mm_store_ps(out.r + half, galaxyNoise4(R, key, STREAM_RED));
+    _mm_store_ps(out.g + half, galaxyNoise4(G, key, STREAM_GREEN));
+    _mm_store_ps(out.b + half, galaxyNoise4(B, key, STREAM_BLUE));
+  }
+}
+#endif
+
+// runtime dispatch
+// ----------------
+inline GalaxyKernel detectGalaxyKernel()
+{
+#ifdef GALAXY_SIMD_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  bool sse41 = (info[2] & (1 << 19)) != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  __cpuidex(info, 7, 0);
+  bool avx2 = (info[1] & (1 << 5)) != 0 && osxsave && (_xgetbv(0) & 6) == 6;
+#else
+  __builtin_cpu_init();
+  bool sse41 = __builtin_cpu_supports("sse4.1");
+  bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+  if (avx2)
+    return GALAXY_KERNEL_AVX2;
+  if (sse41)
+    return GALAXY_KERNEL_SSE41;
+#endif
+  return GALAXY_KERNEL_SCALAR;
+}
+
+// falls back to the best supported kernel when the requested one is not available on this CPU
+inline GalaxyKernel resolveGalaxyKernel(GalaxyKernel requested)
+{
+  GalaxyKernel best = detectGalaxyKernel();
+  if (requested == GALAXY_KERNEL_AUTO || requested > best)
+    return best;
+  return requested;
+}
+
+inline const char *galaxyKernelName(GalaxyKernel kernel)
+{
+  switch (kernel)
+  {
+  case GALAXY_KERNEL_SCALAR:
+    return "scalar";
+  case GALAXY_KERNEL_SSE41:
+    return "sse4.1";
+  case GALAXY_KERNEL_AVX2:
+    return "avx2";
+  default:
+    return "auto";
+  }
+}
+
+inline GalaxyKernel parseGalaxyKernel(const std::string &name)
+{
+  if (name == "scalar")
+    return GALAXY_KERNEL_SCALAR;
+  if (name == "sse4.1" || name == "sse4")
+    return GALAXY_KERNEL_SSE41;
+  if (name == "avx2")
+    return GALAXY_KERNEL_AVX2;
+  return GALAXY_KERNEL_AUTO;
+}
+
+inline void generateStarBatch(GalaxyKernel kernel, const GalaxyParams &params, uint32_t seedKey, uint32_t first, GalaxyBatch &out)
+{
+#ifdef GALAXY_SIMD_X86
+  if (kernel == GALAXY_KERNEL_AVX2)
+    return generateStarBatchAVX2(params, seedKey, first, out);
+  if (kernel == GALAXY_KERNEL_SSE41)
+    return generateStarBatchSSE41(params, seedKey, first, out);
+#endif
+  generateStarBatchScalar(params, seedKey, first, out);
+}
+
+// generates stars [begin, end) into out, which points at the first float of star 0. begin must be a
+// multiple of GALAXY_BATCH so a star is always computed in the same lane, whatever the split.
+inline void generateGalaxyRange(const GalaxyParams &params, GalaxyKernel kernel, uint32_t begin, uint32_t end, float *out)
+{
+  const uint32_t seedKey = galaxySeedKey(params.seed);
+  GalaxyBatch batch;
+  for (uint32_t first = begin; first < end; first += GALAXY_BATCH)
+  {
+    generateStarBatch(kernel, params, seedKey, first, batch);
+    unsigned int count = std::min<uint32_t>(GALAXY_BATCH, end - first);
+    float *star = out + static_cast<size_t>(first) * GALAXY_FLOATS_PER_STAR;
+    for (unsigned int lane = 0; lane < count; ++lane, star += GALAXY_FLOATS_PER_STAR)
+    {
+      star[0] = batch.x[lane];
+      star[1] = batch.y[lane];
+      star[2] = batch.z[lane];
+      star[3] = batch.r[lane];
+      star[4] = batch.g[lane];
+      star[5] = batch.b[lane];
+    }
+  }
+}
+
+// fills vertices with params.numStars stars, splitting the star range over worker threads.
+// The buffer is sized once up front and every worker owns a disjoint, batch-aligned slice of it, so
+// the result is bit-identical for any thread count. threadCount = 0 uses every hardware thread.
+inline GalaxyStats generateGalaxy(const GalaxyParams &params, std::vector<float> &vertices, unsigned int threadCount = 0, GalaxyKernel kernel = GALAXY_KERNEL_AUTO)
+{
+  auto start = std::chrono::steady_clock::now();
+  vertices.resize(static_cast<size_t>(params.numStars) * GALAXY_FLOATS_PER_STAR);
+  kernel = resolveGalaxyKernel(kernel);
+
+  unsigned int threads = parallelFor(params.numStars, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+    generateGalaxyRange(params, kernel, begin, end, vertices.data());
+  }, GALAXY_BATCH);
+
+  GalaxyStats stats;
+  stats.kernel = kernel;
+  stats.threads = threads;
+  stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  stats.starsPerSecond = stats.seconds > 0.0 ? params.numStars / stats.seconds : 0.0;
+  return stats;
+}
+
+// error check
+// -----------
+// compares a kernel against generateStar() over the first numStars stars and reports the largest
+// deviations; passed is false when they exceed the bounds documented above the batch kernels.
+struct GalaxyKernelError
+{
+  float position = 0.0f;
+  float color = 0.0f;
+  bool passed = true;
+};
+
+inline GalaxyKernelError checkGalaxyKernel(GalaxyKernel kernel, const GalaxyParams &params, uint32_t numStars)
+{
+  GalaxyKernelError error;
+  kernel = resolveGalaxyKernel(kernel);
+  const uint32_t seedKey = galaxySeedKey(params.seed);
+  GalaxyBatch batch;
+  float star[GALAXY_FLOATS_PER_STAR];
+  for (uint32_t first = 0; first < numStars; first += GALAXY_BATCH)
+  {
+    generateStarBatch(kernel, params, seedKey, first, batch);
+    for (unsigned int lane = 0; lane < GALAXY_BATCH; ++lane)
+    {
+      generateStar(params, seedKey, first + lane, star);
+      error.position = std::max(error.position, std::fabs(batch.x[lane] - star[0]));
+      error.position = std::max(error.position, std::fabs(batch.y[lane] - star[1]));
+      error.position = std::max(error.position, std::fabs(batch.z[lane] - star[2]));
+      error.color = std::max(error.color, std::fabs(batch.r[lane] - star[3]));
+      error.color = std::max(error.color, std::fabs(batch.g[lane] - star[4]));
+      error.color = std::max(error.color, std::fabs(batch.b[lane] - star[5]));
+    }
+  }
+  // the scalar reference itself may be 1 ulp off in cos/sin, hence the factor of 2 on the position bound
+  error.passed = error.position <= 2.0f * params.radius * GALAXY_SINCOS_MAX_ERROR && error.color <= GALAXY_COLOR_MAX_ERROR;
+  return error;
+}
+
+// procedural reference
+// --------------------
+// With starSource = 1 the vertex shader rebuilds every star from gl_InstanceID with proceduralStar() in
+// assignment_2.vs, its GLSL copy of generateStar(). --check-procedural runs that shader and hands what it
+// produced to checkGeneratedStars(). The hash and the arm choice are integer math, so a drifted constant
+// or formula moves stars by a good part of the radius, far above the bounds below; GPU sin/cos/pow only
+// cost a few ulps.
+const float GALAXY_PROCEDURAL_POSITION_ERROR = 1.0f / 1024.0f; // times the radius
+const float GALAXY_PROCEDURAL_COLOR_ERROR = 1.0f / 1024.0f;
+
+// compares numStars stars in the generateGalaxy() layout with generateStar(), within the procedural bounds
+inline GalaxyKernelError checkGeneratedStars(const GalaxyParams &params, const float *stars, uint32_t numStars)
+{
+  GalaxyKernelError error;
+  const uint32_t seedKey = galaxySeedKey(params.seed);
+  float star[GALAXY_FLOATS_PER_STAR];
+  for (uint32_t i = 0; i < numStars; ++i)
+  {
+    generateStar(params, seedKey, i, star);
+    const float *other = &stars[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+    for (int k = 0; k < 3; ++k)
+    {
+      error.position = std::max(error.position, std::fabs(other[k] - star[k]));
+      error.color = std::max(error.color, std::fabs(other[3 + k] - star[3 + k]));
+    }
+  }
+  error.passed = error.position <= params.radius * GALAXY_PROCEDURAL_POSITION_ERROR && error.color <= GALAXY_PROCEDURAL_COLOR_ERROR;
+  return error;
+}
+#endif
@@ -0,0 +1,239 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/camera.h>
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Headless rendering: an OpenGL context without any window (EGL on a surfaceless Mesa display, which
+// includes llvmpipe on machines without a GPU) rendering into an offscreen framebuffer of any size.
+// Only available where CMake found libEGL (HAVE_EGL).
+class HeadlessContext
+{
+public:
+  std::string error;
+
+  ~HeadlessContext()
+  {
+    destroy();
+  }
+
+  // makes a core 3.3+ context current, loads GLAD and binds a width x height framebuffer with depth
+  bool create(unsigned int width, unsigned int height)
+  {
+#ifdef HAVE_EGL
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    display = getPlatformDisplay ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) : EGL_NO_DISPLAY;
+    if (display == EGL_NO_DISPLAY)
+      display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API))
+    {
+      error = "no EGL display with desktop OpenGL";
+      return false;
+    }
+
+    // the same core 3.3 profile the window asks GLFW for; drivers hand out their newest compatible version
+    const EGLint configAttributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config = NULL;
+    EGLint configCount = 0;
+    eglChooseConfig(display, configAttributes, &config, 1, &configCount);
+    const EGLint contextAttributes[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+                                        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+    context = eglCreateContext(display, configCount > 0 ? config : (EGLConfig)0, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    {
+      error = "cannot create a surfaceless OpenGL 3.3 core context";
+      return false;
+    }
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+    {
+      error = "failed to initialize GLAD";
+      return false;
+    }
+
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(2, renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+      error = "offscreen framebuffer is incomplete";
+      return false;
+    }
+    glViewport(0, 0, width, height);
+
+    // llvmpipe stamps the start of a timer query that opens before anything was ever rendered as 0,
+    // so the first frame would measure the uptime; one finished clear up front avoids that
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glFinish();
+    return true;
+#else
+    (void)width;
+    (void)height;
+    error = "built without EGL";
+    return false;
+#endif
+  }
+
+  void destroy()
+  {
+#ifdef HAVE_EGL
+    if (context != EGL_NO_CONTEXT)
+    {
+      glDeleteFramebuffers(1, &framebuffer);
+      glDeleteRenderbuffers(2, renderbuffers);
+      eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+      eglDestroyContext(display, context);
+      context = EGL_NO_CONTEXT;
+    }
+    if (display != EGL_NO_DISPLAY)
+    {
+      eglTerminate(display);
+      display = EGL_NO_DISPLAY;
+    }
+#endif
+  }
+
+private:
+#ifdef HAVE_EGL
+  EGLDisplay display = EGL_NO_DISPLAY;
+  EGLContext context = EGL_NO_CONTEXT;
+#endif
+  unsigned int framebuffer = 0;
+  unsigned int renderbuffers[2] = {0, 0};
+};
+
+// the benchmark's camera at time t of a run lasting duration seconds: one orbit around the galaxy,
+// flying in from far outside the disc to just above the core and back out, always facing the center
+inline Camera benchmarkCamera(float t, float duration, float galaxyRadius)
+{
+  const float pi = 3.14159265358979323846f;
+  float phase = duration > 0.0f ? t / duration : 0.0f;
+  float distance = galaxyRadius * (1.4f + 1.1f * std::cos(2.0f * pi * phase));
+  float angle = 2.0f * pi * phase;
+  glm::vec3 position(distance * std::cos(angle), 0.35f * distance, distance * std::sin(angle));
+  glm::vec3 front = glm::normalize(-position);
+  float yaw = glm::degrees(std::atan2(front.z, front.x));
+  float pitch = glm::degrees(std::asin(front.y));
+  return Camera(position, glm::vec3(0.0f, 1.0f, 0.0f), yaw, pitch);
+}
+
+// CPU and GPU time of every frame. GPU time comes from GL_TIME_ELAPSED queries, one per frame, which
+// are only read back at the end so measuring never stalls the pipeline.
+class FrameTimings
+{
+public:
+  std::vector<double> cpuMilliseconds;
+  std::vector<double> gpuMilliseconds;
+
+  ~FrameTimings()
+  {
+    if (!queries.empty())
+      glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
+  }
+
+  void reserve(unsigned int frames)
+  {
+    cpuMilliseconds.reserve(frames);
+    queries.resize(frames);
+    glGenQueries(frames, queries.data());
+  }
+
+  void beginFrame()
+  {
+    frameStart = std::chrono::steady_clock::now();
+    glBeginQuery(GL_TIME_ELAPSED, queries[cpuMilliseconds.size()]);
+  }
+
+  // the CPU time is everything up to here: simulation, culling, uploads and draw submission
+  void endFrame()
+  {
+    glEndQuery(GL_TIME_ELAPSED);
+    cpuMilliseconds.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+  }
+
+  unsigned int frames() const
+  {
+    return static_cast<unsigned int>(cpuMilliseconds.size());
+  }
+
+  // waits for the GPU and reads every query
+  void resolve()
+  {
+    gpuMilliseconds.resize(cpuMilliseconds.size());
+    for (size_t i = 0; i < gpuMilliseconds.size(); ++i)
+    {
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &nanoseconds);
+      gpuMilliseconds[i] = nanoseconds / 1.0e6;
+    }
+  }
+
+  // nearest-rank percentile, p in [0, 100]
+  static double percentile(std::vector<double> values, double p)
+  {
+    if (values.empty())
+      return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * values.size()));
+    return values[std::min(values.size(), std::max<size_t>(1, rank)) - 1];
+  }
+
+  // {"frames": n, "cpu_ms": {...}, "gpu_ms": {...}, "per_frame": {"cpu_ms": [...], "gpu_ms": [...]}};
+  // config is written first as-is and must be a comma-terminated list of JSON members
+  void writeJson(std::ostream &out, const std::string &config) const
+  {
+    out << "{\n" << config << "  \"frames\": " << frames() << ",\n";
+    writeSummary(out, "cpu_ms", cpuMilliseconds);
+    out << ",\n";
+    writeSummary(out, "gpu_ms", gpuMilliseconds);
+    out << ",\n  \"per_frame\": {\n";
+    writeList(out, "cpu_ms", cpuMilliseconds);
+    out << ",\n";
+    writeList(out, "gpu_ms", gpuMilliseconds);
+    out << "\n  }\n}\n";
+  }
+
+private:
+  std::vector<GLuint> queries;
+  std::chrono::steady_clock::time_point frameStart;
+
+  static void writeSummary(std::ostream &out, const char *name, const std::vector<double> &values)
+  {
+    double sum = 0.0;
+    for (double value : values)
+      sum += value;
+    out << "  \"" << name << "\": {\"mean\": " << (values.empty() ? 0.0 : sum / values.size())
+        << ", \"min\": " << percentile(values, 0.0) << ", \"p50\": " << percentile(values, 50.0)
+        << ", \"p90\": " << percentile(values, 90.0) << ", \"p95\": " << percentile(values, 95.0)
+        << ", \"p99\": " << percentile(values, 99.0) << ", \"max\": " << percentile(values, 100.0) << "}";
+  }
+
+  static void writeList(std::ostream &out, const char *name, const std::vector<double> &values)
+  {
+    out << "    \"" << name << "\": [";
+    for (size_t i = 0; i < values.size(); ++i)
+      out << (i ? ", " : "") << values[i];
+    out << "]";
+  }
+};
+#endif
@@ -0,0 +1,124 @@
+#ifndef INSTANCE_UPLOADS_H
+#define INSTANCE_UPLOADS_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// record ranges [begin, end) of an instance array changed since the last upload
+struct DirtyRange
+{
+  uint32_t begin, end;
+};
+
+class DirtyRanges
+{
+public:
+  void mark(uint32_t begin, uint32_t end)
+  {
+    if (begin < end)
+      list.push_back({begin, end});
+  }
+
+  // sorts the ranges and merges the ones that overlap or lie at most gap records apart: re-sending a few
+  // unchanged records is cheaper than another call
+  void coalesce(uint32_t gap)
+  {
+    if (list.size() < 2)
+      return;
+    std::sort(list.begin(), list.end(), [](const DirtyRange &a, const DirtyRange &b) { return a.begin < b.begin; });
+    size_t merged = 0;
+    for (size_t i = 1; i < list.size(); ++i)
+    {
+      if (list[i].begin <= list[merged].end + gap)
+        list[merged].end = std::max(list[merged].end, list[i].end);
+      else
+        list[++merged] = list[i];
+    }
+    list.resize(merged + 1);
+  }
+
+  const std::vector<DirtyRange> &ranges() const
+  {
+    return list;
+  }
+
+  bool empty() const
+  {
+    return list.empty();
+  }
+
+  void clear()
+  {
+    list.clear();
+  }
+
+private:
+  std::vector<DirtyRange> list;
+};
+
+// how dirty ranges reach the buffer
+enum InstanceUploadMethod
+{
+  INSTANCE_UPLOAD_SUBDATA, // one glBufferSubData() per range
+  INSTANCE_UPLOAD_MAP      // glMapBufferRange() per range, invalidating just that range, and a memcpy
+};
+
+inline InstanceUploadMethod parseInstanceUploadMethod(const std::string &name)
+{
+  return name == "map" ? INSTANCE_UPLOAD_MAP : INSTANCE_UPLOAD_SUBDATA;
+}
+
+struct InstanceUploadStats
+{
+  uint64_t bytes = 0;  // last upload
+  uint32_t ranges = 0; // last upload, after coalescing
+  uint64_t totalBytes = 0;
+  uint64_t uploads = 0;
+};
+
+// Sends only the dirty records of a CPU instance array to its buffer, so a sculpture that is partly animated
+// costs bandwidth in proportion to what moved rather than the whole buffer.
+class InstanceUploader
+{
+public:
+  InstanceUploadMethod method = INSTANCE_UPLOAD_SUBDATA;
+  InstanceUploadStats stats;
+  size_t mergeBytes = 4096; // dirty ranges closer than this are sent as one
+
+  // copies the dirty records of data (stride bytes each) into buffer and clears dirty
+  void upload(unsigned int buffer, const unsigned char *data, size_t stride, DirtyRanges &dirty)
+  {
+    dirty.coalesce(static_cast<uint32_t>(mergeBytes / stride));
+    stats.bytes = 0;
+    stats.ranges = static_cast<uint32_t>(dirty.ranges().size());
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (const DirtyRange &range : dirty.ranges())
+    {
+      const size_t offset = range.begin * stride;
+      const size_t length = (range.end - range.begin) * stride;
+      if (method == INSTANCE_UPLOAD_MAP)
+      {
+        void *mapped = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        if (mapped != NULL)
+        {
+          std::memcpy(mapped, data + offset, length);
+          glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+      }
+      else
+      {
+        glBufferSubData(GL_ARRAY_BUFFER, offset, length, data + offset);
+      }
+      stats.bytes += length;
+    }
+    stats.totalBytes += stats.bytes;
+    ++stats.uploads;
+    dirty.clear();
+  }
+};
+#endif
@@ -0,0 +1,321 @@
+#ifndef KINETIC_SCULPTURE_H
+#define KINETIC_SCULPTURE_H
+
+#include <glm/glm.hpp>
+
+#include "galaxy.h"
+#include "parallel.h"
+#include "star_instances.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+struct KineticParams
+{
+  unsigned int spheresPerStrand = 10;
+  float linkLength = 0.2f;           // rest length of every rod and cable link
+  float motorSpeed = 1.0f;           // radians/sec of the slowest motor
+  float gravity = 9.81f;             // units/sec^2, pulling towards -y
+  float damping = 0.1f;              // fraction of velocity lost per second
+  float timestep = 1.0f / 60.0f;     // fixed step in seconds of simulated time
+  unsigned int substeps = 8;         // each step is split into this many predict/solve/update passes
+  unsigned int iterations = 1;       // constraint sweeps per substep; small substeps converge better than more sweeps
+  unsigned int maxStepsPerFrame = 4; // steps dropped beyond this, as in NBodyParams
+};
+
+struct KineticStats
+{
+  unsigned int threads = 0;
+  unsigned int motors = 0;
+  unsigned int colors = 0;
+  uint32_t constraints = 0;
+  double stepMilliseconds = 0.0;
+  double solveMilliseconds = 0.0;
+  double stepsPerSecond = 0.0;
+};
+
+// A kinetic sculpture solved with position-based dynamics. Motors spread over the galaxy's disc spin
+// horizontal arms; from both tips of every arm hangs a strand whose first sphere sits on a rigid rod
+// and whose others follow on cables, which resist stretching but go slack when pushed together.
+// The arm tips are particles without mass that the motors move, so the strands are swung around by
+// the constraints alone. Every step is split into substeps of predict, one Gauss-Seidel sweep over the
+// constraints and a velocity update. The sweep is parallel: constraints are coloured so that no two
+// of one colour share a sphere, and each colour is spread over worker threads with nothing to lock.
+class KineticSculpture
+{
+public:
+  KineticParams params;
+  KineticStats stats;
+
+  // builds enough motors for sphereCount spheres inside a disc of the given radius
+  void build(uint32_t sphereCount, float radius, const KineticParams &sculptureParams, unsigned int threadCount = 0)
+  {
+    params = sculptureParams;
+    threads = threadCount;
+    spheres = sphereCount;
+    const uint32_t perMotor = 2 * params.spheresPerStrand;
+    const uint32_t motorCount = std::max<uint32_t>(1, (spheres + perMotor - 1) / perMotor);
+    const float discRadius = 0.85f * radius;
+    const float spacing = discRadius * std::sqrt(3.14159265f / motorCount);
+    const float goldenAngle = 2.39996323f;
+
+    // motors on a sunflower spiral, so the arms never sweep into each other; the outer ones sit lower and
+    // spin faster, every other one the other way round
+    motors.resize(motorCount);
+    for (uint32_t k = 0; k < motorCount; ++k)
+    {
+      float ring = std::sqrt((k + 0.5f) / motorCount);
+      float angle = k * goldenAngle;
+      Motor &motor = motors[k];
+      motor.hub = glm::vec3(discRadius * ring * std::cos(angle), radius * (0.6f - 0.15f * ring * ring), discRadius * ring * std::sin(angle));
+      motor.arm = 0.3f * spacing;
+      motor.speed = params.motorSpeed * (1.0f + 0.5f * ring) * (k % 2 ? -1.0f : 1.0f);
+      motor.phase = angle;
+    }
+
+    // particles: the two arm tips of every motor, then the spheres strand by strand
+    anchors = 2 * motorCount;
+    position.assign(anchors + spheres, glm::vec3(0.0f));
+    previous.resize(position.size());
+    velocity.assign(position.size(), glm::vec3(0.0f));
+    inverseMass.assign(position.size(), 1.0f);
+    std::fill(inverseMass.begin(), inverseMass.begin() + anchors, 0.0f);
+    moveAnchors(0.0f);
+    time = 0.0f;
+
+    std::vector<Constraint> unsorted;
+    unsorted.reserve(spheres);
+    for (uint32_t s = 0; s < spheres; ++s)
+    {
+      uint32_t strand = s / params.spheresPerStrand;
+      uint32_t link = s % params.spheresPerStrand;
+      uint32_t particle = anchors + s;
+      uint32_t above = link == 0 ? strand : particle - 1;
+      position[particle] = position[strand] - glm::vec3(0.0f, (link + 1) * params.linkLength, 0.0f);
+      unsorted.push_back({above, particle, params.linkLength, link == 0 ? 1u : 0u});
+    }
+    previous = position;
+    colorConstraints(unsorted);
+
+    stats.threads = parallelThreadCount(static_cast<uint32_t>(position.size()), threads);
+    stats.motors = motorCount;
+    stats.constraints = static_cast<uint32_t>(constraints.size());
+  }
+
+  uint32_t size() const
+  {
+    return spheres;
+  }
+
+  // the spheres as a float star array (see generateGalaxy()): brass near the motors, cooling to blue at
+  // the free ends, brighter towards the rim
+  void writeRecords(std::vector<float> &stars) const
+  {
+    stars.resize(static_cast<size_t>(spheres) * GALAXY_FLOATS_PER_STAR);
+    for (uint32_t s = 0; s < spheres; ++s)
+    {
+      float *star = &stars[static_cast<size_t>(s) * GALAXY_FLOATS_PER_STAR];
+      const glm::vec3 &p = position[anchors + s];
+      float depth = params.spheresPerStrand > 1 ? static_cast<float>(s % params.spheresPerStrand) / (params.spheresPerStrand - 1) : 0.0f;
+      const Motor &motor = motors[s / (2 * params.spheresPerStrand)];
+      float rim = glm::clamp(glm::length(glm::vec2(motor.hub.x, motor.hub.z)) / (glm::length(glm::vec2(motors.back().hub.x, motors.back().hub.z)) + 1e-6f), 0.0f, 1.0f);
+      glm::vec3 color = glm::mix(glm::vec3(1.0f, 0.72f, 0.32f), glm::vec3(0.35f, 0.6f, 1.0f), depth) * (0.7f + 0.3f * rim);
+      star[0] = p.x;
+      star[1] = p.y;
+      star[2] = p.z;
+      star[3] = color.r;
+      star[4] = color.g;
+      star[5] = color.b;
+    }
+  }
+
+  // one fixed timestep
+  void step()
+  {
+    auto start = std::chrono::steady_clock::now();
+    const float h = params.timestep / params.substeps;
+    const float keep = std::max(0.0f, 1.0f - params.damping * h);
+    const glm::vec3 gravityStep(0.0f, -params.gravity * h, 0.0f);
+    double solveMilliseconds = 0.0;
+    for (unsigned int sub = 0; sub < params.substeps; ++sub)
+    {
+      // velocities from the last substep's corrected positions, then the unconstrained prediction
+      moveAnchors(time + (sub + 1) * h);
+      const bool first = sub == 0;
+      parallelFor(static_cast<uint32_t>(position.size()) - anchors, threads, [&](uint32_t begin, uint32_t end, unsigned int) {
+        for (uint32_t i = anchors + begin; i < anchors + end; ++i)
+        {
+          if (!first)
+            velocity[i] = (position[i] - previous[i]) * (keep / h);
+          previous[i] = position[i];
+          velocity[i] += gravityStep;
+          position[i] += velocity[i] * h;
+        }
+      });
+
+      auto solveStart = std::chrono::steady_clock::now();
+      for (unsigned int iteration = 0; iteration < params.iterations; ++iteration)
+        for (unsigned int c = 0; c < colorStarts.size() - 1; ++c)
+          parallelFor(colorStarts[c + 1] - colorStarts[c], threads, [&](uint32_t begin, uint32_t end, unsigned int) {
+            for (uint32_t k = colorStarts[c] + begin; k < colorStarts[c] + end; ++k)
+              project(constraints[k]);
+          });
+      solveMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - solveStart).count();
+    }
+    parallelFor(static_cast<uint32_t>(position.size()) - anchors, threads, [&](uint32_t begin, uint32_t end, unsigned int) {
+      for (uint32_t i = anchors + begin; i < anchors + end; ++i)
+        velocity[i] = (position[i] - previous[i]) * (keep / h);
+    });
+    time += params.timestep;
+
+    stats.stepMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    stats.solveMilliseconds = solveMilliseconds;
+    stats.stepsPerSecond = stats.stepMilliseconds > 0.0 ? 1000.0 / stats.stepMilliseconds : 0.0;
+  }
+
+  // runs as many fixed steps as elapsed real time asks for, at most params.maxStepsPerFrame; returns the count
+  unsigned int advance(float elapsed)
+  {
+    accumulator += elapsed;
+    unsigned int steps = 0;
+    while (accumulator >= params.timestep && steps < params.maxStepsPerFrame)
+    {
+      step();
+      accumulator -= params.timestep;
+      ++steps;
+    }
+    if (steps == params.maxStepsPerFrame)
+      accumulator = std::min(accumulator, params.timestep);
+    return steps;
+  }
+
+  // writes every sphere's position into the records at out (float or packed layout, packed positions
+  // relative to positionScale); colors are left alone
+  void writePositions(unsigned char *out, StarInstanceFormat format, float positionScale) const
+  {
+    const float invScale = 1.0f / positionScale;
+    parallelFor(spheres, threads, [&](uint32_t begin, uint32_t end, unsigned int) {
+      for (uint32_t s = begin; s < end; ++s)
+      {
+        const glm::vec3 &p = position[anchors + s];
+        if (format == STAR_FORMAT_PACKED)
+        {
+          PackedStar *star = reinterpret_cast<PackedStar *>(out) + s;
+          for (int k = 0; k < 3; ++k)
+            star->position[k] = packSnorm16(p[k] * invScale);
+        }
+        else
+        {
+          float *star = reinterpret_cast<float *>(out) + static_cast<size_t>(s) * GALAXY_FLOATS_PER_STAR;
+          star[0] = p.x;
+          star[1] = p.y;
+          star[2] = p.z;
+        }
+      }
+    });
+  }
+
+  // largest stretch of a cable or length error of a rod, relative to the link length
+  float maxViolation() const
+  {
+    float worst = 0.0f;
+    for (const Constraint &constraint : constraints)
+    {
+      float error = glm::length(position[constraint.b] - position[constraint.a]) - constraint.rest;
+      if (!constraint.rod)
+        error = std::max(0.0f, error);
+      worst = std::max(worst, std::abs(error) / constraint.rest);
+    }
+    return worst;
+  }
+
+private:
+  struct Motor
+  {
+    glm::vec3 hub;
+    float arm;   // distance from the hub to either tip
+    float speed; // radians/sec, signed
+    float phase;
+  };
+
+  struct Constraint
+  {
+    uint32_t a, b;
+    float rest;
+    uint32_t rod; // 1: keeps its length both ways, 0: cable, only pulls
+  };
+
+  std::vector<Motor> motors;
+  std::vector<glm::vec3> position;
+  std::vector<glm::vec3> previous;
+  std::vector<glm::vec3> velocity;
+  std::vector<float> inverseMass;
+  std::vector<Constraint> constraints; // grouped by colour
+  std::vector<uint32_t> colorStarts;   // colour c is constraints[colorStarts[c], colorStarts[c + 1])
+  uint32_t anchors = 0;
+  uint32_t spheres = 0;
+  unsigned int threads = 0;
+  float time = 0.0f;
+  float accumulator = 0.0f;
+
+  void moveAnchors(float t)
+  {
+    for (uint32_t k = 0; k < motors.size(); ++k)
+    {
+      const Motor &motor = motors[k];
+      float angle = motor.phase + motor.speed * t;
+      glm::vec3 arm(motor.arm * std::cos(angle), 0.0f, motor.arm * std::sin(angle));
+      position[2 * k] = motor.hub + arm;
+      position[2 * k + 1] = motor.hub - arm;
+    }
+  }
+
+  // greedy colouring: each constraint takes the lowest colour neither of its particles has yet. Strands
+  // are chains, so this settles on two colours, each constraint order kept within its colour.
+  void colorConstraints(const std::vector<Constraint> &unsorted)
+  {
+    std::vector<uint32_t> used(position.size(), 0); // bit c set: the particle is in a constraint of colour c
+    std::vector<unsigned int> color(unsorted.size());
+    unsigned int colorCount = 0;
+    for (size_t k = 0; k < unsorted.size(); ++k)
+    {
+      uint32_t taken = used[unsorted[k].a] | used[unsorted[k].b];
+      unsigned int c = 0;
+      while (taken & (1u << c))
+        ++c;
+      color[k] = c;
+      used[unsorted[k].a] |= 1u << c;
+      used[unsorted[k].b] |= 1u << c;
+      colorCount = std::max(colorCount, c + 1);
+    }
+
+    colorStarts.assign(colorCount + 1, 0);
+    for (unsigned int c : color)
+      ++colorStarts[c + 1];
+    for (unsigned int c = 0; c < colorCount; ++c)
+      colorStarts[c + 1] += colorStarts[c];
+    constraints.resize(unsorted.size());
+    std::vector<uint32_t> next(colorStarts.begin(), colorStarts.end() - 1);
+    for (size_t k = 0; k < unsorted.size(); ++k)
+      constraints[next[color[k]]++] = unsorted[k];
+    stats.colors = colorCount;
+  }
+
+  // moves both ends along the link until it has its rest length, in proportion to their inverse masses
+  void project(const Constraint &constraint)
+  {
+    glm::vec3 delta = position[constraint.b] - position[constraint.a];
+    float length = glm::length(delta);
+    float error = length - constraint.rest;
+    float wa = inverseMass[constraint.a];
+    float wb = inverseMass[constraint.b];
+    if (length <= 0.0f || wa + wb == 0.0f || (!constraint.rod && error <= 0.0f))
+      return;
+    glm::vec3 correction = delta * (error / ((wa + wb) * length));
+    position[constraint.a] += wa * correction;
+    position[constraint.b] -= wb * correction;
+  }
+};
+#endif
@@ -0,0 +1,230 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// below this many items per worker handing the work out costs more than it saves
+const unsigned int PARALLEL_MIN_ITEMS_PER_THREAD = 16384;
+
+// Process-wide worker threads that parallelFor() and parallelTasks() hand their tasks to, so the per-frame
+// and per-substep loops wake sleeping threads instead of starting and joining new ones every call. The
+// calling thread runs tasks too, and workers are started on first need and kept until exit. One dispatch
+// runs at a time: a call made while the pool is busy (from another thread, or nested inside a task)
+// gets false back, and the caller falls back to threads of its own.
+class ParallelPool
+{
+public:
+  static ParallelPool &instance()
+  {
+    static ParallelPool pool;
+    return pool;
+  }
+
+  ~ParallelPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+  }
+
+  ParallelPool(const ParallelPool &) = delete;
+  ParallelPool &operator=(const ParallelPool &) = delete;
+
+  // runs task(t) for t in [0, taskCount) and returns once all are done; false, having run nothing, when
+  // the pool is busy
+  template <typename Task>
+  bool run(unsigned int taskCount, Task &task)
+  {
+    bool expected = false;
+    if (!busy.compare_exchange_strong(expected, true, std::memory_order_acquire))
+      return false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      while (workers.size() + 1 < taskCount)
+        workers.emplace_back(&ParallelPool::work, this);
+      dispatch.invoke = [](void *context, unsigned int t) { (*static_cast<Task *>(context))(t); };
+      dispatch.context = &task;
+      dispatch.tasks = taskCount;
+      next.store(0, std::memory_order_relaxed);
+      remaining = taskCount;
+      open = true;
+      ++generation;
+    }
+    wake.notify_all();
+    runTasks(dispatch);
+    {
+      // a worker that joined may still be past its last task, so wait for those as well; closing the
+      // dispatch under the same lock keeps workers that wake later out of it
+      std::unique_lock<std::mutex> lock(mutex);
+      done.wait(lock, [this]() { return remaining == 0 && active == 0; });
+      open = false;
+    }
+    busy.store(false, std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::atomic<bool> busy{false};
+  bool stopping = false;
+  uint64_t generation = 0;
+  unsigned int active = 0;    // workers that joined the open dispatch and have not left it
+  unsigned int remaining = 0; // tasks not finished yet
+  bool open = false;          // run() still waits for the dispatch, so workers may join it
+
+  // what a dispatch runs; workers copy it under mutex when they join, and run() rewrites it only while
+  // no dispatch is open
+  struct Dispatch
+  {
+    void (*invoke)(void *, unsigned int) = NULL;
+    void *context = NULL;
+    unsigned int tasks = 0;
+  };
+  Dispatch dispatch;
+  std::atomic<unsigned int> next{0}; // reset only while no dispatch is open, like dispatch
+
+  ParallelPool()
+  {
+  }
+
+  void runTasks(const Dispatch &current)
+  {
+    unsigned int finished = 0;
+    for (unsigned int t = next.fetch_add(1, std::memory_order_relaxed); t < current.tasks; t = next.fetch_add(1, std::memory_order_relaxed))
+    {
+      current.invoke(current.context, t);
+      ++finished;
+    }
+    if (finished > 0)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      remaining -= finished;
+    }
+  }
+
+  void work()
+  {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      wake.wait(lock, [&]() { return stopping || generation != seen; });
+      if (stopping)
+        return;
+      seen = generation;
+      // a dispatch run() has already closed is left alone, its successor may be written any moment
+      if (!open)
+        continue;
+      Dispatch current = dispatch;
+      ++active;
+      lock.unlock();
+      runTasks(current);
+      lock.lock();
+      --active;
+      if (remaining == 0 && active == 0)
+        done.notify_all();
+    }
+  }
+};
+
+// runs task(t) for t in [0, taskCount) on the ParallelPool, or on threads of its own while the pool is busy
+template <typename Task>
+void parallelRun(unsigned int taskCount, Task task)
+{
+  if (taskCount == 1)
+  {
+    task(0u);
+    return;
+  }
+  if (ParallelPool::instance().run(taskCount, task))
+    return;
+  std::vector<std::thread> workers;
+  workers.reserve(taskCount);
+  for (unsigned int t = 0; t < taskCount; ++t)
+    workers.emplace_back([&task, t]() { task(t); });
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+// number of workers parallelFor() will use for count items; requested = 0 means every hardware thread
+inline unsigned int parallelThreadCount(uint32_t count, unsigned int requested = 0)
+{
+  if (requested == 0)
+    requested = std::max(1u, std::thread::hardware_concurrency());
+  unsigned int maxUseful = std::max(1u, count / PARALLEL_MIN_ITEMS_PER_THREAD);
+  return std::min(requested, maxUseful);
+}
+
+// splits [0, count) into one contiguous slice per worker and calls body(begin, end, worker) for each.
+// Slice starts are multiples of alignment, so callers that work in fixed-size batches always see the
+// same batches whatever the thread count. Runs inline when a single worker is enough.
+template <typename Body>
+unsigned int parallelFor(uint32_t count, unsigned int threadCount, Body body, uint32_t alignment = 1)
+{
+  threadCount = parallelThreadCount(count, threadCount);
+  if (threadCount == 1)
+  {
+    body(0u, count, 0u);
+    return 1;
+  }
+
+  uint32_t chunk = (count + threadCount - 1) / threadCount;
+  chunk = (chunk + alignment - 1) / alignment * alignment;
+  parallelRun(threadCount, [&body, count, chunk](unsigned int t) {
+    uint32_t begin = static_cast<uint32_t>(std::min<uint64_t>(count, static_cast<uint64_t>(t) * chunk));
+    uint32_t end = static_cast<uint32_t>(std::min<uint64_t>(count, static_cast<uint64_t>(begin) + chunk));
+    body(begin, end, t);
+  });
+  return threadCount;
+}
+
+// runs body(task) for task in [0, taskCount) in parallel and waits for all of them; tasks must not wait
+// for each other, since one worker may run several
+template <typename Body>
+void parallelTasks(unsigned int taskCount, Body body)
+{
+  parallelRun(taskCount, [&body](unsigned int t) { body(t); });
+}
+
+// Stress test of the pool for --check-parallel: two threads each make rounds dispatches of 2 to 9 tasks,
+// so one of them usually finds the pool busy and runs on threads of its own, and some tasks dispatch
+// again from inside. Returns how many tasks did not run exactly once.
+inline uint64_t checkParallelRuns(unsigned int rounds)
+{
+  std::atomic<uint64_t> wrong{0};
+  auto dispatchRounds = [&wrong, rounds](unsigned int seed) {
+    for (unsigned int r = 0; r < rounds; ++r)
+    {
+      const unsigned int taskCount = 2 + (r * 7 + seed) % 8;
+      std::vector<std::atomic<unsigned int>> runs(taskCount);
+      std::atomic<unsigned int> nestedRuns{0};
+      parallelTasks(taskCount, [&](unsigned int t) {
+        runs[t].fetch_add(1, std::memory_order_relaxed);
+        if (t == 0 && r % 16 == 0)
+          parallelTasks(2, [&nestedRuns](unsigned int) { nestedRuns.fetch_add(1, std::memory_order_relaxed); });
+      });
+      for (const std::atomic<unsigned int> &count : runs)
+        if (count.load() != 1)
+          ++wrong;
+      if (r % 16 == 0 && nestedRuns.load() != 2)
+        ++wrong;
+    }
+  };
+  std::thread other(dispatchRounds, 1u);
+  dispatchRounds(0u);
+  other.join();
+  return wrong.load();
+}
+#endif
@@ -0,0 +1,389 @@
+#ifndef SCULPTURE_H
+#define SCULPTURE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "galaxy.h"
+#include "instance_uploads.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Sculpture description file, one element per line:
+//   <shape> key=value key=value ...
+// shapes: spiral (a galaxy, see generateStar()), ring, helix and lattice. Vectors are written x,y,z.
+// '#' starts a comment. Counts, seeds and arms are plain decimal integers, the rest finite numbers; radius must
+// be positive and the counts may add up to at most SCULPTURE_MAX_STARS. For example:
+//   spiral  count=1000000 radius=10 arms=3 seed=1
+//   ring    count=200000 radius=12 thickness=0.3 color=1,0.6,0.2 tilt=15
+//   helix   count=100000 radius=1.5 height=8 turns=6 arms=2 center=0,4,0 color=0.4,0.8,1
+//   lattice count=27000 radius=3 center=0,-5,0 color=0.9,0.9,1 spin=30
+// Elements with a spin keep turning around the vertical axis through their center; the rest stay put.
+enum SculptureShape
+{
+  SCULPTURE_SPIRAL,
+  SCULPTURE_RING,
+  SCULPTURE_HELIX,
+  SCULPTURE_LATTICE
+};
+
+struct SculptureElement
+{
+  SculptureShape shape = SCULPTURE_SPIRAL;
+  uint32_t count = 1000;
+  uint32_t seed = 1;
+  int arms = 3;            // spiral arms, helix strands
+  float radius = 5.0f;     // spiral, ring and helix radius; half the lattice edge
+  float height = 4.0f;     // helix height
+  float turns = 3.0f;      // helix turns
+  float thickness = 0.1f;  // random spread around the ring or helix curve
+  float tilt = 0.0f;       // degrees around the x axis, applied before center
+  float spin = 0.0f;       // degrees/sec around the vertical axis through center, see Sculpture::animate()
+  glm::vec3 center = glm::vec3(0.0f);
+  glm::vec3 color = glm::vec3(1.0f); // ring, helix and lattice base color; spirals keep their gradient
+  uint32_t first = 0;      // the element's stars are [first, first + count) of the shared buffer
+};
+
+struct SculptureStats
+{
+  unsigned int threads = 0;
+  unsigned int jobs = 0;
+  double milliseconds = 0.0;
+  double starsPerSecond = 0.0;
+};
+
+// stars per generator job; a multiple of GALAXY_BATCH so spiral jobs start on a batch
+const uint32_t SCULPTURE_JOB_STARS = 16384;
+
+// the most stars a sculpture may add up to: every star is drawn in one call, whose count is a GLsizei
+const uint64_t SCULPTURE_MAX_STARS = 0x7fffffffull;
+
+// A composite sculpture read from a description file. generate() turns every element into jobs of at most
+// SCULPTURE_JOB_STARS stars, each owning its own range of one shared star array, and worker threads take
+// jobs off a shared counter until none are left, so cheap and expensive shapes even out across threads.
+class Sculpture
+{
+public:
+  std::vector<SculptureElement> elements;
+  SculptureStats stats;
+  std::string error;
+
+  bool load(const std::string &path)
+  {
+    std::ifstream file(path);
+    if (!file)
+    {
+      error = "cannot read " + path;
+      return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    return parse(text.str());
+  }
+
+  // reads the description; on failure error names the line and nothing is kept
+  bool parse(const std::string &text)
+  {
+    elements.clear();
+    error.clear();
+    std::istringstream lines(text);
+    std::string line;
+    uint64_t total = 0;
+    for (unsigned int number = 1; std::getline(lines, line); ++number)
+    {
+      line = line.substr(0, line.find('#'));
+      std::istringstream words(line);
+      std::string shape;
+      if (!(words >> shape))
+        continue;
+      SculptureElement element;
+      if (shape == "spiral")
+        element.shape = SCULPTURE_SPIRAL;
+      else if (shape == "ring")
+        element.shape = SCULPTURE_RING;
+      else if (shape == "helix")
+        element.shape = SCULPTURE_HELIX;
+      else if (shape == "lattice")
+        element.shape = SCULPTURE_LATTICE;
+      else
+        return fail(number, "unknown shape '" + shape + "'");
+
+      std::string word;
+      while (words >> word)
+      {
+        size_t equals = word.find('=');
+        std::string key = word.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : word.substr(equals + 1);
+        bool valid = true;
+        uint64_t parsed = 0;
+        if (key == "count")
+        {
+          valid = parseUnsigned(value, parsed);
+          if (valid && parsed > SCULPTURE_MAX_STARS)
+            return fail(number, "count must be at most " + std::to_string(SCULPTURE_MAX_STARS));
+          element.count = static_cast<uint32_t>(parsed);
+        }
+        else if (key == "seed")
+        {
+          valid = parseUnsigned(value, parsed) && parsed <= 0xffffffffull;
+          element.seed = static_cast<uint32_t>(parsed);
+        }
+        else if (key == "arms")
+        {
+          valid = parseUnsigned(value, parsed) && parsed <= 0x7fffffffull;
+          if (valid && parsed < 1)
+            return fail(number, "arms must be at least 1");
+          element.arms = static_cast<int>(parsed);
+        }
+        else if (key == "radius")
+        {
+          valid = parseFloat(value, element.radius);
+          if (valid && element.radius <= 0.0f)
+            return fail(number, "radius must be positive");
+        }
+        else if (key == "height")
+          valid = parseFloat(value, element.height);
+        else if (key == "turns")
+          valid = parseFloat(value, element.turns);
+        else if (key == "thickness")
+          valid = parseFloat(value, element.thickness);
+        else if (key == "tilt")
+          valid = parseFloat(value, element.tilt);
+        else if (key == "spin")
+          valid = parseFloat(value, element.spin);
+        else if (key == "center")
+          valid = parseVector(value, element.center);
+        else if (key == "color")
+          valid = parseVector(value, element.color);
+        else
+          return fail(number, "unknown key '" + key + "'");
+        if (!valid)
+          return fail(number, "bad value for '" + key + "'");
+      }
+      element.first = static_cast<uint32_t>(total);
+      total += element.count;
+      if (total > SCULPTURE_MAX_STARS)
+        return fail(number, "more than " + std::to_string(SCULPTURE_MAX_STARS) + " stars in all");
+      elements.push_back(element);
+    }
+    if (elements.empty())
+      error = "no elements";
+    return error.empty();
+  }
+
+  uint32_t size() const
+  {
+    return elements.empty() ? 0 : elements.back().first + elements.back().count;
+  }
+
+  // whether any element spins
+  bool isAnimated() const
+  {
+    for (const SculptureElement &element : elements)
+      if (element.spin != 0.0f && element.count > 0)
+        return true;
+    return false;
+  }
+
+  // fills stars (the float layout of generateGalaxy()) with every element and returns the largest
+  // coordinate any star reaches, spinning ones anywhere on their circle; it bounds the sculpture like
+  // GalaxyParams::radius bounds a galaxy
+  float generate(std::vector<float> &stars, unsigned int threadCount = 0, GalaxyKernel kernel = GALAXY_KERNEL_AUTO)
+  {
+    auto start = std::chrono::steady_clock::now();
+    stars.resize(static_cast<size_t>(size()) * GALAXY_FLOATS_PER_STAR);
+    kernel = resolveGalaxyKernel(kernel);
+
+    struct Job
+    {
+      uint32_t element, begin, end; // stars of the element, relative to its first
+    };
+    std::vector<Job> jobs;
+    for (uint32_t e = 0; e < elements.size(); ++e)
+      for (uint32_t begin = 0; begin < elements[e].count; begin += SCULPTURE_JOB_STARS)
+        jobs.push_back({e, begin, std::min(elements[e].count, begin + SCULPTURE_JOB_STARS)});
+
+    const unsigned int workers = std::max(1u, std::min<unsigned int>(parallelThreadCount(size(), threadCount), static_cast<unsigned int>(jobs.size())));
+    std::vector<float> extents(workers, 0.0f);
+    std::atomic<uint32_t> nextJob{0};
+    parallelTasks(workers, [&](unsigned int worker) {
+      for (uint32_t j = nextJob++; j < jobs.size(); j = nextJob++)
+      {
+        const SculptureElement &element = elements[jobs[j].element];
+        float *out = &stars[static_cast<size_t>(element.first) * GALAXY_FLOATS_PER_STAR];
+        generateRange(element, kernel, jobs[j].begin, jobs[j].end, out);
+        for (uint32_t i = jobs[j].begin; i < jobs[j].end; ++i)
+        {
+          const float *star = &out[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+          float extent = std::max(std::abs(star[0]), std::max(std::abs(star[1]), std::abs(star[2])));
+          if (element.spin != 0.0f)
+          {
+            // anywhere on the circle it turns through
+            float around = std::hypot(star[0] - element.center.x, star[2] - element.center.z);
+            extent = std::max(extent, std::max(std::abs(element.center.x), std::abs(element.center.z)) + around);
+          }
+          extents[worker] = std::max(extents[worker], extent);
+        }
+      }
+    });
+
+    // spinning elements keep their generated positions to turn from
+    restPositions.clear();
+    for (const SculptureElement &element : elements)
+      if (element.spin != 0.0f)
+        for (uint32_t i = element.first; i < element.first + element.count; ++i)
+          restPositions.push_back(glm::make_vec3(&stars[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR]));
+
+    stats.threads = workers;
+    stats.jobs = static_cast<unsigned int>(jobs.size());
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    stats.starsPerSecond = stats.milliseconds > 0.0 ? size() / (stats.milliseconds / 1000.0) : 0.0;
+    return *std::max_element(extents.begin(), extents.end());
+  }
+
+  // turns every spinning element to where it is at time seconds, writing the positions in stars (as filled by
+  // generate(), in generation order) and marking their ranges in dirty; colors and still elements are untouched
+  void animate(float time, std::vector<float> &stars, DirtyRanges &dirty, unsigned int threadCount = 0) const
+  {
+    size_t rest = 0;
+    for (const SculptureElement &element : elements)
+    {
+      if (element.spin == 0.0f)
+        continue;
+      const float angle = glm::radians(element.spin * time);
+      const float c = std::cos(angle), s = std::sin(angle);
+      const glm::vec3 *from = &restPositions[rest];
+      parallelFor(element.count, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+        for (uint32_t i = begin; i < end; ++i)
+        {
+          glm::vec3 p = from[i] - element.center;
+          float *star = &stars[static_cast<size_t>(element.first + i) * GALAXY_FLOATS_PER_STAR];
+          star[0] = element.center.x + c * p.x - s * p.z;
+          star[1] = from[i].y;
+          star[2] = element.center.z + s * p.x + c * p.z;
+        }
+      });
+      dirty.mark(element.first, element.first + element.count);
+      rest += element.count;
+    }
+  }
+
+private:
+  std::vector<glm::vec3> restPositions; // spinning elements only, in element order
+
+  bool fail(unsigned int line, const std::string &message)
+  {
+    elements.clear();
+    error = "line " + std::to_string(line) + ": " + message;
+    return false;
+  }
+
+  // a decimal integer and nothing else, so "-1" or "3x" are errors rather than wrapping or truncating
+  static bool parseUnsigned(const std::string &value, uint64_t &out)
+  {
+    if (value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != std::string::npos)
+      return false;
+    out = std::strtoull(value.c_str(), NULL, 10);
+    return true;
+  }
+
+  // a finite number and nothing else
+  static bool parseFloat(const std::string &value, float &out)
+  {
+    char *end = NULL;
+    float v = std::strtof(value.c_str(), &end);
+    if (value.empty() || *end != 0 || !std::isfinite(v))
+      return false;
+    out = v;
+    return true;
+  }
+
+  static bool parseVector(const std::string &value, glm::vec3 &out)
+  {
+    glm::vec3 v;
+    char comma1 = 0, comma2 = 0;
+    std::istringstream in(value);
+    if (!(in >> v.x >> comma1 >> v.y >> comma2 >> v.z) || comma1 != ',' || comma2 != ',')
+      return false;
+    out = v;
+    return true;
+  }
+
+  // stars [begin, end) of one element into out, which points at the element's first star
+  static void generateRange(const SculptureElement &element, GalaxyKernel kernel, uint32_t begin, uint32_t end, float *out)
+  {
+    const float pi = 3.14159265358979323846f;
+    const uint32_t seedKey = galaxySeedKey(element.seed);
+    if (element.shape == SCULPTURE_SPIRAL)
+    {
+      GalaxyParams params;
+      params.numStars = element.count;
+      params.arms = element.arms;
+      params.radius = element.radius;
+      params.seed = element.seed;
+      generateGalaxyRange(params, kernel, begin, end, out);
+    }
+    // the lattice is the smallest cube with count points, filled in x, z, y order
+    uint32_t side = 1;
+    while (element.shape == SCULPTURE_LATTICE && static_cast<uint64_t>(side) * side * side < element.count)
+      ++side;
+    const float tiltCos = std::cos(glm::radians(element.tilt));
+    const float tiltSin = std::sin(glm::radians(element.tilt));
+    for (uint32_t i = begin; i < end; ++i)
+    {
+      float *star = out + static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR;
+      const uint32_t key = galaxyStarKey(seedKey, i);
+      glm::vec3 position, color;
+      if (element.shape == SCULPTURE_SPIRAL)
+      {
+        position = glm::vec3(star[0], star[1], star[2]);
+        color = glm::vec3(star[3], star[4], star[5]);
+      }
+      else if (element.shape == SCULPTURE_RING)
+      {
+        float angle = 2.0f * pi * galaxyRandom(key, STREAM_RADIUS);
+        float r = element.radius + (galaxyRandom(key, STREAM_DEVIATION) - 0.5f) * element.thickness;
+        position = glm::vec3(r * std::cos(angle), (galaxyRandom(key, STREAM_HEIGHT) - 0.5f) * element.thickness, r * std::sin(angle));
+        color = element.color * (0.85f + 0.3f * galaxyRandom(key, STREAM_RED));
+      }
+      else if (element.shape == SCULPTURE_HELIX)
+      {
+        // strands interleave, so every strand gets an even share of the count
+        uint32_t strand = i % element.arms;
+        uint32_t perStrand = (element.count + element.arms - 1) / element.arms;
+        float t = perStrand > 1 ? static_cast<float>(i / element.arms) / (perStrand - 1) : 0.0f;
+        float angle = 2.0f * pi * (element.turns * t + static_cast<float>(strand) / element.arms);
+        glm::vec3 jitter(galaxyRandom(key, STREAM_DEVIATION), galaxyRandom(key, STREAM_HEIGHT), galaxyRandom(key, STREAM_RADIUS));
+        position = glm::vec3(element.radius * std::cos(angle), element.height * (t - 0.5f), element.radius * std::sin(angle)) +
+                   (jitter - 0.5f) * element.thickness;
+        color = glm::mix(element.color, glm::vec3(1.0f), 0.5f * t) * (0.85f + 0.3f * galaxyRandom(key, STREAM_RED));
+      }
+      else
+      {
+        glm::vec3 cell(static_cast<float>(i % side), static_cast<float>(i / (side * side)), static_cast<float>((i / side) % side));
+        position = side > 1 ? (cell / static_cast<float>(side - 1) - 0.5f) * (2.0f * element.radius) : glm::vec3(0.0f);
+        color = element.color * (0.6f + 0.4f * cell / static_cast<float>(std::max<uint32_t>(1, side - 1)));
+      }
+
+      position = glm::vec3(position.x, position.y * tiltCos - position.z * tiltSin, position.y * tiltSin + position.z * tiltCos);
+      position += element.center;
+      color = glm::clamp(color, 0.0f, 1.0f);
+      star[0] = position.x;
+      star[1] = position.y;
+      star[2] = position.z;
+      star[3] = color.r;
+      star[4] = color.g;
+      star[5] = color.b;
+    }
+  }
+};
+#endif
@@ -0,0 +1,213 @@
+#ifndef SIMULATION_THREAD_H
+#define SIMULATION_THREAD_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Single-producer, single-consumer triple buffer. The writer fills back() and publish()es it, the reader
+// calls update() and reads front(); the third slot sits in between. Both sides only ever exchange one
+// atomic index, so neither can block the other, and the reader always gets the newest published slot.
+template <typename T>
+class TripleBuffer
+{
+public:
+  // writer side
+  T &back()
+  {
+    return slots[backIndex];
+  }
+
+  void publish()
+  {
+    uint8_t previous = middle.exchange(static_cast<uint8_t>(backIndex | FRESH), std::memory_order_acq_rel);
+    backIndex = previous & INDEX;
+  }
+
+  // reader side: takes the newest published slot if there is one, returns whether front() changed
+  bool update()
+  {
+    if ((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+      return false;
+    uint8_t previous = middle.exchange(static_cast<uint8_t>(frontIndex), std::memory_order_acq_rel);
+    frontIndex = previous & INDEX;
+    return true;
+  }
+
+  const T &front() const
+  {
+    return slots[frontIndex];
+  }
+
+  // only while no other thread uses the buffer
+  void fill(const T &value)
+  {
+    for (T &slot : slots)
+      slot = value;
+    middle.store(2, std::memory_order_relaxed);
+    backIndex = 0;
+    frontIndex = 1;
+  }
+
+private:
+  static const uint8_t INDEX = 3;
+  static const uint8_t FRESH = 4;
+  T slots[3];
+  unsigned int backIndex = 0;
+  unsigned int frontIndex = 1;
+  std::atomic<uint8_t> middle{2};
+};
+
+// One published tick. It keeps the state before the tick as well, so the renderer can always blend between
+// the two without keeping history of its own, however many ticks it missed. The star arrays are shared, not
+// copied: previousStars is the stars array of the tick before, which stays untouched while any slot
+// refers to it.
+struct SimulationFrame
+{
+  uint64_t tick = 0;
+  double previousTime = 0.0;
+  double time = 0.0;
+  float previousAngle = 0.0f; // rigid rotation, degrees
+  float angle = 0.0f;
+  std::shared_ptr<std::vector<float>> previousStars; // float star arrays (see generateGalaxy()), empty without per-star motion
+  std::shared_ptr<std::vector<float>> stars;
+  double stepMilliseconds = 0.0; // what the step took
+  uint64_t skippedTicks = 0;     // ticks dropped so far because steps ran late
+};
+
+// Advances the animation on its own thread at a fixed rate, independent of the frame rate. Tick k stands
+// for time k * tickSeconds on the given clock; when the thread falls behind it jumps straight to the
+// newest due tick, so a slow step never queues up more work. The renderer shows the time one tick behind
+// its clock, which the newest frame always brackets while the simulation keeps up.
+class SimulationThread
+{
+public:
+  // step fills frame.angle and *frame.stars for frame.time, frame.time - frame.previousTime after the last
+  // tick; *frame.stars still holds the state of some earlier tick (or the initial stars), so steps that
+  // rewrite only some fields may leave the others alone
+  typedef std::function<void(SimulationFrame &frame)> Step;
+
+  ~SimulationThread()
+  {
+    stop();
+  }
+
+  // clock must be callable from the simulation thread; stars is the initial float star array, if any
+  void start(double seconds, std::function<double()> clockFunction, Step stepFunction, const std::vector<float> &stars)
+  {
+    stop();
+    tickSeconds = seconds;
+    clock = clockFunction;
+    step = stepFunction;
+    starArrays.assign(1, std::make_shared<std::vector<float>>(stars));
+    SimulationFrame initial;
+    initial.previousStars = starArrays[0];
+    initial.stars = starArrays[0];
+    buffer.fill(initial);
+    running = true;
+    worker = std::thread(&SimulationThread::run, this);
+  }
+
+  void stop()
+  {
+    running = false;
+    if (worker.joinable())
+      worker.join();
+  }
+
+  bool isRunning() const
+  {
+    return worker.joinable();
+  }
+
+  double tick() const
+  {
+    return tickSeconds;
+  }
+
+  // the newest published frame; stays valid until the next call
+  const SimulationFrame &latest()
+  {
+    buffer.update();
+    return buffer.front();
+  }
+
+  // how far renderTime lies from frame.previousTime to frame.time, clamped to [0, 1]: if the simulation fell
+  // behind, the newest state is held rather than extrapolated
+  static float blend(const SimulationFrame &frame, double renderTime)
+  {
+    double span = frame.time - frame.previousTime;
+    if (span <= 0.0)
+      return 1.0f;
+    return static_cast<float>(std::min(1.0, std::max(0.0, (renderTime - frame.previousTime) / span)));
+  }
+
+private:
+  TripleBuffer<SimulationFrame> buffer;
+  std::thread worker;
+  std::atomic<bool> running{false};
+  double tickSeconds = 1.0 / 60.0;
+  std::function<double()> clock;
+  Step step;
+  // every star array the frames share, simulation thread only once started. The three slots refer to at
+  // most five arrays at a time, so the pool stops growing after a few ticks.
+  std::vector<std::shared_ptr<std::vector<float>>> starArrays;
+
+  // an array no slot refers to any more; the reader never copies the pointers, so only this thread changes
+  // the counts, and a slot the reader still holds keeps its arrays counted
+  std::shared_ptr<std::vector<float>> unusedStars()
+  {
+    for (const std::shared_ptr<std::vector<float>> &stars : starArrays)
+      if (stars.use_count() == 1)
+        return stars;
+    starArrays.push_back(std::make_shared<std::vector<float>>(*starArrays[0]));
+    return starArrays.back();
+  }
+
+  void run()
+  {
+    const SimulationFrame &initial = buffer.back();
+    std::shared_ptr<std::vector<float>> lastStars = initial.stars;
+    float lastAngle = initial.angle;
+    double lastTime = 0.0;
+    uint64_t tick = 0;
+    uint64_t skipped = 0;
+    while (running)
+    {
+      double now = clock();
+      uint64_t due = static_cast<uint64_t>(std::max(0.0, now / tickSeconds));
+      if (due <= tick)
+      {
+        double wait = std::min(tickSeconds, std::max(0.0005, (tick + 1) * tickSeconds - now));
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        continue;
+      }
+      skipped += due - tick - 1;
+      tick = due;
+
+      SimulationFrame &frame = buffer.back();
+      frame.tick = tick;
+      frame.previousTime = lastTime;
+      frame.time = tick * tickSeconds;
+      frame.previousAngle = lastAngle;
+      frame.previousStars = lastStars;
+      frame.stars.reset();
+      frame.stars = unusedStars();
+      auto start = std::chrono::steady_clock::now();
+      step(frame);
+      frame.stepMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      frame.skippedTicks = skipped;
+
+      lastTime = frame.time;
+      lastAngle = frame.angle;
+      lastStars = frame.stars;
+      buffer.publish();
+    }
+  }
+};
+#endif
@@ -0,0 +1,461 @@
+#ifndef SPHERE_MESH_H
+#define SPHERE_MESH_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// the two tessellations of a star: latitude/longitude rings, or a subdivided icosahedron whose triangles
+// are all about the same size
+enum SphereShape
+{
+  SPHERE_UV,
+  SPHERE_ICO
+};
+
+inline SphereShape parseSphereShape(const std::string &name)
+{
+  return name == "ico" ? SPHERE_ICO : SPHERE_UV;
+}
+
+// positions only (x, y, z per vertex; the shaders take the normal from the position), indices local to
+// the mesh, three per triangle
+struct SphereMesh
+{
+  std::vector<float> vertices;
+  std::vector<uint32_t> indices;
+
+  uint32_t vertexCount() const
+  {
+    return static_cast<uint32_t>(vertices.size() / 3);
+  }
+
+  uint32_t triangleCount() const
+  {
+    return static_cast<uint32_t>(indices.size() / 3);
+  }
+};
+
+// UV sphere with sectorCount longitudes and stackCount latitude bands. Each pole is a single vertex with a
+// fan of sectorCount triangles, so there are no degenerate triangles, and there is no seam column since
+// the vertices carry no texture coordinates: (stackCount - 1) * sectorCount + 2 vertices and
+// 2 * sectorCount * (stackCount - 1) triangles. Fewer than 3 sectors or 2 stacks enclose no volume (and
+// would wrap the unsigned counts below), so they are raised to that minimum, as StaticUvSphere asserts.
+inline SphereMesh generateUvSphere(float radius, int sectorCount, int stackCount)
+{
+  const float pi = 3.14159265358979323846f;
+  sectorCount = std::max(sectorCount, 3);
+  stackCount = std::max(stackCount, 2);
+  SphereMesh mesh;
+  const uint32_t rings = static_cast<uint32_t>(stackCount - 1);
+  const uint32_t sectors = static_cast<uint32_t>(sectorCount);
+  mesh.vertices.reserve(3 * (rings * sectors + 2));
+  mesh.indices.reserve(6 * sectors * rings);
+
+  mesh.vertices.insert(mesh.vertices.end(), {0.0f, 0.0f, radius});
+  for (uint32_t i = 1; i <= rings; ++i)
+  {
+    float stackAngle = pi / 2 - i * pi / stackCount; // latitude
+    float xy = radius * std::cos(stackAngle);
+    float z = radius * std::sin(stackAngle);
+    for (uint32_t j = 0; j < sectors; ++j)
+    {
+      float sectorAngle = j * 2 * pi / sectorCount; // longitude
+      mesh.vertices.insert(mesh.vertices.end(), {xy * std::cos(sectorAngle), xy * std::sin(sectorAngle), z});
+    }
+  }
+  mesh.vertices.insert(mesh.vertices.end(), {0.0f, 0.0f, -radius});
+
+  const uint32_t south = rings * sectors + 1;
+  auto ring = [&](uint32_t i, uint32_t j) { return 1 + (i - 1) * sectors + j % sectors; };
+  for (uint32_t j = 0; j < sectors; ++j)
+    mesh.indices.insert(mesh.indices.end(), {0, ring(1, j), ring(1, j + 1)});
+  for (uint32_t i = 1; i < rings; ++i)
+  {
+    for (uint32_t j = 0; j < sectors; ++j)
+    {
+      uint32_t k1 = ring(i, j), k2 = ring(i + 1, j);
+      uint32_t k3 = ring(i, j + 1), k4 = ring(i + 1, j + 1);
+      mesh.indices.insert(mesh.indices.end(), {k1, k2, k3, k3, k2, k4});
+    }
+  }
+  for (uint32_t j = 0; j < sectors; ++j)
+    mesh.indices.insert(mesh.indices.end(), {ring(rings, j), south, ring(rings, j + 1)});
+  return mesh;
+}
+
+// std::sin() is not constexpr in C++17, so the compile-time spheres below use this: the angle is reduced
+// to [-pi/2, pi/2] and summed as a Taylor series in double, which is exact to well under a float ulp
+constexpr double constexprSin(double x)
+{
+  const double pi = 3.14159265358979323846;
+  double turns = x / (2 * pi);
+  x -= 2 * pi * static_cast<double>(static_cast<long long>(turns < 0 ? turns - 0.5 : turns + 0.5));
+  if (x > pi / 2)
+    x = pi - x;
+  else if (x < -pi / 2)
+    x = -pi - x;
+  double term = x, sum = x;
+  for (int n = 1; n <= 11; ++n)
+  {
+    term *= -x * x / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+constexpr double constexprCos(double x)
+{
+  return constexprSin(x + 3.14159265358979323846 / 2);
+}
+
+// generateUvSphere() evaluated by the compiler, for the sizes known at build time: the same float
+// arithmetic, vertex for vertex and index for index, with 16-bit indices. A constexpr instance is embedded
+// in the binary and costs no trigonometry at startup; --check-spheres compares it with the runtime generator.
+template <int Sectors, int Stacks>
+struct StaticUvSphere
+{
+  static constexpr uint32_t vertexCount = (Stacks - 1) * Sectors + 2;
+  static constexpr uint32_t triangleCount = 2 * Sectors * (Stacks - 1);
+  static_assert(Sectors >= 3 && Stacks >= 2, "a sphere needs at least 3 sectors and 2 stacks");
+  static_assert(vertexCount <= 65536, "the indices are 16 bits");
+
+  std::array<float, 3 * vertexCount> vertices{};
+  std::array<uint16_t, 3 * triangleCount> indices{};
+
+  constexpr explicit StaticUvSphere(float radius)
+  {
+    const float pi = 3.14159265358979323846f;
+    const uint32_t rings = Stacks - 1;
+    size_t v = 0;
+    vertices[v++] = 0.0f;
+    vertices[v++] = 0.0f;
+    vertices[v++] = radius;
+    for (uint32_t i = 1; i <= rings; ++i)
+    {
+      float stackAngle = pi / 2 - i * pi / Stacks;
+      float xy = radius * static_cast<float>(constexprCos(stackAngle));
+      float z = radius * static_cast<float>(constexprSin(stackAngle));
+      for (uint32_t j = 0; j < Sectors; ++j)
+      {
+        float sectorAngle = j * 2 * pi / Sectors;
+        vertices[v++] = xy * static_cast<float>(constexprCos(sectorAngle));
+        vertices[v++] = xy * static_cast<float>(constexprSin(sectorAngle));
+        vertices[v++] = z;
+      }
+    }
+    vertices[v++] = 0.0f;
+    vertices[v++] = 0.0f;
+    vertices[v++] = -radius;
+
+    size_t k = 0;
+    auto add = [&](uint32_t a, uint32_t b, uint32_t c) {
+      indices[k++] = static_cast<uint16_t>(a);
+      indices[k++] = static_cast<uint16_t>(b);
+      indices[k++] = static_cast<uint16_t>(c);
+    };
+    auto ring = [](uint32_t i, uint32_t j) { return 1 + (i - 1) * Sectors + j % Sectors; };
+    for (uint32_t j = 0; j < Sectors; ++j)
+      add(0, ring(1, j), ring(1, j + 1));
+    for (uint32_t i = 1; i < rings; ++i)
+    {
+      for (uint32_t j = 0; j < Sectors; ++j)
+      {
+        add(ring(i, j), ring(i + 1, j), ring(i, j + 1));
+        add(ring(i, j + 1), ring(i + 1, j), ring(i + 1, j + 1));
+      }
+    }
+    for (uint32_t j = 0; j < Sectors; ++j)
+      add(ring(rings, j), vertexCount - 1, ring(rings, j + 1));
+  }
+
+  // a runtime copy, for SphereMeshBuffer and optimizeVertexCache()
+  SphereMesh mesh() const
+  {
+    SphereMesh copy;
+    copy.vertices.assign(vertices.begin(), vertices.end());
+    copy.indices.assign(indices.begin(), indices.end());
+    return copy;
+  }
+};
+
+// icosahedron split subdivisions times, each triangle into four with the edge midpoints pushed out to the
+// sphere: 10 * 4^n + 2 vertices and 20 * 4^n triangles. A negative count is the bare icosahedron.
+inline SphereMesh generateIcosphere(float radius, int subdivisions)
+{
+  subdivisions = std::max(subdivisions, 0);
+  const uint32_t scale = 1u << (2 * subdivisions);
+  SphereMesh mesh;
+  mesh.vertices.reserve(3 * (10 * scale + 2));
+
+  const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+  const float corners[12][3] = {{-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0}, {0, -1, t}, {0, 1, t},
+                                {0, -1, -t}, {0, 1, -t}, {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}};
+  auto addVertex = [&](float x, float y, float z) {
+    float s = radius / std::sqrt(x * x + y * y + z * z);
+    mesh.vertices.insert(mesh.vertices.end(), {x * s, y * s, z * s});
+    return mesh.vertexCount() - 1;
+  };
+  for (const float *c : corners)
+    addVertex(c[0], c[1], c[2]);
+  mesh.indices = {0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11, 1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+                  3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9, 4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1};
+  mesh.indices.reserve(3 * 20 * scale);
+
+  // each edge is shared by two triangles, so its midpoint is looked up by the sorted pair of its ends
+  std::unordered_map<uint64_t, uint32_t> midpoints;
+  std::vector<uint32_t> next;
+  for (int level = 0; level < subdivisions; ++level)
+  {
+    midpoints.clear();
+    midpoints.reserve(mesh.indices.size() / 2);
+    next.clear();
+    next.reserve(mesh.indices.size() * 4);
+    auto midpoint = [&](uint32_t a, uint32_t b) {
+      uint64_t key = static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b);
+      auto found = midpoints.find(key);
+      if (found != midpoints.end())
+        return found->second;
+      const float *pa = &mesh.vertices[3 * a], *pb = &mesh.vertices[3 * b];
+      uint32_t m = addVertex(pa[0] + pb[0], pa[1] + pb[1], pa[2] + pb[2]);
+      midpoints.emplace(key, m);
+      return m;
+    };
+    for (size_t f = 0; f < mesh.indices.size(); f += 3)
+    {
+      uint32_t a = mesh.indices[f], b = mesh.indices[f + 1], c = mesh.indices[f + 2];
+      uint32_t ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+      next.insert(next.end(), {a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca});
+    }
+    mesh.indices.swap(next);
+  }
+  return mesh;
+}
+
+// average cache miss ratio: vertices transformed per triangle through a FIFO post-transform cache of
+// cacheSize entries. 0.5 is the floor for a closed mesh, 3 means no reuse at all.
+inline float vertexCacheAcmr(const std::vector<uint32_t> &indices, uint32_t vertexCount, unsigned int cacheSize = 16)
+{
+  if (indices.empty())
+    return 0.0f;
+  std::vector<uint32_t> insertedAt(vertexCount, 0); // time the vertex entered the cache, 0 = never
+  uint32_t clock = 0, misses = 0;
+  for (uint32_t v : indices)
+  {
+    if (insertedAt[v] == 0 || clock - insertedAt[v] >= cacheSize)
+    {
+      insertedAt[v] = ++clock;
+      ++misses;
+    }
+  }
+  return static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+}
+
+// Reorders the triangles for the post-transform vertex cache (Tom Forsyth's linear-speed greedy
+// algorithm): vertices score by their position in a modelled LRU cache and by how few triangles still
+// need them, and the next triangle is the best scored one touching the cache. The vertices are then
+// renumbered in first-use order so the fetches stream through the vertex buffer as well. The mesh is left
+// as it is when the new order does not lower vertexCacheAcmr().
+inline void optimizeVertexCache(SphereMesh &mesh)
+{
+  const int cacheSize = 32;
+  const uint32_t vertexCount = mesh.vertexCount();
+  const uint32_t triangleCount = mesh.triangleCount();
+  if (triangleCount == 0)
+    return;
+
+  // triangles of each vertex, as offsets into one array
+  std::vector<uint32_t> firstTriangle(vertexCount + 1, 0), vertexTriangles(mesh.indices.size());
+  for (uint32_t v : mesh.indices)
+    ++firstTriangle[v + 1];
+  for (uint32_t v = 0; v < vertexCount; ++v)
+    firstTriangle[v + 1] += firstTriangle[v];
+  std::vector<uint32_t> remaining(vertexCount, 0);
+  for (uint32_t f = 0; f < triangleCount; ++f)
+    for (int k = 0; k < 3; ++k)
+    {
+      uint32_t v = mesh.indices[3 * f + k];
+      vertexTriangles[firstTriangle[v] + remaining[v]++] = f;
+    }
+
+  auto vertexScore = [&](int cachePosition, uint32_t valence) {
+    if (valence == 0)
+      return -1.0f;
+    float score = 0.0f;
+    if (cachePosition >= 0)
+      score = cachePosition < 3 ? 0.75f : std::pow(1.0f - (cachePosition - 3) / float(cacheSize - 3), 1.5f);
+    return score + 2.0f / std::sqrt(static_cast<float>(valence));
+  };
+  std::vector<int> cachePosition(vertexCount, -1);
+  std::vector<float> score(vertexCount);
+  for (uint32_t v = 0; v < vertexCount; ++v)
+    score[v] = vertexScore(-1, remaining[v]);
+  std::vector<float> triangleScore(triangleCount);
+  std::vector<char> emitted(triangleCount, 0);
+  for (uint32_t f = 0; f < triangleCount; ++f)
+    triangleScore[f] = score[mesh.indices[3 * f]] + score[mesh.indices[3 * f + 1]] + score[mesh.indices[3 * f + 2]];
+
+  std::vector<uint32_t> order, cache, nextCache;
+  order.reserve(mesh.indices.size());
+  cache.reserve(cacheSize + 3);
+  nextCache.reserve(cacheSize + 3);
+  uint32_t best = UINT32_MAX, scanFrom = 0;
+  for (uint32_t done = 0; done < triangleCount; ++done)
+  {
+    if (best == UINT32_MAX)
+    {
+      // nothing left touches the cache: best unemitted triangle anywhere (the scan never goes back)
+      float bestScore = -1.0f;
+      while (emitted[scanFrom])
+        ++scanFrom;
+      for (uint32_t f = scanFrom; f < triangleCount; ++f)
+        if (!emitted[f] && triangleScore[f] > bestScore)
+        {
+          bestScore = triangleScore[f];
+          best = f;
+        }
+    }
+    emitted[best] = 1;
+    const uint32_t *tri = &mesh.indices[3 * best];
+    order.insert(order.end(), tri, tri + 3);
+
+    // the triangle's vertices move to the front of the cache and lose it from their lists
+    nextCache.assign(tri, tri + 3);
+    for (uint32_t v : cache)
+      if (v != tri[0] && v != tri[1] && v != tri[2])
+        nextCache.push_back(v);
+    for (int k = 0; k < 3; ++k)
+    {
+      uint32_t v = tri[k];
+      uint32_t *list = &vertexTriangles[firstTriangle[v]];
+      uint32_t *last = list + remaining[v] - 1;
+      *std::find(list, last + 1, best) = *last;
+      --remaining[v];
+    }
+    for (size_t c = 0; c < nextCache.size(); ++c)
+    {
+      uint32_t v = nextCache[c];
+      cachePosition[v] = c < static_cast<size_t>(cacheSize) ? static_cast<int>(c) : -1;
+      score[v] = vertexScore(cachePosition[v], remaining[v]);
+    }
+    if (nextCache.size() > static_cast<size_t>(cacheSize))
+      nextCache.resize(cacheSize);
+    cache.swap(nextCache);
+
+    // rescore the triangles around the cache and continue with the best of them
+    best = UINT32_MAX;
+    float bestScore = -1.0f;
+    for (uint32_t v : cache)
+      for (uint32_t t = firstTriangle[v]; t < firstTriangle[v] + remaining[v]; ++t)
+      {
+        uint32_t f = vertexTriangles[t];
+        const uint32_t *fv = &mesh.indices[3 * f];
+        triangleScore[f] = score[fv[0]] + score[fv[1]] + score[fv[2]];
+        if (triangleScore[f] > bestScore)
+        {
+          bestScore = triangleScore[f];
+          best = f;
+        }
+      }
+  }
+
+  // small rings already stream through a FIFO cache in generation order, and the greedy order, which
+  // models a larger LRU cache, can lose there: keep whichever misses less
+  if (vertexCacheAcmr(order, vertexCount) >= vertexCacheAcmr(mesh.indices, vertexCount))
+    return;
+
+  // renumber the vertices in the order the new index list first uses them
+  std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+  std::vector<float> vertices;
+  vertices.reserve(mesh.vertices.size());
+  for (uint32_t &v : order)
+  {
+    if (remap[v] == UINT32_MAX)
+    {
+      remap[v] = static_cast<uint32_t>(vertices.size() / 3);
+      vertices.insert(vertices.end(), &mesh.vertices[3 * v], &mesh.vertices[3 * v] + 3);
+    }
+    v = remap[v];
+  }
+  mesh.vertices.swap(vertices);
+  mesh.indices.swap(order);
+}
+
+// where one mesh sits in a SphereMeshBuffer
+struct SphereMeshRange
+{
+  int baseVertex = 0;
+  unsigned int firstIndex = 0;
+  unsigned int indexCount = 0;
+};
+
+// Several sphere meshes in one vertex and one index buffer, each drawn with its base vertex. The indices
+// stay local to their mesh, so they are stored as 16 bits whenever every mesh has at most 65536 vertices.
+class SphereMeshBuffer
+{
+public:
+  std::vector<float> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<SphereMeshRange> ranges; // one per mesh, in the order given
+
+  explicit SphereMeshBuffer(const std::vector<SphereMesh> &meshes)
+  {
+    size_t vertexFloats = 0, indexCount = 0;
+    for (const SphereMesh &mesh : meshes)
+    {
+      vertexFloats += mesh.vertices.size();
+      indexCount += mesh.indices.size();
+      wide = wide || mesh.vertexCount() > 65536;
+    }
+    vertices.reserve(vertexFloats);
+    indices.reserve(indexCount);
+    for (const SphereMesh &mesh : meshes)
+    {
+      SphereMeshRange range;
+      range.baseVertex = static_cast<int>(vertices.size() / 3);
+      range.firstIndex = static_cast<unsigned int>(indices.size());
+      range.indexCount = static_cast<unsigned int>(mesh.indices.size());
+      ranges.push_back(range);
+      vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+      indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+    }
+  }
+
+  GLenum indexType() const
+  {
+    return wide ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+  }
+
+  size_t indexSize() const
+  {
+    return wide ? sizeof(uint32_t) : sizeof(uint16_t);
+  }
+
+  // fills vbo and ebo (GL_ARRAY_BUFFER and GL_ELEMENT_ARRAY_BUFFER; the element binding is part of the
+  // bound VAO, if any)
+  void upload(unsigned int vbo, unsigned int ebo) const
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    if (wide)
+    {
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+    }
+    else
+    {
+      std::vector<uint16_t> narrow(indices.begin(), indices.end());
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, narrow.size() * sizeof(uint16_t), narrow.data(), GL_STATIC_DRAW);
+    }
+  }
+
+private:
+  bool wide = false;
+};
+#endif
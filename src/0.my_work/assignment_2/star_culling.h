@@ -0,0 +1,323 @@
+#ifndef STAR_CULLING_H
+#define STAR_CULLING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/camera.h>
+#include <learnopengl/model.h>
+#include <learnopengl/entity.h>
+#include <learnopengl/shader_c.h>
+
+#include "galaxy.h"
+#include "parallel.h"
+#include "star_instances.h"
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+enum StarCullMode
+{
+  STAR_CULL_NONE,
+  STAR_CULL_CPU,
+  STAR_CULL_GPU
+};
+
+inline StarCullMode parseStarCullMode(const std::string &name)
+{
+  if (name == "cpu")
+    return STAR_CULL_CPU;
+  if (name == "gpu")
+    return STAR_CULL_GPU;
+  return STAR_CULL_NONE;
+}
+
+struct CullStats
+{
+  uint32_t visible = 0;
+  uint32_t total = 0;
+  double milliseconds = 0.0;
+};
+
+// moves a world-space frustum into the space the star positions live in, so the stars themselves
+// never need to be transformed. model is the galaxy's rigid model matrix (rotation + translation).
+inline Frustum frustumToModelSpace(const Frustum &frustum, const glm::mat4 &model)
+{
+  const glm::mat3 rotationT = glm::transpose(glm::mat3(model));
+  const glm::vec3 translation = glm::vec3(model[3]);
+  Frustum local = frustum;
+  for (Plane *plane : {&local.topFace, &local.bottomFace, &local.rightFace, &local.leftFace, &local.farFace, &local.nearFace})
+  {
+    plane->distance -= glm::dot(plane->normal, translation);
+    plane->normal = rotationT * plane->normal;
+  }
+  return local;
+}
+
+// same test as Sphere::isOnFrustum() in entity.h, without the virtual call per plane
+inline bool isSphereOnFrustum(const Frustum &frustum, const glm::vec3 &center, float radius)
+{
+  return frustum.leftFace.getSignedDistanceToPlane(center) > -radius &&
+         frustum.rightFace.getSignedDistanceToPlane(center) > -radius &&
+         frustum.nearFace.getSignedDistanceToPlane(center) > -radius &&
+         frustum.farFace.getSignedDistanceToPlane(center) > -radius &&
+         frustum.topFace.getSignedDistanceToPlane(center) > -radius &&
+         frustum.bottomFace.getSignedDistanceToPlane(center) > -radius;
+}
+
+// star indices sorted into a fixed number of buckets by parallel workers. Each worker owns one list
+// per bucket, so nothing is shared while sorting; upload() then gathers the instance records bucket
+// by bucket, again in parallel, straight into a mapped streaming buffer that is orphaned every frame.
+class StarBuckets
+{
+public:
+  // prepares empty lists for the given number of workers (see parallelThreadCount()) and buckets
+  void reset(unsigned int workerCount, unsigned int bucketCount)
+  {
+    workers = workerCount;
+    buckets = bucketCount;
+    lists.resize(static_cast<size_t>(workers) * buckets);
+    for (std::vector<uint32_t> &list : lists)
+      list.clear();
+  }
+
+  std::vector<uint32_t> &list(unsigned int worker, unsigned int bucket)
+  {
+    return lists[static_cast<size_t>(bucket) * workers + worker];
+  }
+
+  // lays the buckets out one after another, each in worker (and therefore star) order
+  void finish()
+  {
+    offsets.resize(lists.size());
+    firsts.assign(buckets, 0);
+    counts.assign(buckets, 0);
+    uint32_t offset = 0;
+    for (unsigned int b = 0; b < buckets; ++b)
+    {
+      firsts[b] = offset;
+      for (unsigned int w = 0; w < workers; ++w)
+      {
+        offsets[static_cast<size_t>(b) * workers + w] = offset;
+        offset += static_cast<uint32_t>(list(w, b).size());
+      }
+      counts[b] = offset - firsts[b];
+    }
+    totalCount = offset;
+  }
+
+  uint32_t first(unsigned int bucket) const
+  {
+    return firsts[bucket];
+  }
+
+  uint32_t count(unsigned int bucket) const
+  {
+    return counts[bucket];
+  }
+
+  uint32_t total() const
+  {
+    return totalCount;
+  }
+
+  // copies the sorted records (stride bytes each, indexed like the stars) into buffer. Indices at or
+  // above extraBase read record (index - extraBase) of extra instead, e.g. octree cluster aggregates.
+  void upload(unsigned int buffer, const unsigned char *instances, size_t stride, const unsigned char *extra = NULL, uint32_t extraBase = 0)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    size_t bytes = std::max<size_t>(1, static_cast<size_t>(totalCount) * stride);
+    glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+    if (totalCount == 0)
+      return;
+    unsigned char *mapped = static_cast<unsigned char *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    if (mapped == NULL)
+      return;
+    gather(mapped, instances, stride, extra, extraBase);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+  }
+
+  // the copy behind upload(), into any memory with room for total() records
+  void gather(unsigned char *out, const unsigned char *instances, size_t stride, const unsigned char *extra = NULL, uint32_t extraBase = 0)
+  {
+    parallelTasks(workers, [&](unsigned int worker) {
+      for (unsigned int b = 0; b < buckets; ++b)
+      {
+        unsigned char *record = out + static_cast<size_t>(offsets[static_cast<size_t>(b) * workers + worker]) * stride;
+        for (uint32_t index : list(worker, b))
+        {
+          const unsigned char *source = extra != NULL && index >= extraBase ? extra + static_cast<size_t>(index - extraBase) * stride
+                                                                            : instances + static_cast<size_t>(index) * stride;
+          std::memcpy(record, source, stride);
+          record += stride;
+        }
+      }
+    });
+  }
+
+private:
+  unsigned int workers = 0;
+  unsigned int buckets = 0;
+  std::vector<std::vector<uint32_t>> lists;
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> firsts;
+  std::vector<uint32_t> counts;
+  uint32_t totalCount = 0;
+};
+
+// CPU culling: every worker tests its slice of the stars and keeps the visible ones in a single bucket
+class StarCuller
+{
+public:
+  CullStats stats;
+
+  // stars is the float array from generateGalaxy(); frustum must already be in galaxy space
+  void cull(const std::vector<float> &stars, const Frustum &frustum, float starRadius, unsigned int threadCount = 0)
+  {
+    auto start = std::chrono::steady_clock::now();
+    uint32_t numStars = static_cast<uint32_t>(stars.size() / GALAXY_FLOATS_PER_STAR);
+    visible.reset(parallelThreadCount(numStars, threadCount), 1);
+    parallelFor(numStars, threadCount, [&](uint32_t begin, uint32_t end, unsigned int worker) {
+      std::vector<uint32_t> &list = visible.list(worker, 0);
+      for (uint32_t i = begin; i < end; ++i)
+      {
+        const float *star = &stars[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+        if (isSphereOnFrustum(frustum, glm::vec3(star[0], star[1], star[2]), starRadius))
+          list.push_back(i);
+      }
+    });
+    visible.finish();
+
+    stats.total = numStars;
+    stats.visible = visible.total();
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // copies the visible records (stride bytes each, indexed like the stars) into buffer and returns how many there are
+  uint32_t upload(unsigned int buffer, const unsigned char *instances, size_t stride)
+  {
+    visible.upload(buffer, instances, stride);
+    return stats.visible;
+  }
+
+  // upload() into plain memory, e.g. to time the copy without a GL context
+  uint32_t gather(unsigned char *out, const unsigned char *instances, size_t stride)
+  {
+    visible.gather(out, instances, stride);
+    return stats.visible;
+  }
+
+private:
+  StarBuckets visible;
+};
+
+// GPU culling (needs OpenGL 4.3): assignment_2_cull.cs tests every star and appends the visible
+// records to an output buffer, counting them straight into the instanceCount of an indirect draw
+// command, so the visible set never travels back to the CPU.
+class GpuStarCuller
+{
+public:
+  CullStats stats;
+
+  GpuStarCuller(const char *computePath) : shader(computePath)
+  {
+    glGenBuffers(1, &visibleBuffer);
+    glGenBuffers(1, &commandBuffer);
+  }
+
+  ~GpuStarCuller()
+  {
+    glDeleteBuffers(1, &visibleBuffer);
+    glDeleteBuffers(1, &commandBuffer);
+  }
+
+  static bool isSupported()
+  {
+    return GLAD_GL_VERSION_4_3 != 0;
+  }
+
+  // instanceBuffer holds numStars records in the given layout; the compacted output has the same layout
+  void setInstances(unsigned int instanceBuffer, uint32_t numStars, StarInstanceFormat format, float positionScale)
+  {
+    instances = instanceBuffer;
+    stats.total = numStars;
+    recordWords = static_cast<int>(starInstanceStride(format) / sizeof(uint32_t));
+    scale = positionScale;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(1, numStars * starInstanceStride(format)), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  }
+
+  // switches the input to another buffer holding the same records, e.g. the one moving stars were just written to
+  void setInstanceBuffer(unsigned int instanceBuffer)
+  {
+    instances = instanceBuffer;
+  }
+
+  unsigned int outputBuffer() const
+  {
+    return visibleBuffer;
+  }
+
+  // frustum must already be in galaxy space; indexCount is the index count of the mesh drawn per star
+  void cull(const Frustum &frustum, float starRadius, unsigned int indexCount)
+  {
+    DrawElementsIndirectCommand command = {indexCount, 0, 0, 0, 0};
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(command), &command, GL_DYNAMIC_DRAW);
+
+    const Plane *planes[6] = {&frustum.leftFace, &frustum.rightFace, &frustum.nearFace, &frustum.farFace, &frustum.topFace, &frustum.bottomFace};
+    shader.use();
+    for (int k = 0; k < 6; ++k)
+      shader.setVec4("planes[" + std::to_string(k) + "]", glm::vec4(planes[k]->normal, planes[k]->distance));
+    glUniform1ui(glGetUniformLocation(shader.ID, "numStars"), stats.total);
+    shader.setInt("recordWords", recordWords);
+    shader.setFloat("positionScale", scale);
+    shader.setFloat("starRadius", starRadius);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instances);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+    unsigned int groups = std::min<unsigned int>(65535, (stats.total + 255) / 256);
+    glDispatchCompute(std::max(1u, groups), 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+  }
+
+  // draws the visible stars with the currently bound VAO, whose instance attributes read outputBuffer()
+  // and whose element buffer holds indexType indices
+  void draw(GLenum indexType = GL_UNSIGNED_INT) const
+  {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glDrawElementsIndirect(GL_TRIANGLES, indexType, 0);
+  }
+
+  // reads the visible counter back; this waits for the GPU, so only call it when the stats are reported
+  uint32_t readVisibleCount()
+  {
+    DrawElementsIndirectCommand command;
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(command), &command);
+    stats.visible = command.instanceCount;
+    return stats.visible;
+  }
+
+private:
+  struct DrawElementsIndirectCommand
+  {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+  };
+
+  ComputeShader shader;
+  unsigned int instances = 0;
+  unsigned int visibleBuffer = 0;
+  unsigned int commandBuffer = 0;
+  int recordWords = 6;
+  float scale = 1.0f;
+};
+#endif
@@ -0,0 +1,156 @@
+#ifndef STAR_INSTANCES_H
+#define STAR_INSTANCES_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "galaxy.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// per-instance layouts for the star buffer, see the attribute notes in assignment_2.vs
+enum StarInstanceFormat
+{
+  STAR_FORMAT_FLOAT,  // 24 bytes: vec3 position + vec3 color
+  STAR_FORMAT_PACKED  // 12 bytes: snorm16 position relative to the galaxy radius + rgba8 color
+};
+
+// where the vertex shader gets each star from
+enum StarSource
+{
+  STAR_SOURCE_BUFFER,    // instance attributes filled from generateGalaxy()
+  STAR_SOURCE_PROCEDURAL // rebuilt from gl_InstanceID and the seed, no per-star memory at all
+};
+
+// how every star is drawn
+enum StarRenderMode
+{
+  STAR_RENDER_SPHERES, // instanced sphere meshes, depth tested
+  STAR_RENDER_POINTS   // one point sprite per star, blended additively without depth writes
+};
+
+struct PackedStar
+{
+  int16_t position[4]; // x, y, z, unused
+  uint8_t color[4];    // r, g, b, brightness exponent (255 for every star, see packStarBrightness())
+};
+
+// log2 of the largest brightness factor the packed layout can carry
+const float STAR_PACKED_BRIGHTNESS_RANGE = 32.0f;
+
+inline StarInstanceFormat parseStarInstanceFormat(const std::string &name)
+{
+  return name == "packed" ? STAR_FORMAT_PACKED : STAR_FORMAT_FLOAT;
+}
+
+inline StarSource parseStarSource(const std::string &name)
+{
+  return name == "procedural" ? STAR_SOURCE_PROCEDURAL : STAR_SOURCE_BUFFER;
+}
+
+inline StarRenderMode parseStarRenderMode(const std::string &name)
+{
+  return name == "points" ? STAR_RENDER_POINTS : STAR_RENDER_SPHERES;
+}
+
+inline size_t starInstanceStride(StarInstanceFormat format)
+{
+  return format == STAR_FORMAT_PACKED ? sizeof(PackedStar) : GALAXY_FLOATS_PER_STAR * sizeof(float);
+}
+
+// value the shader multiplies instancePos by to get back to galaxy space
+inline float starPositionScale(StarInstanceFormat format, float radius)
+{
+  return format == STAR_FORMAT_PACKED ? radius : 1.0f;
+}
+
+inline int16_t packSnorm16(float v)
+{
+  return static_cast<int16_t>(std::lround(glm::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+inline uint8_t packUnorm8(float v)
+{
+  return static_cast<uint8_t>(std::lround(glm::clamp(v, 0.0f, 1.0f) * 255.0f));
+}
+
+inline PackedStar packStar(const float *star, float invScale)
+{
+  PackedStar packed;
+  packed.position[0] = packSnorm16(star[0] * invScale);
+  packed.position[1] = packSnorm16(star[1] * invScale);
+  packed.position[2] = packSnorm16(star[2] * invScale);
+  packed.position[3] = 0;
+  packed.color[0] = packUnorm8(star[3]);
+  packed.color[1] = packUnorm8(star[4]);
+  packed.color[2] = packUnorm8(star[5]);
+  packed.color[3] = 255;
+  return packed;
+}
+
+// An octree cluster drawn additively shines with the summed light of its stars. The float layout scales
+// its color; the packed color saturates at 1, so its fourth byte keeps the factor as an exponent, which
+// assignment_2.vs turns back into exp2((1 - a) * STAR_PACKED_BRIGHTNESS_RANGE). A single star (255) gets 1.
+inline uint8_t packStarBrightness(float brightness)
+{
+  return packUnorm8(1.0f - std::log2(std::max(1.0f, brightness)) / STAR_PACKED_BRIGHTNESS_RANGE);
+}
+
+// converts the float star array from generateGalaxy() into the packed layout, positions relative to radius
+inline void packStars(const std::vector<float> &vertices, float radius, std::vector<PackedStar> &packed, unsigned int threadCount = 0)
+{
+  uint32_t numStars = static_cast<uint32_t>(vertices.size() / GALAXY_FLOATS_PER_STAR);
+  packed.resize(numStars);
+  const float invScale = 1.0f / radius;
+  parallelFor(numStars, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+    for (uint32_t i = begin; i < end; ++i)
+      packed[i] = packStar(&vertices[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR], invScale);
+  });
+}
+
+// the reverse of packStars(), for CPU passes over stars that only exist in the packed layout (e.g. a
+// packed snapshot); positions come back within radius / 32767 of the originals
+inline void unpackStars(const PackedStar *packed, uint32_t numStars, float radius, std::vector<float> &vertices, unsigned int threadCount = 0)
+{
+  vertices.resize(static_cast<size_t>(numStars) * GALAXY_FLOATS_PER_STAR);
+  const float positionScale = radius / 32767.0f;
+  parallelFor(numStars, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+    for (uint32_t i = begin; i < end; ++i)
+    {
+      float *star = &vertices[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+      for (int k = 0; k < 3; ++k)
+      {
+        star[k] = std::max(-32767, static_cast<int>(packed[i].position[k])) * positionScale;
+        star[3 + k] = packed[i].color[k] / 255.0f;
+      }
+    }
+  });
+}
+
+// points instance attributes 1 (position) and 2 (color) at the buffer bound to GL_ARRAY_BUFFER,
+// advancing once per instance (divisor 0: once per vertex, for point sprites) and starting offset
+// bytes in. The packed layout is expanded by the normalized fetch, so the shader sees the same
+// vectors either way and only positionScale differs.
+inline void setupStarInstanceAttributes(StarInstanceFormat format, size_t offset = 0, GLuint divisor = 1)
+{
+  if (format == STAR_FORMAT_PACKED)
+  {
+    glVertexAttribPointer(1, 3, GL_SHORT, GL_TRUE, sizeof(PackedStar), (void *)(offset + offsetof(PackedStar, position)));
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedStar), (void *)(offset + offsetof(PackedStar, color)));
+  }
+  else
+  {
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)offset);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)(offset + 3 * sizeof(float)));
+  }
+  glEnableVertexAttribArray(1);
+  glVertexAttribDivisor(1, divisor);
+  glEnableVertexAttribArray(2);
+  glVertexAttribDivisor(2, divisor);
+}
+#endif
@@ -0,0 +1,254 @@
+#ifndef STAR_LOD_H
+#define STAR_LOD_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader_m.h>
+
+#include "sphere_mesh.h"
+#include "star_culling.h"
+#include "star_instances.h"
+
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+// error, in pixels, a level may show at the silhouette before the next finer level takes over. Half a
+// pixel is below what rasterization can resolve, so switching levels never visibly pops.
+const float STAR_LOD_MAX_PIXEL_ERROR = 0.5f;
+
+// one level of the chain: the point sprite, a UV sphere (sectors x stacks) or an icosphere (subdivisions);
+// the sphere meshes share one vertex and index buffer (SphereMeshBuffer)
+struct StarLodLevel
+{
+  int sectors = 0;
+  int stacks = 0;
+  int subdivisions = -1; // >= 0 for an icosphere
+  int baseVertex = 0;
+  unsigned int firstIndex = 0;
+  unsigned int indexCount = 0;
+  float maxPixelRadius = 0.0f; // projected radius up to which this level is used, infinite for the finest
+
+  bool isSprite() const
+  {
+    return sectors == 0 && subdivisions < 0;
+  }
+
+  bool sameMesh(const StarLodLevel &other) const
+  {
+    return sectors == other.sectors && stacks == other.stacks && subdivisions == other.subdivisions;
+  }
+
+  std::string name() const
+  {
+    if (subdivisions >= 0)
+      return "ico" + std::to_string(subdivisions);
+    return isSprite() ? "points" : std::to_string(sectors) + "x" + std::to_string(stacks);
+  }
+
+  SphereMesh mesh(float radius) const
+  {
+    return subdivisions >= 0 ? generateIcosphere(radius, subdivisions) : generateUvSphere(radius, sectors, stacks);
+  }
+};
+
+// a UV sphere with n sectors and m stacks is inscribed in the true sphere; its silhouette sits at most
+// R * (1 - cos(a / 2)) inside it, a being the larger of the sector and stack angles. The level is good
+// enough while that stays under STAR_LOD_MAX_PIXEL_ERROR.
+inline float starLodMaxPixelRadius(int sectors, int stacks)
+{
+  const float pi = 3.14159265358979323846f;
+  float halfAngle = std::max(pi / sectors, pi / (2.0f * stacks));
+  return STAR_LOD_MAX_PIXEL_ERROR / (1.0f - std::cos(halfAngle));
+}
+
+// An icosphere has no two angles to take the larger of, so its error is measured on the mesh itself: the
+// deepest a face plane sits inside the unit sphere.
+inline float starLodMaxPixelRadius(int subdivisions)
+{
+  SphereMesh mesh = generateIcosphere(1.0f, subdivisions);
+  float nearest = 1.0f;
+  for (size_t f = 0; f < mesh.indices.size(); f += 3)
+  {
+    glm::vec3 p[3];
+    for (int k = 0; k < 3; ++k)
+      p[k] = glm::vec3(mesh.vertices[3 * mesh.indices[f + k]], mesh.vertices[3 * mesh.indices[f + k] + 1], mesh.vertices[3 * mesh.indices[f + k] + 2]);
+    nearest = std::min(nearest, glm::dot(glm::normalize(glm::cross(p[1] - p[0], p[2] - p[0])), p[0]));
+  }
+  return STAR_LOD_MAX_PIXEL_ERROR / (1.0f - nearest);
+}
+
+// the mesh every star gets when LOD is off: the 12x8 sphere, or the icosphere at least as round
+inline StarLodLevel defaultStarSphere(SphereShape shape)
+{
+  StarLodLevel level;
+  if (shape == SPHERE_ICO)
+  {
+    level.subdivisions = 2;
+  }
+  else
+  {
+    level.sectors = 12;
+    level.stacks = 8;
+  }
+  return level;
+}
+
+// coarsest to finest: a point sprite below one pixel of radius, then spheres from 4x3 up to 24x16, or
+// icospheres from 0 to 3 subdivisions. The UV sphere counts follow the shape of the silhouette error, each
+// level roughly doubling the sectors; each icosphere level has four times the triangles of the last.
+inline std::vector<StarLodLevel> defaultStarLodLevels(SphereShape shape = SPHERE_UV)
+{
+  std::vector<StarLodLevel> levels(1);
+  levels[0].maxPixelRadius = 1.0f;
+  if (shape == SPHERE_ICO)
+  {
+    for (int subdivisions = 0; subdivisions <= 3; ++subdivisions)
+    {
+      StarLodLevel level;
+      level.subdivisions = subdivisions;
+      level.maxPixelRadius = starLodMaxPixelRadius(subdivisions);
+      levels.push_back(level);
+    }
+  }
+  else
+  {
+    const int shapes[][2] = {{4, 3}, {6, 4}, {12, 8}, {24, 16}};
+    for (const int *uv : shapes)
+    {
+      StarLodLevel level;
+      level.sectors = uv[0];
+      level.stacks = uv[1];
+      level.maxPixelRadius = starLodMaxPixelRadius(level.sectors, level.stacks);
+      levels.push_back(level);
+    }
+  }
+  levels.back().maxPixelRadius = INFINITY;
+  return levels;
+}
+
+// picks a level per star from its projected radius, optionally culling against the frustum in the
+// same pass, and draws each level with one instanced call
+class StarLod
+{
+public:
+  CullStats stats;
+  std::vector<StarLodLevel> levels;
+  StarBuckets buckets; // one bucket per level, filled by select() or StarOctree::select()
+  GLenum indexType = GL_UNSIGNED_INT; // of the shared index buffer, see SphereMeshBuffer
+
+  explicit StarLod(SphereShape shape = SPHERE_UV) : levels(defaultStarLodLevels(shape))
+  {
+  }
+
+  // pixels per unit of size at distance 1 for a viewport viewportHeight pixels high
+  static float projectionScale(float fovY, float viewportHeight)
+  {
+    return 0.5f * viewportHeight / std::tan(0.5f * fovY);
+  }
+
+  // A star of radius R at distance d covers R * projScale / d pixels, so every level boundary becomes a
+  // distance, kept squared so levelFor() needs no square root
+  void prepare(float projScale, float starRadius)
+  {
+    minDistance2.resize(levels.size());
+    for (unsigned int l = 0; l < levels.size(); ++l)
+    {
+      float d = starRadius * projScale / levels[l].maxPixelRadius;
+      minDistance2[l] = d * d;
+    }
+  }
+
+  // level for a star at squared distance distance2 from the eye; needs prepare()
+  unsigned int levelFor(float distance2) const
+  {
+    unsigned int l = 0;
+    while (l + 1 < minDistance2.size() && distance2 < minDistance2[l])
+      ++l;
+    return l;
+  }
+
+  // stars is the float array from generateGalaxy(); eye and frustum (when given) must be in galaxy space
+  void select(const std::vector<float> &stars, const glm::vec3 &eye, float projScale, float starRadius, const Frustum *frustum, unsigned int threadCount = 0)
+  {
+    auto start = std::chrono::steady_clock::now();
+    prepare(projScale, starRadius);
+    const unsigned int levelCount = static_cast<unsigned int>(levels.size());
+
+    uint32_t numStars = static_cast<uint32_t>(stars.size() / GALAXY_FLOATS_PER_STAR);
+    buckets.reset(parallelThreadCount(numStars, threadCount), levelCount);
+    parallelFor(numStars, threadCount, [&](uint32_t begin, uint32_t end, unsigned int worker) {
+      for (uint32_t i = begin; i < end; ++i)
+      {
+        const float *star = &stars[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+        glm::vec3 center(star[0], star[1], star[2]);
+        if (frustum && !isSphereOnFrustum(*frustum, center, starRadius))
+          continue;
+        glm::vec3 toStar = center - eye;
+        buckets.list(worker, levelFor(glm::dot(toStar, toStar))).push_back(i);
+      }
+    });
+    buckets.finish();
+
+    stats.total = numStars;
+    stats.visible = buckets.total();
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // copies the selected records into buffer, grouped by level (see StarBuckets::upload() for extra)
+  void upload(unsigned int buffer, const unsigned char *instances, size_t stride, const unsigned char *extra = NULL, uint32_t extraBase = 0)
+  {
+    buckets.upload(buffer, instances, stride, extra, extraBase);
+  }
+
+  // draws every level from the current VAO, whose attribute 0 is the shared sphere mesh and whose
+  // instance attributes read the buffer passed to upload(). The sprite level disables attribute 0
+  // (aPos then reads as the origin) and sets pointSprite so the shaders size and round the point.
+  void draw(Shader &shader, StarInstanceFormat format)
+  {
+    const size_t stride = starInstanceStride(format);
+    for (unsigned int l = 0; l < levels.size(); ++l)
+    {
+      uint32_t count = buckets.count(l);
+      if (count == 0)
+        continue;
+      setupStarInstanceAttributes(format, static_cast<size_t>(buckets.first(l)) * stride);
+      const StarLodLevel &level = levels[l];
+      if (level.isSprite())
+      {
+        shader.setBool("pointSprite", true);
+        glDisableVertexAttribArray(0);
+        glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+        glEnableVertexAttribArray(0);
+        shader.setBool("pointSprite", false);
+      }
+      else
+      {
+        const size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, level.indexCount, indexType,
+                                          (void *)(level.firstIndex * indexSize), count, level.baseVertex);
+      }
+    }
+    setupStarInstanceAttributes(format);
+  }
+
+  uint32_t count(unsigned int level) const
+  {
+    return buckets.count(level);
+  }
+
+  // triangles submitted by the last select(), points counting as none
+  uint64_t triangles() const
+  {
+    uint64_t total = 0;
+    for (unsigned int l = 0; l < levels.size(); ++l)
+      total += static_cast<uint64_t>(buckets.count(l)) * (levels[l].indexCount / 3);
+    return total;
+  }
+
+private:
+  std::vector<float> minDistance2;
+};
+#endif
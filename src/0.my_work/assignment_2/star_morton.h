@@ -0,0 +1,196 @@
+#ifndef STAR_MORTON_H
+#define STAR_MORTON_H
+
+#include "galaxy.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// true when ids holds every value below count exactly once, i.e. it is an order of count stars
+inline bool isStarPermutation(const uint32_t *ids, uint32_t count)
+{
+  std::vector<bool> seen(count, false);
+  for (uint32_t slot = 0; slot < count; ++slot)
+  {
+    if (ids[slot] >= count || seen[ids[slot]])
+      return false;
+    seen[ids[slot]] = true;
+  }
+  return true;
+}
+
+// bits per axis of the Morton code; 3 x 10 bits fit a 32-bit key, so the radix sort needs four passes
+const unsigned int STAR_MORTON_BITS = 10;
+
+// spreads the low 10 bits of v so that two zero bits follow each one
+inline uint32_t mortonSpread3(uint32_t v)
+{
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+// interleaves three 10-bit cell coordinates into a 30-bit code, x in the lowest bit
+inline uint32_t mortonCode3(uint32_t x, uint32_t y, uint32_t z)
+{
+  return mortonSpread3(x) | (mortonSpread3(y) << 1) | (mortonSpread3(z) << 2);
+}
+
+// Morton code of a position inside the cube [-radius, radius]^3. The cube is the same for every axis,
+// like the octree's root box, so the curve walks cells that are cubes; the thin disc then only uses a
+// few of the y levels, which is what keeps neighbours on the curve neighbours in space.
+inline uint32_t starMortonCode(const float *position, float radius)
+{
+  const float cells = static_cast<float>(1u << STAR_MORTON_BITS);
+  const float scale = cells / (2.0f * radius);
+  uint32_t cell[3];
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    float c = (position[axis] + radius) * scale;
+    cell[axis] = static_cast<uint32_t>(std::min(cells - 1.0f, std::max(0.0f, c)));
+  }
+  return mortonCode3(cell[0], cell[1], cell[2]);
+}
+
+// stable LSD radix sort of keys, carrying values along, 8 bits per pass. Every worker counts the digits
+// of its own contiguous slice, one prefix sum over (digit, worker) gives each worker its output ranges,
+// and the scatter then writes without any sharing. Passes where every key has the same digit are skipped.
+inline unsigned int radixSortByKey(std::vector<uint32_t> &keys, std::vector<uint32_t> &values, unsigned int bits = 32, unsigned int threadCount = 0)
+{
+  const uint32_t count = static_cast<uint32_t>(keys.size());
+  const unsigned int workers = parallelThreadCount(count, threadCount);
+  const uint32_t chunk = (count + workers - 1) / workers;
+  std::vector<uint32_t> keysOut(count), valuesOut(count);
+  std::vector<uint32_t> offsets(static_cast<size_t>(256) * workers);
+
+  for (unsigned int shift = 0; shift < bits; shift += 8)
+  {
+    std::fill(offsets.begin(), offsets.end(), 0);
+    parallelTasks(workers, [&](unsigned int worker) {
+      uint32_t *histogram = &offsets[static_cast<size_t>(worker) * 256];
+      uint32_t end = std::min(count, (worker + 1) * chunk);
+      for (uint32_t i = worker * chunk; i < end; ++i)
+        ++histogram[(keys[i] >> shift) & 0xff];
+    });
+
+    // digit-major, worker-minor: equal digits keep their slice order, which keeps the sort stable
+    uint32_t offset = 0;
+    bool sorted = false;
+    for (unsigned int digit = 0; digit < 256; ++digit)
+    {
+      uint32_t digitCount = 0;
+      for (unsigned int worker = 0; worker < workers; ++worker)
+      {
+        uint32_t &slot = offsets[static_cast<size_t>(worker) * 256 + digit];
+        uint32_t n = slot;
+        slot = offset;
+        offset += n;
+        digitCount += n;
+      }
+      sorted = sorted || digitCount == count;
+    }
+    if (sorted)
+      continue;
+
+    parallelTasks(workers, [&](unsigned int worker) {
+      uint32_t *next = &offsets[static_cast<size_t>(worker) * 256];
+      uint32_t end = std::min(count, (worker + 1) * chunk);
+      for (uint32_t i = worker * chunk; i < end; ++i)
+      {
+        uint32_t slot = next[(keys[i] >> shift) & 0xff]++;
+        keysOut[slot] = keys[i];
+        valuesOut[slot] = values[i];
+      }
+    });
+    keys.swap(keysOut);
+    values.swap(valuesOut);
+  }
+  return workers;
+}
+
+struct StarMortonStats
+{
+  unsigned int threads = 0;
+  double milliseconds = 0.0;
+};
+
+// Reorders the star array along a Morton curve, so stars that are close in space are close in memory.
+// Spatial passes (culling, LOD bucketing, the gathers that follow them) then touch memory in runs and the
+// GPU fetches neighbouring instances together. A star keeps its generation index as its id: ids maps a
+// storage slot to the id and slots maps back, so anything that names stars can stay stable.
+class StarMortonOrder
+{
+public:
+  StarMortonStats stats;
+  std::vector<uint32_t> ids;   // ids[slot] = generation index of the star stored at slot
+  std::vector<uint32_t> slots; // slots[id] = where the star generated as id is stored now
+
+  // sorts stars (the float array from generateGalaxy()) in place; radius bounds the galaxy
+  void sort(std::vector<float> &stars, float radius, unsigned int threadCount = 0)
+  {
+    auto start = std::chrono::steady_clock::now();
+    const uint32_t numStars = static_cast<uint32_t>(stars.size() / GALAXY_FLOATS_PER_STAR);
+
+    std::vector<uint32_t> keys(numStars);
+    ids.resize(numStars);
+    parallelFor(numStars, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+      for (uint32_t i = begin; i < end; ++i)
+      {
+        keys[i] = starMortonCode(&stars[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR], radius);
+        ids[i] = i;
+      }
+    });
+    stats.threads = radixSortByKey(keys, ids, 3 * STAR_MORTON_BITS, threadCount);
+
+    std::vector<float> sorted(stars.size());
+    slots.resize(numStars);
+    parallelFor(numStars, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+      for (uint32_t slot = begin; slot < end; ++slot)
+      {
+        const float *star = &stars[static_cast<size_t>(ids[slot]) * GALAXY_FLOATS_PER_STAR];
+        std::copy(star, star + GALAXY_FLOATS_PER_STAR, &sorted[static_cast<size_t>(slot) * GALAXY_FLOATS_PER_STAR]);
+        slots[ids[slot]] = slot;
+      }
+    });
+    stars.swap(sorted);
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // takes over an order stored elsewhere, e.g. the ids of a snapshot; false, leaving the stars unordered,
+  // when storedIds is not a permutation of the stars
+  bool assign(const uint32_t *storedIds, uint32_t numStars)
+  {
+    ids.clear();
+    slots.clear();
+    if (!isStarPermutation(storedIds, numStars))
+      return false;
+    ids.assign(storedIds, storedIds + numStars);
+    slots.resize(numStars);
+    for (uint32_t slot = 0; slot < numStars; ++slot)
+      slots[ids[slot]] = slot;
+    return true;
+  }
+
+  bool empty() const
+  {
+    return ids.empty();
+  }
+
+  // generation index of the star stored at slot; the identity when the stars were never sorted
+  uint32_t idOf(uint32_t slot) const
+  {
+    return ids.empty() ? slot : ids[slot];
+  }
+
+  uint32_t slotOf(uint32_t id) const
+  {
+    return slots.empty() ? id : slots[id];
+  }
+};
+#endif
@@ -0,0 +1,416 @@
+#ifndef STAR_MOTION_H
+#define STAR_MOTION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader_c.h>
+
+#include "galaxy.h"
+#include "parallel.h"
+#include "star_instances.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+enum StarMotionMode
+{
+  STAR_MOTION_RIGID,        // the whole galaxy turns through the model matrix
+  STAR_MOTION_DIFFERENTIAL, // every star orbits the center at a speed set by its radius
+  STAR_MOTION_NBODY,        // Barnes-Hut gravity between all stars, see star_nbody.h
+  STAR_MOTION_KINETIC       // the stars become spheres of a motor-driven kinetic sculpture, see kinetic_sculpture.h
+};
+
+// where differential motion is computed
+enum StarMotionPath
+{
+  STAR_MOTION_CPU, // worker threads with the galaxy SIMD kernels, written into mapped instance buffers
+  STAR_MOTION_GPU  // assignment_2_motion.cs rewrites the instance buffer in place (OpenGL 4.3)
+};
+
+inline StarMotionMode parseStarMotionMode(const std::string &name)
+{
+  if (name == "differential")
+    return STAR_MOTION_DIFFERENTIAL;
+  if (name == "nbody")
+    return STAR_MOTION_NBODY;
+  if (name == "kinetic")
+    return STAR_MOTION_KINETIC;
+  return STAR_MOTION_RIGID;
+}
+
+inline StarMotionPath parseStarMotionPath(const std::string &name)
+{
+  return name == "gpu" ? STAR_MOTION_GPU : STAR_MOTION_CPU;
+}
+
+// flat rotation curve with a solid-body core: orbital velocity rises linearly up to about coreRadius
+// and stays near speed beyond it, so inner stars lap the outer ones and the arms wind up over time.
+// With the defaults the rim turns at roughly the 0.6 degrees/sec of the rigid mode.
+struct RotationCurve
+{
+  float speed = 0.1f; // units/sec
+  float coreRadius = 1.0f;
+};
+
+inline float orbitalAngularSpeed(const RotationCurve &curve, float radius)
+{
+  return curve.speed / std::sqrt(radius * radius + curve.coreRadius * curve.coreRadius);
+}
+
+struct MotionStats
+{
+  GalaxyKernel kernel = GALAXY_KERNEL_SCALAR;
+  unsigned int threads = 0;
+  double milliseconds = 0.0;
+};
+
+// per-star circular orbits around the galaxy's y axis. Only x and z change, so an update rewrites just
+// those fields of each instance record and leaves y and the color where they are.
+class StarMotion
+{
+public:
+  MotionStats stats;
+
+  // takes the orbits from the float star array of generateGalaxy(); arrays are padded to whole batches
+  void init(const std::vector<float> &stars, const RotationCurve &curve, GalaxyKernel kernel = GALAXY_KERNEL_AUTO)
+  {
+    numStars = static_cast<uint32_t>(stars.size() / GALAXY_FLOATS_PER_STAR);
+    stats.kernel = resolveGalaxyKernel(kernel);
+    size_t padded = (static_cast<size_t>(numStars) + GALAXY_BATCH - 1) / GALAXY_BATCH * GALAXY_BATCH;
+    radius.assign(padded, 0.0f);
+    phase.assign(padded, 0.0f);
+    omega.assign(padded, 0.0f);
+    for (uint32_t i = 0; i < numStars; ++i)
+    {
+      const float *star = &stars[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+      radius[i] = std::sqrt(star[0] * star[0] + star[2] * star[2]);
+      phase[i] = std::atan2(star[2], star[0]);
+      omega[i] = orbitalAngularSpeed(curve, radius[i]);
+    }
+  }
+
+  uint32_t size() const
+  {
+    return numStars;
+  }
+
+  // vec4 per star for assignment_2_motion.cs: radius, phase at time 0, angular speed, unused
+  std::vector<float> orbitData() const
+  {
+    std::vector<float> data(static_cast<size_t>(numStars) * 4);
+    for (uint32_t i = 0; i < numStars; ++i)
+    {
+      data[i * 4 + 0] = radius[i];
+      data[i * 4 + 1] = phase[i];
+      data[i * 4 + 2] = omega[i];
+      data[i * 4 + 3] = 0.0f;
+    }
+    return data;
+  }
+
+  // writes every star's x and z at time into the records at out (float or packed layout, packed
+  // positions relative to positionScale). Worker slices are whole batches, as in generateGalaxy().
+  void update(float time, unsigned char *out, StarInstanceFormat format, float positionScale, unsigned int threadCount = 0)
+  {
+    auto start = std::chrono::steady_clock::now();
+    const GalaxyKernel kernel = stats.kernel;
+    stats.threads = parallelFor(numStars, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+      alignas(32) float x[GALAXY_BATCH];
+      alignas(32) float z[GALAXY_BATCH];
+      const float invScale = 1.0f / positionScale;
+      for (uint32_t first = begin; first < end; first += GALAXY_BATCH)
+      {
+        orbitBatch(kernel, first, time, x, z);
+        unsigned int count = std::min<uint32_t>(GALAXY_BATCH, end - first);
+        if (format == STAR_FORMAT_PACKED)
+        {
+          PackedStar *star = reinterpret_cast<PackedStar *>(out) + first;
+          for (unsigned int lane = 0; lane < count; ++lane, ++star)
+          {
+            star->position[0] = packSnorm16(x[lane] * invScale);
+            star->position[2] = packSnorm16(z[lane] * invScale);
+          }
+        }
+        else
+        {
+          float *star = reinterpret_cast<float *>(out) + static_cast<size_t>(first) * GALAXY_FLOATS_PER_STAR;
+          for (unsigned int lane = 0; lane < count; ++lane, star += GALAXY_FLOATS_PER_STAR)
+          {
+            star[0] = x[lane];
+            star[2] = z[lane];
+          }
+        }
+      }
+    }, GALAXY_BATCH);
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // largest x/z difference between a kernel and the scalar path over every star at time, in units
+  // of the orbit radius; the SIMD sin/cos stay within GALAXY_SINCOS_MAX_ERROR
+  float checkKernel(GalaxyKernel kernel, float time)
+  {
+    float maxError = 0.0f;
+    alignas(32) float x[GALAXY_BATCH], z[GALAXY_BATCH], xRef[GALAXY_BATCH], zRef[GALAXY_BATCH];
+    for (uint32_t first = 0; first < numStars; first += GALAXY_BATCH)
+    {
+      orbitBatch(kernel, first, time, x, z);
+      orbitBatch(GALAXY_KERNEL_SCALAR, first, time, xRef, zRef);
+      for (unsigned int lane = 0; lane < GALAXY_BATCH && first + lane < numStars; ++lane)
+      {
+        float r = std::max(radius[first + lane], 1.0f);
+        maxError = std::max(maxError, std::max(std::fabs(x[lane] - xRef[lane]), std::fabs(z[lane] - zRef[lane])) / r);
+      }
+    }
+    return maxError;
+  }
+
+private:
+  uint32_t numStars = 0;
+  std::vector<float> radius;
+  std::vector<float> phase;
+  std::vector<float> omega;
+
+  // angle = phase + omega * time, folded into [-pi, pi] so the sin/cos reduction stays accurate
+  static float orbitAngle(float phase, float omega, float time)
+  {
+    const float twoPi = 6.28318530717958647692f;
+    float angle = phase + omega * time;
+    return angle - twoPi * std::nearbyint(angle * (1.0f / twoPi));
+  }
+
+  void orbitBatch(GalaxyKernel kernel, uint32_t first, float time, float *x, float *z) const
+  {
+#ifdef GALAXY_SIMD_X86
+    if (kernel == GALAXY_KERNEL_AVX2)
+      return orbitBatchAVX2(first, time, x, z);
+    if (kernel == GALAXY_KERNEL_SSE41)
+      return orbitBatchSSE41(first, time, x, z);
+#endif
+    for (unsigned int lane = 0; lane < GALAXY_BATCH; ++lane)
+    {
+      float angle = orbitAngle(phase[first + lane], omega[first + lane], time);
+      x[lane] = radius[first + lane] * std::cos(angle);
+      z[lane] = radius[first + lane] * std::sin(angle);
+    }
+  }
+
+#ifdef GALAXY_SIMD_X86
+  GALAXY_TARGET("avx2") void orbitBatchAVX2(uint32_t first, float time, float *x, float *z) const
+  {
+    const __m256 twoPi = _mm256_set1_ps(6.28318530717958647692f);
+    __m256 angle = _mm256_add_ps(_mm256_loadu_ps(&phase[first]), _mm256_mul_ps(_mm256_loadu_ps(&omega[first]), _mm256_set1_ps(time)));
+    __m256 turns = _mm256_round_ps(_mm256_mul_ps(angle, _mm256_set1_ps(1.0f / 6.28318530717958647692f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    angle = _mm256_sub_ps(angle, _mm256_mul_ps(twoPi, turns));
+    __m256 s, c;
+    galaxySinCos8(angle, s, c);
+    __m256 r = _mm256_loadu_ps(&radius[first]);
+    _mm256_store_ps(x, _mm256_mul_ps(r, c));
+    _mm256_store_ps(z, _mm256_mul_ps(r, s));
+  }
+
+  GALAXY_TARGET("sse4.1") void orbitBatchSSE41(uint32_t first, float time, float *x, float *z) const
+  {
+    const __m128 twoPi = _mm_set1_ps(6.28318530717958647692f);
+    for (unsigned int half = 0; half < GALAXY_BATCH; half += 4)
+    {
+      __m128 angle = _mm_add_ps(_mm_loadu_ps(&phase[first + half]), _mm_mul_ps(_mm_loadu_ps(&omega[first + half]), _mm_set1_ps(time)));
+      __m128 turns = _mm_round_ps(_mm_mul_ps(angle, _mm_set1_ps(1.0f / 6.28318530717958647692f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+      angle = _mm_sub_ps(angle, _mm_mul_ps(twoPi, turns));
+      __m128 s, c;
+      galaxySinCos4(angle, s, c);
+      __m128 r = _mm_loadu_ps(&radius[first + half]);
+      _mm_store_ps(x + half, _mm_mul_ps(r, c));
+      _mm_store_ps(z + half, _mm_mul_ps(r, s));
+    }
+  }
+#endif
+};
+
+// writes the positions of previous blended towards current by alpha (both float star arrays, e.g. the two
+// states of a SimulationFrame) into the records at out, like StarMotion::update() does for one time
+inline void writeBlendedStarPositions(const std::vector<float> &previous, const std::vector<float> &current, float alpha, unsigned char *out,
+                                      StarInstanceFormat format, float positionScale, unsigned int threadCount = 0)
+{
+  const uint32_t numStars = static_cast<uint32_t>(current.size() / GALAXY_FLOATS_PER_STAR);
+  const float invScale = 1.0f / positionScale;
+  parallelFor(numStars, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+    for (uint32_t i = begin; i < end; ++i)
+    {
+      const float *from = &previous[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+      const float *to = &current[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+      if (format == STAR_FORMAT_PACKED)
+      {
+        PackedStar *star = reinterpret_cast<PackedStar *>(out) + i;
+        for (int k = 0; k < 3; ++k)
+          star->position[k] = packSnorm16((from[k] + (to[k] - from[k]) * alpha) * invScale);
+      }
+      else
+      {
+        float *star = reinterpret_cast<float *>(out) + static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR;
+        for (int k = 0; k < 3; ++k)
+          star[k] = from[k] + (to[k] - from[k]) * alpha;
+      }
+    }
+  });
+}
+
+// two instance buffers the CPU path writes into alternately, so the frame being filled never waits
+// for the draw still reading the other one. With OpenGL 4.4 both stay persistently mapped; older
+// contexts map the buffer unsynchronized each frame instead. A fence per buffer keeps the CPU from
+// overwriting it while a draw is still in flight. The buffers start out with full instance records,
+// so updates only ever touch positions.
+class StarMotionBuffers
+{
+public:
+  unsigned int buffers[2] = {0, 0};
+
+  static bool isPersistentSupported()
+  {
+    return GLAD_GL_VERSION_4_4 != 0;
+  }
+
+  ~StarMotionBuffers()
+  {
+    for (int k = 0; k < 2; ++k)
+    {
+      if (fences[k])
+        glDeleteSync(fences[k]);
+      if (persistent[k])
+      {
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[k]);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+      }
+    }
+    glDeleteBuffers(2, buffers);
+  }
+
+  void init(const unsigned char *records, size_t recordBytes)
+  {
+    bytes = std::max<size_t>(1, recordBytes);
+    persistentMapped = isPersistentSupported();
+    glGenBuffers(2, buffers);
+    for (int k = 0; k < 2; ++k)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, buffers[k]);
+      if (persistentMapped)
+      {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, bytes, records, flags);
+        persistent[k] = static_cast<unsigned char *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags));
+      }
+      else
+      {
+        glBufferData(GL_ARRAY_BUFFER, bytes, records, GL_STREAM_DRAW);
+      }
+    }
+  }
+
+  bool isPersistent() const
+  {
+    return persistentMapped;
+  }
+
+  // waits until the GPU is done with the current buffer and returns where to write its records
+  unsigned char *beginWrite()
+  {
+    if (fences[current])
+    {
+      glClientWaitSync(fences[current], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+      glDeleteSync(fences[current]);
+      fences[current] = 0;
+    }
+    if (persistentMapped)
+      return persistent[current];
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[current]);
+    return static_cast<unsigned char *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+  }
+
+  // returns the buffer to draw from this frame
+  unsigned int endWrite()
+  {
+    if (!persistentMapped)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, buffers[current]);
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    return buffers[current];
+  }
+
+  int currentIndex() const
+  {
+    return current;
+  }
+
+  // call once every draw reading the current buffer has been issued
+  void frameDone()
+  {
+    fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    current ^= 1;
+  }
+
+private:
+  GLsync fences[2] = {0, 0};
+  unsigned char *persistent[2] = {NULL, NULL};
+  size_t bytes = 0;
+  bool persistentMapped = false;
+  int current = 0;
+};
+
+// GPU path (needs OpenGL 4.3): assignment_2_motion.cs rewrites x and z of every record in place
+class GpuStarMotion
+{
+public:
+  GpuStarMotion(const char *computePath) : shader(computePath)
+  {
+    glGenBuffers(1, &orbitBuffer);
+  }
+
+  ~GpuStarMotion()
+  {
+    glDeleteBuffers(1, &orbitBuffer);
+  }
+
+  static bool isSupported()
+  {
+    return GLAD_GL_VERSION_4_3 != 0;
+  }
+
+  void init(const StarMotion &motion, unsigned int instanceBuffer, StarInstanceFormat format, float positionScale)
+  {
+    std::vector<float> orbits = motion.orbitData();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, orbitBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(1, orbits.size() * sizeof(float)), orbits.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    instances = instanceBuffer;
+    numStars = motion.size();
+    recordWords = static_cast<int>(starInstanceStride(format) / sizeof(uint32_t));
+    scale = positionScale;
+  }
+
+  void update(float time)
+  {
+    shader.use();
+    glUniform1ui(glGetUniformLocation(shader.ID, "numStars"), numStars);
+    shader.setInt("recordWords", recordWords);
+    shader.setFloat("positionScale", scale);
+    shader.setFloat("time", time);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, orbitBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, instances);
+    unsigned int groups = std::min<unsigned int>(65535, (numStars + 255) / 256);
+    glDispatchCompute(std::max(1u, groups), 1, 1);
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+  }
+
+private:
+  ComputeShader shader;
+  unsigned int orbitBuffer = 0;
+  unsigned int instances = 0;
+  uint32_t numStars = 0;
+  int recordWords = 6;
+  float scale = 1.0f;
+};
+#endif
@@ -0,0 +1,452 @@
+#ifndef STAR_NBODY_H
+#define STAR_NBODY_H
+
+#include <glm/glm.hpp>
+
+#include "galaxy.h"
+#include "parallel.h"
+#include "star_instances.h"
+#include "star_morton.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+// bodies per leaf; leaves are summed directly, which is cheaper than opening more tiny cells
+const uint32_t NBODY_LEAF_BODIES = 8;
+const int NBODY_MAX_DEPTH = 20;
+
+struct NBodyParams
+{
+  float theta = 0.5f;                // opening angle: a cell of size s at distance d is used whole while s / d < theta
+  float softening = 0.05f;           // Plummer softening length, keeps close encounters finite
+  float timestep = 1.0f / 60.0f;     // fixed step in seconds of simulated time
+  float totalMass = 2.5f;            // with G = 1, puts the rim of a radius 10 galaxy at about 0.5 units/sec
+  unsigned int maxStepsPerFrame = 4; // steps dropped beyond this, so a slow frame cannot snowball
+};
+
+struct NBodyStats
+{
+  unsigned int threads = 0;
+  uint32_t nodes = 0;
+  double buildMilliseconds = 0.0;
+  double forceMilliseconds = 0.0;
+  double stepsPerSecond = 0.0;
+};
+
+// Barnes-Hut gravity on the generated stars. Every step rebuilds an octree over the current positions,
+// then walks it once per body on worker threads and integrates with kick-drift-kick leapfrog, which keeps
+// the disc's energy bounded over long runs. Bodies are visited in tree order so neighbouring bodies walk
+// the same cells back to back.
+//
+// The build is a linear octree for its top STAR_MORTON_BITS levels: the bodies are radix sorted by the
+// Morton code of their cell in the root cube, after which the bodies of every cell, and so of its
+// octants, are one contiguous run that a binary search finds. The top of the tree is split that way on
+// the calling thread until there are a few cells per worker, and the workers grow those subtrees; the few
+// cells deeper than the codes reach are partitioned like before.
+class NBodySimulation
+{
+public:
+  NBodyParams params;
+  NBodyStats stats;
+
+  // stars is the float array from generateGalaxy(). Every body gets the same mass and starts on a
+  // circular orbit for the mass inside its radius, so the disc begins close to equilibrium.
+  void init(const std::vector<float> &stars, const NBodyParams &simulationParams, unsigned int threadCount = 0)
+  {
+    params = simulationParams;
+    threads = threadCount;
+    uint32_t n = static_cast<uint32_t>(stars.size() / GALAXY_FLOATS_PER_STAR);
+    position.resize(n);
+    velocity.resize(n);
+    acceleration.assign(n, glm::vec3(0.0f));
+    mass = n > 0 ? params.totalMass / n : 0.0f;
+
+    std::vector<float> radii(n);
+    for (uint32_t i = 0; i < n; ++i)
+    {
+      const float *star = &stars[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+      position[i] = glm::vec3(star[0], star[1], star[2]);
+      radii[i] = std::sqrt(star[0] * star[0] + star[2] * star[2]);
+    }
+    std::vector<float> sortedRadii = radii;
+    std::sort(sortedRadii.begin(), sortedRadii.end());
+    for (uint32_t i = 0; i < n; ++i)
+    {
+      float r = radii[i];
+      float enclosed = mass * static_cast<float>(std::upper_bound(sortedRadii.begin(), sortedRadii.end(), r) - sortedRadii.begin());
+      float speed = std::sqrt(enclosed * r / (r * r + params.softening * params.softening));
+      glm::vec3 tangent = r > 0.0f ? glm::vec3(-position[i].z, 0.0f, position[i].x) / r : glm::vec3(0.0f);
+      velocity[i] = tangent * speed;
+    }
+    buildTree();
+    computeForces();
+  }
+
+  uint32_t size() const
+  {
+    return static_cast<uint32_t>(position.size());
+  }
+
+  // one fixed timestep
+  void step()
+  {
+    auto start = std::chrono::steady_clock::now();
+    const float dt = params.timestep;
+    parallelFor(size(), threads, [&](uint32_t begin, uint32_t end, unsigned int) {
+      for (uint32_t i = begin; i < end; ++i)
+      {
+        velocity[i] += acceleration[i] * (0.5f * dt);
+        position[i] += velocity[i] * dt;
+      }
+    });
+    buildTree();
+    computeForces();
+    parallelFor(size(), threads, [&](uint32_t begin, uint32_t end, unsigned int) {
+      for (uint32_t i = begin; i < end; ++i)
+        velocity[i] += acceleration[i] * (0.5f * dt);
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.stepsPerSecond = seconds > 0.0 ? 1.0 / seconds : 0.0;
+  }
+
+  // runs as many fixed steps as elapsed real time asks for, at most params.maxStepsPerFrame; returns the count
+  unsigned int advance(float elapsed)
+  {
+    accumulator += elapsed;
+    unsigned int steps = 0;
+    while (accumulator >= params.timestep && steps < params.maxStepsPerFrame)
+    {
+      step();
+      accumulator -= params.timestep;
+      ++steps;
+    }
+    if (steps == params.maxStepsPerFrame)
+      accumulator = std::min(accumulator, params.timestep);
+    return steps;
+  }
+
+  // writes every body's position into the records at out (float or packed layout, packed positions
+  // relative to positionScale); colors are left alone
+  void writePositions(unsigned char *out, StarInstanceFormat format, float positionScale) const
+  {
+    const float invScale = 1.0f / positionScale;
+    parallelFor(size(), threads, [&](uint32_t begin, uint32_t end, unsigned int) {
+      for (uint32_t i = begin; i < end; ++i)
+      {
+        if (format == STAR_FORMAT_PACKED)
+        {
+          PackedStar *star = reinterpret_cast<PackedStar *>(out) + i;
+          for (int k = 0; k < 3; ++k)
+            star->position[k] = packSnorm16(position[i][k] * invScale);
+        }
+        else
+        {
+          float *star = reinterpret_cast<float *>(out) + static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR;
+          star[0] = position[i].x;
+          star[1] = position[i].y;
+          star[2] = position[i].z;
+        }
+      }
+    });
+  }
+
+private:
+  struct Node
+  {
+    glm::vec3 centerOfMass = glm::vec3(0.0f);
+    float mass = 0.0f;
+    float size = 0.0f;       // edge length of the cell
+    uint32_t firstChild = 0; // children are contiguous; 0 for leaves
+    uint32_t childCount = 0;
+    uint32_t first = 0;      // leaves: bodies order[first, first + count)
+    uint32_t count = 0;
+  };
+
+  struct OctantSplit
+  {
+    unsigned int count = 0;
+    uint32_t begin[8];
+    uint32_t end[8];
+    glm::vec3 boxMin[8];
+  };
+
+  std::vector<glm::vec3> position;
+  std::vector<glm::vec3> velocity;
+  std::vector<glm::vec3> acceleration;
+  std::vector<uint32_t> order; // body indices grouped by leaf
+  std::vector<uint32_t> keys;  // Morton code of the body at the same place in order, sorted; see buildTree()
+  std::vector<Node> nodes;
+  float mass = 0.0f;
+  float accumulator = 0.0f;
+  unsigned int threads = 0;
+
+  OctantSplit splitOctants(uint32_t begin, uint32_t end, const glm::vec3 &boxMin, float size)
+  {
+    const glm::vec3 mid = boxMin + glm::vec3(0.5f * size);
+    uint32_t counts[8] = {0};
+    std::vector<uint8_t> octant(end - begin);
+    for (uint32_t s = begin; s < end; ++s)
+    {
+      const glm::vec3 &p = position[order[s]];
+      octant[s - begin] = static_cast<uint8_t>((p.x >= mid.x ? 1 : 0) | (p.y >= mid.y ? 2 : 0) | (p.z >= mid.z ? 4 : 0));
+      ++counts[octant[s - begin]];
+    }
+    uint32_t offsets[8];
+    uint32_t offset = 0;
+    for (int o = 0; o < 8; ++o)
+    {
+      offsets[o] = offset;
+      offset += counts[o];
+    }
+    std::vector<uint32_t> sorted(end - begin);
+    for (uint32_t s = begin; s < end; ++s)
+      sorted[offsets[octant[s - begin]]++] = order[s];
+    std::copy(sorted.begin(), sorted.end(), order.begin() + begin);
+
+    OctantSplit split;
+    uint32_t first = begin;
+    for (int o = 0; o < 8; ++o)
+    {
+      if (counts[o] > 0)
+      {
+        split.begin[split.count] = first;
+        split.end[split.count] = first + counts[o];
+        split.boxMin[split.count] = glm::vec3(o & 1 ? mid.x : boxMin.x, o & 2 ? mid.y : boxMin.y, o & 4 ? mid.z : boxMin.z);
+        ++split.count;
+      }
+      first += counts[o];
+    }
+    return split;
+  }
+
+  // the octants of a cell at a depth the Morton codes still resolve: its bodies are sorted by code, so
+  // each octant is the run whose next three code bits are its number, found by binary search
+  OctantSplit splitSorted(uint32_t begin, uint32_t end, const glm::vec3 &boxMin, float size, int depth) const
+  {
+    const unsigned int shift = 3 * (STAR_MORTON_BITS - 1 - depth);
+    const glm::vec3 mid = boxMin + glm::vec3(0.5f * size);
+    OctantSplit split;
+    uint32_t first = begin;
+    for (uint32_t o = 0; o < 8 && first < end; ++o)
+    {
+      uint32_t last = static_cast<uint32_t>(std::upper_bound(keys.begin() + first, keys.begin() + end, o,
+                                                             [shift](uint32_t octant, uint32_t key) { return octant < ((key >> shift) & 7); }) -
+                                            keys.begin());
+      if (last > first)
+      {
+        split.begin[split.count] = first;
+        split.end[split.count] = last;
+        split.boxMin[split.count] = glm::vec3(o & 1 ? mid.x : boxMin.x, o & 2 ? mid.y : boxMin.y, o & 4 ? mid.z : boxMin.z);
+        ++split.count;
+      }
+      first = last;
+    }
+    return split;
+  }
+
+  OctantSplit splitCell(uint32_t begin, uint32_t end, const glm::vec3 &boxMin, float size, int depth)
+  {
+    return depth < static_cast<int>(STAR_MORTON_BITS) ? splitSorted(begin, end, boxMin, size, depth) : splitOctants(begin, end, boxMin, size);
+  }
+
+  void buildNode(std::vector<Node> &list, uint32_t index, uint32_t begin, uint32_t end, const glm::vec3 &boxMin, float size, int depth)
+  {
+    list[index].size = size;
+    if (end - begin <= NBODY_LEAF_BODIES || depth >= NBODY_MAX_DEPTH)
+    {
+      Node &leaf = list[index];
+      leaf.first = begin;
+      leaf.count = end - begin;
+      glm::vec3 weighted(0.0f);
+      for (uint32_t s = begin; s < end; ++s)
+        weighted += position[order[s]];
+      leaf.mass = mass * leaf.count;
+      leaf.centerOfMass = weighted / static_cast<float>(leaf.count);
+      return;
+    }
+    OctantSplit split = splitCell(begin, end, boxMin, size, depth);
+    uint32_t firstChild = static_cast<uint32_t>(list.size());
+    list[index].firstChild = firstChild;
+    list[index].childCount = split.count;
+    list.resize(list.size() + split.count);
+    for (unsigned int c = 0; c < split.count; ++c)
+      buildNode(list, firstChild + c, split.begin[c], split.end[c], split.boxMin[c], 0.5f * size, depth + 1);
+    aggregateChildren(list, index);
+  }
+
+  // a cell of the top of the tree whose subtree one worker grows
+  struct SubtreeJob
+  {
+    uint32_t index, begin, end;
+    glm::vec3 boxMin;
+    float size;
+    int depth;
+  };
+
+  // splits nodes[index] on this thread until its cells hold at most grain bodies, which become jobs;
+  // the nodes split here are listed in inner, parents before children
+  void splitTop(uint32_t index, uint32_t begin, uint32_t end, const glm::vec3 &boxMin, float size, int depth, uint32_t grain,
+                std::vector<SubtreeJob> &jobs, std::vector<uint32_t> &inner)
+  {
+    nodes[index].size = size;
+    if (end - begin <= grain || end - begin <= NBODY_LEAF_BODIES || depth >= NBODY_MAX_DEPTH)
+    {
+      jobs.push_back({index, begin, end, boxMin, size, depth});
+      return;
+    }
+    OctantSplit split = splitCell(begin, end, boxMin, size, depth);
+    uint32_t firstChild = static_cast<uint32_t>(nodes.size());
+    nodes[index].firstChild = firstChild;
+    nodes[index].childCount = split.count;
+    nodes.resize(nodes.size() + split.count);
+    inner.push_back(index);
+    for (unsigned int c = 0; c < split.count; ++c)
+      splitTop(firstChild + c, split.begin[c], split.end[c], split.boxMin[c], 0.5f * size, depth + 1, grain, jobs, inner);
+  }
+
+  static void aggregateChildren(std::vector<Node> &list, uint32_t index)
+  {
+    Node &node = list[index];
+    glm::vec3 weighted(0.0f);
+    node.mass = 0.0f;
+    node.count = 0;
+    for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+    {
+      weighted += list[c].centerOfMass * list[c].mass;
+      node.mass += list[c].mass;
+      node.count += list[c].count;
+    }
+    node.centerOfMass = node.mass > 0.0f ? weighted / node.mass : glm::vec3(0.0f);
+  }
+
+  void buildTree()
+  {
+    auto start = std::chrono::steady_clock::now();
+    uint32_t n = size();
+    nodes.assign(1, Node());
+    order.resize(n);
+    if (n == 0)
+      return;
+
+    const unsigned int workers = parallelThreadCount(n, threads);
+    std::vector<glm::vec3> lows(workers, position[0]), highs(workers, position[0]);
+    parallelFor(n, threads, [&](uint32_t begin, uint32_t end, unsigned int worker) {
+      for (uint32_t i = begin; i < end; ++i)
+      {
+        lows[worker] = glm::min(lows[worker], position[i]);
+        highs[worker] = glm::max(highs[worker], position[i]);
+      }
+    });
+    glm::vec3 boxMin = lows[0], boxMax = highs[0];
+    for (unsigned int w = 1; w < workers; ++w)
+    {
+      boxMin = glm::min(boxMin, lows[w]);
+      boxMax = glm::max(boxMax, highs[w]);
+    }
+    // cubic root cell, nudged so the far faces still fall inside the last octant
+    float rootSize = std::max(boxMax.x - boxMin.x, std::max(boxMax.y - boxMin.y, boxMax.z - boxMin.z)) * 1.0001f + 1e-6f;
+
+    // bodies in Morton order of their cell in the root cube
+    const float cells = static_cast<float>(1u << STAR_MORTON_BITS);
+    const float cellScale = cells / rootSize;
+    keys.resize(n);
+    std::iota(order.begin(), order.end(), 0u);
+    parallelFor(n, threads, [&](uint32_t begin, uint32_t end, unsigned int) {
+      for (uint32_t i = begin; i < end; ++i)
+      {
+        glm::vec3 c = glm::min(glm::vec3(cells - 1.0f), glm::max(glm::vec3(0.0f), (position[i] - boxMin) * cellScale));
+        keys[i] = mortonCode3(static_cast<uint32_t>(c.x), static_cast<uint32_t>(c.y), static_cast<uint32_t>(c.z));
+      }
+    });
+    radixSortByKey(keys, order, 3 * STAR_MORTON_BITS, threads);
+
+    // the top of the tree here, down to a few cells per worker, then every cell's subtree on a worker
+    std::vector<SubtreeJob> jobs;
+    std::vector<uint32_t> inner;
+    const uint32_t grain = workers > 1 ? std::max(NBODY_LEAF_BODIES, n / (4 * workers)) : n;
+    splitTop(0, 0, n, boxMin, rootSize, 0, grain, jobs, inner);
+    std::vector<std::vector<Node>> subtrees(jobs.size());
+    std::atomic<uint32_t> nextJob{0};
+    parallelTasks(std::min<unsigned int>(workers, static_cast<unsigned int>(jobs.size())), [&](unsigned int) {
+      for (uint32_t j = nextJob++; j < jobs.size(); j = nextJob++)
+      {
+        subtrees[j].assign(1, Node());
+        buildNode(subtrees[j], 0, jobs[j].begin, jobs[j].end, jobs[j].boxMin, jobs[j].size, jobs[j].depth);
+      }
+    });
+
+    // splice every subtree in: its root takes the job's place, the rest follows the nodes so far
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+      uint32_t base = static_cast<uint32_t>(nodes.size());
+      for (size_t k = 0; k < subtrees[j].size(); ++k)
+      {
+        Node node = subtrees[j][k];
+        if (node.childCount > 0)
+          node.firstChild = base + node.firstChild - 1;
+        if (k == 0)
+          nodes[jobs[j].index] = node;
+        else
+          nodes.push_back(node);
+      }
+    }
+    for (size_t k = inner.size(); k-- > 0;)
+      aggregateChildren(nodes, inner[k]);
+    stats.nodes = static_cast<uint32_t>(nodes.size());
+    stats.buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  void computeForces()
+  {
+    auto start = std::chrono::steady_clock::now();
+    const float theta2 = params.theta * params.theta;
+    const float eps2 = params.softening * params.softening;
+    stats.threads = parallelFor(size(), threads, [&](uint32_t begin, uint32_t end, unsigned int) {
+      std::vector<uint32_t> stack;
+      stack.reserve(64);
+      for (uint32_t k = begin; k < end; ++k)
+      {
+        const uint32_t i = order[k];
+        const glm::vec3 p = position[i];
+        glm::vec3 a(0.0f);
+        stack.assign(1, 0);
+        while (!stack.empty())
+        {
+          const Node &node = nodes[stack.back()];
+          stack.pop_back();
+          glm::vec3 d = node.centerOfMass - p;
+          float dist2 = glm::dot(d, d);
+          if (node.childCount == 0)
+          {
+            for (uint32_t s = node.first; s < node.first + node.count; ++s)
+            {
+              uint32_t j = order[s];
+              if (j == i)
+                continue;
+              glm::vec3 dj = position[j] - p;
+              float r2 = glm::dot(dj, dj) + eps2;
+              a += dj * (mass / (r2 * std::sqrt(r2)));
+            }
+          }
+          else if (node.size * node.size < theta2 * dist2)
+          {
+            float r2 = dist2 + eps2;
+            a += d * (node.mass / (r2 * std::sqrt(r2)));
+          }
+          else
+          {
+            for (uint32_t c = 0; c < node.childCount; ++c)
+              stack.push_back(node.firstChild + c);
+          }
+        }
+        acceleration[i] = a;
+      }
+    });
+    stats.forceMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+};
+#endif
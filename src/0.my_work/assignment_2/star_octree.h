@@ -0,0 +1,397 @@
+#ifndef STAR_OCTREE_H
+#define STAR_OCTREE_H
+
+#include <glm/glm.hpp>
+
+#include "galaxy.h"
+#include "parallel.h"
+#include "star_culling.h"
+#include "star_instances.h"
+#include "star_lod.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+// a cluster whose stars spread over less than this many pixels is drawn as one representative
+const float STAR_OCTREE_MAX_PIXEL_ERROR = 1.0f;
+
+// stars per leaf before a node is split, and how deep the tree may go for heavily clumped stars
+const uint32_t STAR_OCTREE_LEAF_STARS = 64;
+const int STAR_OCTREE_MAX_DEPTH = 16;
+
+// one node of the octree. Every node, leaves included, carries the aggregate of the stars below it,
+// which is what gets drawn once the node is too small on screen to be worth opening: one star-sized
+// sprite. Opaque spheres show the front star where they overlap, so that sprite takes the mean color;
+// additive point sprites add up, so there it shines with the summed luminosity instead.
+struct StarOctreeNode
+{
+  glm::vec3 center = glm::vec3(0.0f); // mean star position
+  float radius = 0.0f;                // bounds every star position below the node around center
+  glm::vec3 color = glm::vec3(0.0f);  // mean star color
+  float luminosity = 0.0f;            // summed star luminance (Rec. 709 weights)
+  uint32_t count = 0;                 // stars below the node
+  uint32_t firstChild = 0;            // children are stored contiguously; 0 for leaves (the root is never a child)
+  uint32_t childCount = 0;
+  uint32_t firstStar = 0;             // leaves: first entry of their range in StarOctree::starIndices
+};
+
+struct StarOctreeStats
+{
+  uint32_t nodes = 0;    // nodes in the tree
+  uint32_t visited = 0;  // nodes touched by the last select()
+  uint32_t clusters = 0; // aggregates drawn in place of their stars
+  uint32_t stars = 0;    // stars drawn individually
+  double buildMilliseconds = 0.0;
+  double milliseconds = 0.0;
+};
+
+// octree over the generateGalaxy() output. select() walks it front to back from the root, stops at
+// nodes whose projected spread falls under the error threshold and emits their aggregate as a single
+// point sprite, so the work per frame follows screen coverage instead of the star count. Stars in
+// leaves that are still too large are handed to the StarLod chain one by one.
+class StarOctree
+{
+public:
+  StarOctreeStats stats;
+  std::vector<StarOctreeNode> nodes;
+  std::vector<uint32_t> starIndices; // star indices grouped by leaf
+
+  // builds the tree and one aggregate record per node in the given instance layout, in the mean color
+  // for spheres or carrying the summed luminosity for additive points. The eight subtrees below the
+  // root are built in parallel.
+  void build(const std::vector<float> &stars, StarInstanceFormat format, float radius, StarRenderMode renderMode = STAR_RENDER_SPHERES)
+  {
+    auto start = std::chrono::steady_clock::now();
+    uint32_t numStars = static_cast<uint32_t>(stars.size() / GALAXY_FLOATS_PER_STAR);
+    starIndices.resize(numStars);
+    for (uint32_t i = 0; i < numStars; ++i)
+      starIndices[i] = i;
+    nodes.assign(1, StarOctreeNode());
+
+    glm::vec3 boxMin(0.0f), boxMax(0.0f);
+    for (uint32_t i = 0; i < numStars; ++i)
+    {
+      glm::vec3 p = starPosition(stars, i);
+      boxMin = i == 0 ? p : glm::min(boxMin, p);
+      boxMax = i == 0 ? p : glm::max(boxMax, p);
+    }
+    // cubic cells: splitting the thin galaxy disc at its own midpoints would give flat cells as wide as
+    // the tree is deep, so every octant would spread over far more pixels than its star count warrants
+    glm::vec3 half = glm::vec3(0.5f * glm::max(boxMax.x - boxMin.x, glm::max(boxMax.y - boxMin.y, boxMax.z - boxMin.z)));
+    glm::vec3 mid = 0.5f * (boxMin + boxMax);
+    boxMin = mid - half;
+    boxMax = mid + half;
+
+    // split the root by hand, then grow each octant into its own node list and splice them after it
+    OctantSplit split = splitOctants(stars, 0, numStars, boxMin, boxMax);
+    std::vector<std::vector<StarOctreeNode>> subtrees(split.count);
+    unsigned int tasks = numStars >= PARALLEL_MIN_ITEMS_PER_THREAD ? std::max(1u, split.count) : 1;
+    parallelTasks(tasks, [&](unsigned int task) {
+      for (unsigned int c = task; c < split.count; c += tasks)
+      {
+        subtrees[c].assign(1, StarOctreeNode());
+        buildNode(stars, subtrees[c], 0, split.begin[c], split.end[c], split.boxMin[c], split.boxMax[c], 1);
+      }
+    });
+
+    nodes[0].firstChild = split.count > 0 ? 1 : 0;
+    nodes[0].childCount = split.count;
+    nodes.resize(1 + split.count);
+    for (unsigned int c = 0; c < split.count; ++c)
+    {
+      uint32_t base = static_cast<uint32_t>(nodes.size());
+      StarOctreeNode root = subtrees[c][0];
+      if (root.childCount > 0)
+        root.firstChild = base + root.firstChild - 1;
+      nodes[1 + c] = root;
+      for (size_t n = 1; n < subtrees[c].size(); ++n)
+      {
+        StarOctreeNode node = subtrees[c][n];
+        if (node.childCount > 0)
+          node.firstChild = base + node.firstChild - 1;
+        nodes.push_back(node);
+      }
+    }
+    if (split.count > 0)
+      aggregateChildren(nodes, 0);
+
+    // aggregate records, drawn through the same instance attributes as the stars. For points the mean
+    // color is scaled until its luminance is the sum of the stars', which for the packed layout goes
+    // into the brightness exponent since its color cannot exceed 1.
+    records.resize(nodes.size() * starInstanceStride(format));
+    for (size_t n = 0; n < nodes.size(); ++n)
+    {
+      const StarOctreeNode &node = nodes[n];
+      float brightness = 1.0f;
+      if (renderMode == STAR_RENDER_POINTS)
+      {
+        float meanLuminance = starLuminance(node.color);
+        brightness = meanLuminance > 0.0f ? node.luminosity / meanLuminance : static_cast<float>(node.count);
+      }
+      float star[GALAXY_FLOATS_PER_STAR] = {node.center.x, node.center.y, node.center.z, node.color.r, node.color.g, node.color.b};
+      if (format == STAR_FORMAT_PACKED)
+      {
+        PackedStar packed = packStar(star, 1.0f / radius);
+        packed.color[3] = packStarBrightness(brightness);
+        std::memcpy(&records[n * sizeof(PackedStar)], &packed, sizeof(PackedStar));
+      }
+      else
+      {
+        for (int k = 3; k < 6; ++k)
+          star[k] *= brightness;
+        std::memcpy(&records[n * sizeof(star)], star, sizeof(star));
+      }
+    }
+
+    stats.nodes = static_cast<uint32_t>(nodes.size());
+    stats.buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // aggregate records, one per node in the layout passed to build(); StarLod::upload() reads them as
+  // extra records, node n being index numStars + n
+  const unsigned char *nodeRecords() const
+  {
+    return records.data();
+  }
+
+  // fills lod.buckets: aggregates of nodes below maxPixelError go to the point sprite level as index
+  // numStars + node, stars of leaves that are still too large go to the level their own size asks for.
+  // eye and frustum (when given) must be in galaxy space.
+  void select(StarLod &lod, const std::vector<float> &stars, const glm::vec3 &eye, float projScale, float starRadius,
+              const Frustum *frustum, float maxPixelError = STAR_OCTREE_MAX_PIXEL_ERROR, unsigned int threadCount = 0)
+  {
+    auto start = std::chrono::steady_clock::now();
+    lod.prepare(projScale, starRadius);
+    const uint32_t numStars = static_cast<uint32_t>(stars.size() / GALAXY_FLOATS_PER_STAR);
+    // a node is opened while radius * projScale / distance >= maxPixelError
+    const float openScale2 = (projScale / maxPixelError) * (projScale / maxPixelError);
+
+    // open the top of the tree on this thread until there is enough independent work for the workers
+    unsigned int workers = parallelThreadCount(numStars, threadCount);
+    std::vector<uint32_t> frontier(1, 0);
+    std::vector<uint32_t> next;
+    uint32_t visited = 0;
+    while (frontier.size() < 4 * workers)
+    {
+      next.clear();
+      bool opened = false;
+      for (uint32_t n : frontier)
+      {
+        const StarOctreeNode &node = nodes[n];
+        if (node.childCount > 0 && classify(node, eye, starRadius, frustum, openScale2) == OPEN)
+        {
+          ++visited;
+          for (uint32_t c = 0; c < node.childCount; ++c)
+            next.push_back(node.firstChild + c);
+          opened = true;
+        }
+        else
+        {
+          next.push_back(n);
+        }
+      }
+      frontier.swap(next);
+      if (!opened)
+        break;
+    }
+
+    lod.buckets.reset(workers, static_cast<unsigned int>(lod.levels.size()));
+    std::vector<uint32_t> workerVisited(workers, 0), workerClusters(workers, 0), workerStars(workers, 0);
+    parallelTasks(workers, [&](unsigned int worker) {
+      std::vector<uint32_t> stack;
+      for (size_t f = worker; f < frontier.size(); f += workers)
+      {
+        stack.assign(1, frontier[f]);
+        while (!stack.empty())
+        {
+          uint32_t n = stack.back();
+          stack.pop_back();
+          const StarOctreeNode &node = nodes[n];
+          ++workerVisited[worker];
+          switch (classify(node, eye, starRadius, frustum, openScale2))
+          {
+          case SKIP:
+            break;
+          case CLUSTER:
+            lod.buckets.list(worker, 0).push_back(numStars + n);
+            ++workerClusters[worker];
+            break;
+          case OPEN:
+            if (node.childCount > 0)
+            {
+              for (uint32_t c = node.childCount; c-- > 0;)
+                stack.push_back(node.firstChild + c);
+              break;
+            }
+            for (uint32_t s = node.firstStar; s < node.firstStar + node.count; ++s)
+            {
+              uint32_t i = starIndices[s];
+              glm::vec3 center = starPosition(stars, i);
+              if (frustum && !isSphereOnFrustum(*frustum, center, starRadius))
+                continue;
+              glm::vec3 toStar = center - eye;
+              lod.buckets.list(worker, lod.levelFor(glm::dot(toStar, toStar))).push_back(i);
+              ++workerStars[worker];
+            }
+            break;
+          }
+        }
+      }
+    });
+    lod.buckets.finish();
+
+    stats.visited = visited;
+    stats.clusters = 0;
+    stats.stars = 0;
+    for (unsigned int w = 0; w < workers; ++w)
+    {
+      stats.visited += workerVisited[w];
+      stats.clusters += workerClusters[w];
+      stats.stars += workerStars[w];
+    }
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    lod.stats.total = numStars;
+    lod.stats.visible = lod.buckets.total();
+    lod.stats.milliseconds = stats.milliseconds;
+  }
+
+private:
+  enum NodeAction
+  {
+    SKIP,    // outside the frustum
+    CLUSTER, // small enough on screen, draw the aggregate
+    OPEN     // descend into the children, or draw the stars of a leaf
+  };
+
+  struct OctantSplit
+  {
+    unsigned int count = 0; // non-empty octants, the arrays below are packed
+    uint32_t begin[8];
+    uint32_t end[8];
+    glm::vec3 boxMin[8];
+    glm::vec3 boxMax[8];
+  };
+
+  std::vector<unsigned char> records;
+
+  static glm::vec3 starPosition(const std::vector<float> &stars, uint32_t i)
+  {
+    const float *star = &stars[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+    return glm::vec3(star[0], star[1], star[2]);
+  }
+
+  static float starLuminance(const glm::vec3 &color)
+  {
+    return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+  }
+
+  static NodeAction classify(const StarOctreeNode &node, const glm::vec3 &eye, float starRadius, const Frustum *frustum, float openScale2)
+  {
+    if (node.count == 0 || (frustum && !isSphereOnFrustum(*frustum, node.center, node.radius + starRadius)))
+      return SKIP;
+    if (node.count == 1)
+      return OPEN;
+    glm::vec3 toNode = node.center - eye;
+    return node.radius * node.radius * openScale2 < glm::dot(toNode, toNode) ? CLUSTER : OPEN;
+  }
+
+  // counting sort of starIndices[begin, end) into the eight octants around the box center
+  OctantSplit splitOctants(const std::vector<float> &stars, uint32_t begin, uint32_t end, const glm::vec3 &boxMin, const glm::vec3 &boxMax)
+  {
+    const glm::vec3 mid = 0.5f * (boxMin + boxMax);
+    uint32_t counts[8] = {0};
+    std::vector<uint8_t> octant(end - begin);
+    for (uint32_t s = begin; s < end; ++s)
+    {
+      glm::vec3 p = starPosition(stars, starIndices[s]);
+      octant[s - begin] = static_cast<uint8_t>((p.x >= mid.x ? 1 : 0) | (p.y >= mid.y ? 2 : 0) | (p.z >= mid.z ? 4 : 0));
+      ++counts[octant[s - begin]];
+    }
+    uint32_t offsets[8];
+    uint32_t offset = begin;
+    for (int o = 0; o < 8; ++o)
+    {
+      offsets[o] = offset;
+      offset += counts[o];
+    }
+    std::vector<uint32_t> sorted(end - begin);
+    for (uint32_t s = begin; s < end; ++s)
+      sorted[offsets[octant[s - begin]]++ - begin] = starIndices[s];
+    std::copy(sorted.begin(), sorted.end(), starIndices.begin() + begin);
+
+    OctantSplit split;
+    uint32_t first = begin;
+    for (int o = 0; o < 8; ++o)
+    {
+      if (counts[o] > 0)
+      {
+        split.begin[split.count] = first;
+        split.end[split.count] = first + counts[o];
+        split.boxMin[split.count] = glm::vec3(o & 1 ? mid.x : boxMin.x, o & 2 ? mid.y : boxMin.y, o & 4 ? mid.z : boxMin.z);
+        split.boxMax[split.count] = glm::vec3(o & 1 ? boxMax.x : mid.x, o & 2 ? boxMax.y : mid.y, o & 4 ? boxMax.z : mid.z);
+        ++split.count;
+      }
+      first += counts[o];
+    }
+    return split;
+  }
+
+  // fills list[index] for starIndices[begin, end), appending its descendants to list
+  void buildNode(const std::vector<float> &stars, std::vector<StarOctreeNode> &list, uint32_t index, uint32_t begin, uint32_t end,
+                 const glm::vec3 &boxMin, const glm::vec3 &boxMax, int depth)
+  {
+    if (end - begin <= STAR_OCTREE_LEAF_STARS || depth >= STAR_OCTREE_MAX_DEPTH)
+    {
+      StarOctreeNode &leaf = list[index];
+      leaf.firstStar = begin;
+      leaf.count = end - begin;
+      glm::vec3 center(0.0f), color(0.0f);
+      for (uint32_t s = begin; s < end; ++s)
+      {
+        const float *star = &stars[static_cast<size_t>(starIndices[s]) * GALAXY_FLOATS_PER_STAR];
+        center += glm::vec3(star[0], star[1], star[2]);
+        color += glm::vec3(star[3], star[4], star[5]);
+        leaf.luminosity += starLuminance(glm::vec3(star[3], star[4], star[5]));
+      }
+      leaf.center = center / static_cast<float>(leaf.count);
+      leaf.color = color / static_cast<float>(leaf.count);
+      for (uint32_t s = begin; s < end; ++s)
+        leaf.radius = std::max(leaf.radius, glm::length(starPosition(stars, starIndices[s]) - leaf.center));
+      return;
+    }
+
+    OctantSplit split = splitOctants(stars, begin, end, boxMin, boxMax);
+    uint32_t firstChild = static_cast<uint32_t>(list.size());
+    list[index].firstChild = firstChild;
+    list[index].childCount = split.count;
+    list.resize(list.size() + split.count);
+    for (unsigned int c = 0; c < split.count; ++c)
+      buildNode(stars, list, firstChild + c, split.begin[c], split.end[c], split.boxMin[c], split.boxMax[c], depth + 1);
+    aggregateChildren(list, index);
+  }
+
+  // count-weighted means of the children; the radius is a bound, not the tightest sphere
+  static void aggregateChildren(std::vector<StarOctreeNode> &list, uint32_t index)
+  {
+    StarOctreeNode &node = list[index];
+    glm::vec3 center(0.0f), color(0.0f);
+    node.count = 0;
+    node.luminosity = 0.0f;
+    for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+    {
+      const StarOctreeNode &child = list[c];
+      center += child.center * static_cast<float>(child.count);
+      color += child.color * static_cast<float>(child.count);
+      node.count += child.count;
+      node.luminosity += child.luminosity;
+    }
+    node.center = center / static_cast<float>(node.count);
+    node.color = color / static_cast<float>(node.count);
+    node.radius = 0.0f;
+    for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+      node.radius = std::max(node.radius, glm::length(list[c].center - node.center) + list[c].radius);
+  }
+};
+#endif
@@ -0,0 +1,360 @@
+#ifndef STAR_PICKING_H
+#define STAR_PICKING_H
+
+#include <glm/glm.hpp>
+
+#include "galaxy.h"
+#include "parallel.h"
+#include "star_morton.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// stars per BVH leaf; they are neighbours on the Morton curve, so a leaf stays small in space. Star
+// spheres are cheap to test, and at 10M stars 16 per leaf visits fewer nodes than 4 or 8 in the worst case.
+const uint32_t STAR_BVH_LEAF_SIZE = 16;
+const uint32_t STAR_BVH_LEAF = 0x80000000u; // child index flag: the child is a leaf
+
+struct StarBvhStats
+{
+  unsigned int threads = 0;
+  uint32_t nodes = 0; // internal nodes
+  uint32_t leaves = 0;
+  double buildMilliseconds = 0.0;
+};
+
+struct StarPick
+{
+  bool hit = false;
+  uint32_t slot = 0;        // index of the star in the array the BVH was built from
+  float distance = 0.0f;    // along the ray to the star's sphere
+  uint32_t nodesVisited = 0;
+  double microseconds = 0.0;
+};
+
+// Ray picking against star spheres through a linear BVH (Karras 2012). The stars are sorted along a Morton
+// curve with the parallel radix sort, every internal node finds its own key range independently, and the
+// boxes are then merged bottom-up: each leaf walks towards the root, and the second of two siblings to
+// arrive at a parent computes its box. Every step is a parallelFor, so building follows the generator's
+// thread count. Queries walk the tree front to back and stop at boxes further away than the nearest hit.
+class StarBvh
+{
+public:
+  StarBvhStats stats;
+
+  // stars is the float array from generateGalaxy(); every star is a sphere of starRadius
+  void build(const std::vector<float> &stars, float starRadius, unsigned int threadCount = 0)
+  {
+    auto start = std::chrono::steady_clock::now();
+    radius = starRadius;
+    const uint32_t count = static_cast<uint32_t>(stars.size() / GALAXY_FLOATS_PER_STAR);
+    nodes.clear();
+    leafBounds.clear();
+    if (count == 0)
+      return;
+
+    // Morton codes inside a cube around all stars, so cells are cubes whatever the galaxy's shape
+    std::vector<glm::vec3> lows(parallelThreadCount(count, threadCount), glm::vec3(INFINITY));
+    std::vector<glm::vec3> highs(lows.size(), glm::vec3(-INFINITY));
+    stats.threads = parallelFor(count, threadCount, [&](uint32_t begin, uint32_t end, unsigned int worker) {
+      for (uint32_t i = begin; i < end; ++i)
+      {
+        const float *star = &stars[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+        lows[worker] = glm::min(lows[worker], glm::vec3(star[0], star[1], star[2]));
+        highs[worker] = glm::max(highs[worker], glm::vec3(star[0], star[1], star[2]));
+      }
+    });
+    glm::vec3 low = lows[0], high = highs[0];
+    for (size_t w = 1; w < lows.size(); ++w)
+    {
+      low = glm::min(low, lows[w]);
+      high = glm::max(high, highs[w]);
+    }
+    const glm::vec3 center = 0.5f * (low + high);
+    const float halfSize = 0.5f * std::max(high.x - low.x, std::max(high.y - low.y, high.z - low.z)) + 1e-6f;
+    const float scale = (1u << STAR_MORTON_BITS) / (2.0f * halfSize);
+
+    std::vector<uint32_t> keys(count);
+    slots.resize(count);
+    parallelFor(count, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+      for (uint32_t i = begin; i < end; ++i)
+      {
+        const float *star = &stars[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+        uint32_t cell[3];
+        for (int axis = 0; axis < 3; ++axis)
+          cell[axis] = static_cast<uint32_t>(glm::clamp((star[axis] - center[axis] + halfSize) * scale, 0.0f, (1u << STAR_MORTON_BITS) - 1.0f));
+        keys[i] = mortonCode3(cell[0], cell[1], cell[2]);
+        slots[i] = i;
+      }
+    });
+    radixSortByKey(keys, slots, 3 * STAR_MORTON_BITS, threadCount);
+
+    // leaves: runs of STAR_BVH_LEAF_SIZE sorted stars, positions copied in tree order for the ray tests
+    const uint32_t leafCount = (count + STAR_BVH_LEAF_SIZE - 1) / STAR_BVH_LEAF_SIZE;
+    positions.resize(count);
+    leafKeys.resize(leafCount);
+    leafBounds.resize(leafCount);
+    parallelFor(leafCount, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+      for (uint32_t leaf = begin; leaf < end; ++leaf)
+      {
+        Bounds &bounds = leafBounds[leaf];
+        bounds.min = glm::vec3(INFINITY);
+        bounds.max = glm::vec3(-INFINITY);
+        for (uint32_t i = leaf * STAR_BVH_LEAF_SIZE; i < std::min(count, (leaf + 1) * STAR_BVH_LEAF_SIZE); ++i)
+        {
+          const float *star = &stars[static_cast<size_t>(slots[i]) * GALAXY_FLOATS_PER_STAR];
+          positions[i] = glm::vec3(star[0], star[1], star[2]);
+          bounds.min = glm::min(bounds.min, positions[i] - radius);
+          bounds.max = glm::max(bounds.max, positions[i] + radius);
+        }
+        leafKeys[leaf] = keys[leaf * STAR_BVH_LEAF_SIZE];
+      }
+    });
+
+    // a single leaf still gets a root, with the leaf on both sides
+    const uint32_t internalCount = std::max(1u, leafCount - 1);
+    nodes.resize(internalCount);
+    std::vector<uint32_t> parents(internalCount + leafCount, 0); // internal nodes first, then leaves
+    if (leafCount == 1)
+    {
+      nodes[0].left = nodes[0].right = STAR_BVH_LEAF;
+      nodes[0].bounds = leafBounds[0];
+    }
+    else
+    {
+      parallelFor(internalCount, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+        for (uint32_t i = begin; i < end; ++i)
+          buildNode(i, leafCount, parents);
+      });
+
+      // bottom-up boxes: the first child to reach a parent stops, the second merges both
+      std::vector<std::atomic<uint32_t>> arrivals(internalCount);
+      for (std::atomic<uint32_t> &arrival : arrivals)
+        arrival.store(0, std::memory_order_relaxed);
+      parallelFor(leafCount, threadCount, [&](uint32_t begin, uint32_t end, unsigned int) {
+        for (uint32_t leaf = begin; leaf < end; ++leaf)
+        {
+          uint32_t node = parents[internalCount + leaf];
+          while (arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 1)
+          {
+            const Bounds &left = childBounds(nodes[node].left);
+            const Bounds &right = childBounds(nodes[node].right);
+            nodes[node].bounds.min = glm::min(left.min, right.min);
+            nodes[node].bounds.max = glm::max(left.max, right.max);
+            if (node == 0)
+              break;
+            node = parents[node];
+          }
+        }
+      });
+    }
+
+    stats.nodes = internalCount;
+    stats.leaves = leafCount;
+    stats.buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  bool empty() const
+  {
+    return nodes.empty();
+  }
+
+  // nearest star sphere hit by the ray origin + t * direction, t >= 0; direction must be normalized
+  StarPick pick(const glm::vec3 &origin, const glm::vec3 &direction) const
+  {
+    auto start = std::chrono::steady_clock::now();
+    StarPick result;
+    if (nodes.empty())
+      return result;
+    const glm::vec3 inverse = 1.0f / direction;
+    float nearest = INFINITY;
+
+    // the Morton prefix of a path grows by at least one of its 62 bits per level, so depth stays below 64
+    struct Entry
+    {
+      uint32_t node;
+      float distance;
+    };
+    Entry stack[128];
+    int top = 0;
+    stack[top++] = {0, 0.0f};
+    while (top > 0)
+    {
+      Entry entry = stack[--top];
+      if (entry.distance >= nearest)
+        continue;
+      ++result.nodesVisited;
+      if (entry.node & STAR_BVH_LEAF)
+      {
+        uint32_t leaf = entry.node & ~STAR_BVH_LEAF;
+        uint32_t end = std::min(static_cast<uint32_t>(positions.size()), (leaf + 1) * STAR_BVH_LEAF_SIZE);
+        for (uint32_t i = leaf * STAR_BVH_LEAF_SIZE; i < end; ++i)
+        {
+          float t = intersectSphere(origin, direction, positions[i]);
+          if (t < nearest)
+          {
+            nearest = t;
+            result.slot = slots[i];
+          }
+        }
+        continue;
+      }
+
+      // nearer child on top, so it is searched first and can prune the other
+      const Node &node = nodes[entry.node];
+      float leftDistance = intersectBox(origin, inverse, childBounds(node.left), nearest);
+      float rightDistance = intersectBox(origin, inverse, childBounds(node.right), nearest);
+      bool leftFirst = leftDistance <= rightDistance;
+      uint32_t firstChild = leftFirst ? node.left : node.right;
+      uint32_t secondChild = leftFirst ? node.right : node.left;
+      float firstDistance = std::min(leftDistance, rightDistance), secondDistance = std::max(leftDistance, rightDistance);
+      if (secondDistance < nearest && top < 128)
+        stack[top++] = {secondChild, secondDistance};
+      if (firstDistance < nearest && top < 128)
+        stack[top++] = {firstChild, firstDistance};
+    }
+
+    result.hit = nearest < INFINITY;
+    result.distance = result.hit ? nearest : 0.0f;
+    result.microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    return result;
+  }
+
+  // the same query against every star, for checking pick()
+  static StarPick pickBruteForce(const std::vector<float> &stars, float starRadius, const glm::vec3 &origin, const glm::vec3 &direction)
+  {
+    StarPick result;
+    float nearest = INFINITY;
+    const uint32_t count = static_cast<uint32_t>(stars.size() / GALAXY_FLOATS_PER_STAR);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      const float *star = &stars[static_cast<size_t>(i) * GALAXY_FLOATS_PER_STAR];
+      float t = intersectSphere(origin, direction, glm::vec3(star[0], star[1], star[2]), starRadius);
+      if (t < nearest)
+      {
+        nearest = t;
+        result.slot = i;
+      }
+    }
+    result.hit = nearest < INFINITY;
+    result.distance = result.hit ? nearest : 0.0f;
+    return result;
+  }
+
+private:
+  struct Bounds
+  {
+    glm::vec3 min, max;
+  };
+
+  struct Node
+  {
+    Bounds bounds;
+    uint32_t left, right; // child node index, or leaf index | STAR_BVH_LEAF
+  };
+
+  std::vector<Node> nodes; // nodes[0] is the root
+  std::vector<Bounds> leafBounds;
+  std::vector<uint32_t> leafKeys;
+  std::vector<glm::vec3> positions; // star centers in leaf order
+  std::vector<uint32_t> slots;      // slots[i] = index of positions[i] in the source array
+  float radius = 0.0f;
+
+  const Bounds &childBounds(uint32_t child) const
+  {
+    return child & STAR_BVH_LEAF ? leafBounds[child & ~STAR_BVH_LEAF] : nodes[child].bounds;
+  }
+
+  // length of the common prefix of the keys of leaves i and j, the leaf index breaking ties between equal
+  // keys; -1 when j is out of range
+  int commonPrefix(uint32_t i, int64_t j, uint32_t leafCount) const
+  {
+    if (j < 0 || j >= leafCount)
+      return -1;
+    uint32_t a = leafKeys[i], b = leafKeys[static_cast<uint32_t>(j)];
+    if (a == b)
+      return 32 + countLeadingZeros(i ^ static_cast<uint32_t>(j));
+    return countLeadingZeros(a ^ b);
+  }
+
+  static int countLeadingZeros(uint32_t v)
+  {
+#if defined(__GNUC__) || defined(__clang__)
+    return v == 0 ? 32 : __builtin_clz(v);
+#else
+    int n = 0;
+    for (uint32_t bit = 0x80000000u; bit != 0 && (v & bit) == 0; bit >>= 1)
+      ++n;
+    return n;
+#endif
+  }
+
+  // internal node i covers a key range starting or ending at leaf i and splits it where the highest
+  // differing bit flips (Karras 2012, figure 4)
+  void buildNode(uint32_t i, uint32_t leafCount, std::vector<uint32_t> &parents)
+  {
+    const uint32_t internalCount = leafCount - 1;
+    int direction = commonPrefix(i, static_cast<int64_t>(i) + 1, leafCount) - commonPrefix(i, static_cast<int64_t>(i) - 1, leafCount) >= 0 ? 1 : -1;
+    int minPrefix = commonPrefix(i, static_cast<int64_t>(i) - direction, leafCount);
+    uint32_t maxLength = 2;
+    while (commonPrefix(i, static_cast<int64_t>(i) + static_cast<int64_t>(maxLength) * direction, leafCount) > minPrefix)
+      maxLength *= 2;
+    uint32_t length = 0;
+    for (uint32_t step = maxLength / 2; step > 0; step /= 2)
+      if (commonPrefix(i, static_cast<int64_t>(i) + static_cast<int64_t>(length + step) * direction, leafCount) > minPrefix)
+        length += step;
+    const uint32_t j = direction > 0 ? i + length : i - length;
+
+    const int nodePrefix = commonPrefix(i, j, leafCount);
+    uint32_t split = 0;
+    for (uint32_t step = (length + 1) / 2;; step = (step + 1) / 2)
+    {
+      if (split + step < length && commonPrefix(i, static_cast<int64_t>(i) + static_cast<int64_t>(split + step) * direction, leafCount) > nodePrefix)
+        split += step;
+      if (step == 1)
+        break;
+    }
+    const uint32_t gamma = direction > 0 ? i + split : i - split - 1;
+
+    const uint32_t first = std::min(i, j), last = std::max(i, j);
+    nodes[i].left = first == gamma ? gamma | STAR_BVH_LEAF : gamma;
+    nodes[i].right = last == gamma + 1 ? (gamma + 1) | STAR_BVH_LEAF : gamma + 1;
+    parents[first == gamma ? internalCount + gamma : gamma] = i;
+    parents[last == gamma + 1 ? internalCount + gamma + 1 : gamma + 1] = i;
+  }
+
+  // entry distance of the ray into the box, clamped to 0, or INFINITY on a miss or beyond limit
+  static float intersectBox(const glm::vec3 &origin, const glm::vec3 &inverse, const Bounds &bounds, float limit)
+  {
+    glm::vec3 t0 = (bounds.min - origin) * inverse;
+    glm::vec3 t1 = (bounds.max - origin) * inverse;
+    glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, limit));
+    return enter <= exit ? enter : INFINITY;
+  }
+
+  float intersectSphere(const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 &center) const
+  {
+    return intersectSphere(origin, direction, center, radius);
+  }
+
+  // distance to the first point of the sphere on the ray (0 from inside), INFINITY on a miss
+  static float intersectSphere(const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 &center, float sphereRadius)
+  {
+    glm::vec3 offset = origin - center;
+    float b = glm::dot(offset, direction);
+    float c = glm::dot(offset, offset) - sphereRadius * sphereRadius;
+    if (c <= 0.0f)
+      return 0.0f;
+    float discriminant = b * b - c;
+    if (b > 0.0f || discriminant < 0.0f)
+      return INFINITY;
+    return -b - std::sqrt(discriminant);
+  }
+};
+#endif
@@ -0,0 +1,170 @@
+#ifndef STAR_SNAPSHOT_H
+#define STAR_SNAPSHOT_H
+
+#include <learnopengl/mapped_file.h>
+
+#include "galaxy.h"
+#include "star_instances.h"
+#include "star_morton.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Galaxy snapshot file, native byte order:
+//   StarSnapshotHeader  64 bytes
+//   instances           count * stride bytes in the header's layout, at payloadOffset (64-byte aligned)
+//   ids                 count uint32 star ids, at idsOffset (64-byte aligned), only with STAR_SNAPSHOT_IDS
+// The instance payload is exactly what the instance buffer holds, so loading maps the file and hands
+// the payload to the GL as it is.
+const char STAR_SNAPSHOT_MAGIC[8] = {'G', 'A', 'L', 'A', 'X', 'Y', 'S', '\0'};
+const uint32_t STAR_SNAPSHOT_VERSION = 1;
+const uint64_t STAR_SNAPSHOT_ALIGNMENT = 64;
+const uint32_t STAR_SNAPSHOT_IDS = 1; // stars are stored out of generation order (e.g. --morton), ids follow
+
+struct StarSnapshotHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t layout; // StarInstanceFormat
+  uint32_t count;
+  uint32_t stride;
+  uint32_t seed;
+  int32_t arms;
+  float radius;
+  uint32_t flags;
+  uint64_t payloadOffset;
+  uint64_t payloadBytes;
+  uint64_t idsOffset;
+};
+static_assert(sizeof(StarSnapshotHeader) == 64, "the snapshot header is one 64-byte block");
+
+inline uint64_t alignSnapshotOffset(uint64_t offset)
+{
+  return (offset + STAR_SNAPSHOT_ALIGNMENT - 1) / STAR_SNAPSHOT_ALIGNMENT * STAR_SNAPSHOT_ALIGNMENT;
+}
+
+// writes numStars instance records (stride bytes each, in format) and, when given, their ids
+inline bool saveStarSnapshot(const std::string &path, const GalaxyParams &params, StarInstanceFormat format, const unsigned char *instances,
+                             uint32_t numStars, const std::vector<uint32_t> *ids = NULL)
+{
+  StarSnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, STAR_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = STAR_SNAPSHOT_VERSION;
+  header.layout = format;
+  header.count = numStars;
+  header.stride = static_cast<uint32_t>(starInstanceStride(format));
+  header.seed = params.seed;
+  header.arms = params.arms;
+  header.radius = params.radius;
+  header.payloadOffset = alignSnapshotOffset(sizeof(header));
+  header.payloadBytes = static_cast<uint64_t>(numStars) * header.stride;
+  if (ids != NULL && !ids->empty())
+  {
+    header.flags |= STAR_SNAPSHOT_IDS;
+    header.idsOffset = alignSnapshotOffset(header.payloadOffset + header.payloadBytes);
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file)
+    return false;
+  const char padding[STAR_SNAPSHOT_ALIGNMENT] = {};
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(padding, header.payloadOffset - sizeof(header));
+  file.write(reinterpret_cast<const char *>(instances), header.payloadBytes);
+  if (header.flags & STAR_SNAPSHOT_IDS)
+  {
+    file.write(padding, header.idsOffset - header.payloadOffset - header.payloadBytes);
+    file.write(reinterpret_cast<const char *>(ids->data()), static_cast<std::streamsize>(numStars) * sizeof(uint32_t));
+  }
+  return static_cast<bool>(file);
+}
+
+// a mapped snapshot; load() checks the header against the file size and that the ids are an order of the
+// stars, the instance payload is never parsed
+class StarSnapshot
+{
+public:
+  StarSnapshotHeader header;
+  std::string error;
+  double milliseconds = 0.0;
+
+  bool load(const std::string &path)
+  {
+    auto start = std::chrono::steady_clock::now();
+    error.clear();
+    if (!file.open(path))
+    {
+      error = "cannot map " + path;
+      return false;
+    }
+
+    const uint64_t size = file.size();
+    if (size >= sizeof(header))
+      std::memcpy(&header, file.data(), sizeof(header));
+    if (size < sizeof(header))
+      error = "file too small for a snapshot header";
+    else if (std::memcmp(header.magic, STAR_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+      error = "not a galaxy snapshot";
+    else if (header.version != STAR_SNAPSHOT_VERSION)
+      error = "unsupported snapshot version " + std::to_string(header.version);
+    else if (header.layout > STAR_FORMAT_PACKED || header.stride != starInstanceStride(format()))
+      error = "unknown instance layout";
+    else if (header.payloadOffset % STAR_SNAPSHOT_ALIGNMENT != 0 || header.payloadBytes != static_cast<uint64_t>(header.count) * header.stride ||
+             header.payloadOffset > size || header.payloadBytes > size - header.payloadOffset)
+      error = "instance payload does not fit the file";
+    else if ((header.flags & STAR_SNAPSHOT_IDS) && (header.idsOffset % STAR_SNAPSHOT_ALIGNMENT != 0 || header.idsOffset > size ||
+                                                    static_cast<uint64_t>(header.count) * sizeof(uint32_t) > size - header.idsOffset))
+      error = "star ids do not fit the file";
+    else if ((header.flags & STAR_SNAPSHOT_IDS) &&
+             !isStarPermutation(reinterpret_cast<const uint32_t *>(file.data() + header.idsOffset), header.count))
+      error = "star ids are not a permutation of the stars";
+    if (!error.empty())
+    {
+      file.close();
+      return false;
+    }
+    milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return true;
+  }
+
+  StarInstanceFormat format() const
+  {
+    return static_cast<StarInstanceFormat>(header.layout);
+  }
+
+  // the generator parameters the stars were built with
+  GalaxyParams params() const
+  {
+    GalaxyParams params;
+    params.numStars = header.count;
+    params.seed = header.seed;
+    params.arms = header.arms;
+    params.radius = header.radius;
+    return params;
+  }
+
+  const unsigned char *instances() const
+  {
+    return file.data() + header.payloadOffset;
+  }
+
+  size_t instanceBytes() const
+  {
+    return static_cast<size_t>(header.payloadBytes);
+  }
+
+  // ids[slot] of every stored star, NULL when the stars are in generation order
+  const uint32_t *ids() const
+  {
+    return header.flags & STAR_SNAPSHOT_IDS ? reinterpret_cast<const uint32_t *>(file.data() + header.idsOffset) : NULL;
+  }
+
+private:
+  MappedFile file;
+};
+#endif